@@ -0,0 +1,334 @@
+/**
+ * @file bench_kernels.cpp
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 求交, 遍历, 采样和纹理等核心函数的微基准测试
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "mesh_loader.h"
+#include "perlin.h"
+#include "quad.h"
+#include "rtweekend.h"
+#include "simd_dispatch.h"
+#include "sphere.h"
+#include "texture.h"
+#include "texture_program.h"
+
+// 防止被测代码被编译器优化掉
+static volatile double sink;
+
+struct bench_options {
+  double min_time = 0.2;  // 每个基准测试的最短运行时间(秒)
+  std::string filter;     // 只运行名字包含 filter 的基准测试
+};
+
+/**
+ * @brief 重复运行 body 直到累计时间超过 min_time, 输出 ns/op 和 ops/s.
+ * body 每次调用执行 ops 次被测操作
+ *
+ * @param opt
+ * @param name 基准测试名
+ * @param unit 吞吐量的单位, 如 "rays" 或 "lookups"
+ * @param ops body 每次调用包含的操作数
+ * @param body double body(), 返回值累加到 sink
+ */
+template <typename Body>
+void run_bench(const bench_options& opt, const char* name, const char* unit,
+               size_t ops, const Body& body) {
+  if (!opt.filter.empty() &&
+      std::string(name).find(opt.filter) == std::string::npos)
+    return;
+  using clock = std::chrono::steady_clock;
+  // 预热
+  double acc = body();
+  size_t iterations = 0;
+  auto start = clock::now();
+  double seconds = 0;
+  do {
+    acc += body();
+    iterations++;
+    seconds = std::chrono::duration<double>(clock::now() - start).count();
+  } while (seconds < opt.min_time);
+  sink = acc;
+
+  double total_ops = static_cast<double>(ops) * iterations;
+  std::cout << std::left << std::setw(28) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(2)
+            << seconds * 1e9 / total_ops << " ns/op" << std::setw(14)
+            << std::setprecision(2) << total_ops / seconds / 1e6 << " M"
+            << unit << "/s\n";
+}
+
+// 固定的光线集合: 从半径为 radius 的球面上射向原点附近, 约一半光线击中目标
+std::vector<ray> make_rays(size_t n, double radius, double spread) {
+  seed_random(12345);
+  std::vector<ray> rays;
+  rays.reserve(n);
+  for (size_t k = 0; k < n; k++) {
+    auto origin = radius * random_unit_vector();
+    auto target = spread * vec3::random(-1, 1);
+    rays.emplace_back(origin, target - origin, random_double());
+  }
+  return rays;
+}
+
+/**
+ * @brief 用几个小文件检查网格读取的正确性: OBJ 的四边形/多边形拆分与负数下标,
+ * 列表长度不是 uchar 的二进制 PLY, 以及下标越界的 PLY 被拒绝
+ *
+ * @return true 全部通过
+ */
+bool check_mesh_loaders() {
+  auto dir = std::filesystem::temp_directory_path();
+  auto write = [&](const char* name, const std::string& bytes) {
+    auto path = (dir / name).string();
+    std::ofstream(path, std::ios::binary) << bytes;
+    return path;
+  };
+  bool ok = true;
+  auto expect = [&](const char* name, bool loaded, const mesh_data& mesh,
+                    const std::vector<std::uint32_t>& indices) {
+    if (loaded && mesh.indices == indices) return;
+    std::clog << "网格读取检查失败: " << name << "\n";
+    ok = false;
+  };
+
+  mesh_data mesh;
+  // 四边形与五边形按扇形拆分
+  auto obj = write("rtw_check_ngon.obj",
+                   "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 2 0 0\n"
+                   "f 1 2 3 4\nf 1 2 5 3 4\n");
+  expect("OBJ 多边形", load_obj(obj, mesh, 1), mesh,
+         {0, 1, 2, 0, 2, 3, 0, 1, 4, 0, 4, 2, 0, 2, 3});
+  // 负数下标相对于这一行之前已定义的顶点数
+  obj = write("rtw_check_negative.obj",
+              "v 0 0 0\nv 1 0 0\nv 1 1 0\nf -3 -2 -1\n"
+              "v 0 1 0\nf -4 -2 -1\n");
+  expect("OBJ 负数下标", load_obj(obj, mesh, 1), mesh, {0, 1, 2, 0, 2, 3});
+
+  // 二进制 PLY: 列表长度为 ushort, 下标为 int, 注释中含有 end_header
+  auto ply_face = [](std::uint16_t n, std::initializer_list<std::int32_t> idx) {
+    std::string bytes(reinterpret_cast<const char*>(&n), sizeof(n));
+    for (auto i : idx) bytes.append(reinterpret_cast<const char*>(&i), 4);
+    return bytes;
+  };
+  auto ply = [&](const char* name, std::int32_t last) {
+    std::string bytes =
+        "ply\nformat binary_little_endian 1.0\n"
+        "comment not the end_header\n"
+        "element vertex 4\nproperty float x\nproperty float y\n"
+        "property float z\nelement face 2\n"
+        "property list ushort int vertex_indices\nend_header\n";
+    for (int v = 0; v < 4; v++) {
+      float p[3] = {float(v & 1), float(v >> 1), 0};
+      bytes.append(reinterpret_cast<const char*>(p), sizeof(p));
+    }
+    bytes += ply_face(3, {0, 1, 2});
+    bytes += ply_face(4, {0, 1, 3, last});
+    return write(name, bytes);
+  };
+  expect("PLY ushort 列表", load_ply(ply("rtw_check.ply", 2), mesh, 1), mesh,
+         {0, 1, 2, 0, 1, 3, 0, 3, 2});
+  std::clog << "(以下错误是预期的)\n";
+  if (load_ply(ply("rtw_check_range.ply", 4), mesh, 1) ||
+      load_ply(ply("rtw_check_negative.ply", -1), mesh, 1)) {
+    std::clog << "网格读取检查失败: PLY 下标越界\n";
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  bench_options opt;
+  for (int a = 1; a < argc; a++) {
+    if (!strcmp(argv[a], "--min-time") && a + 1 < argc) {
+      opt.min_time = std::atof(argv[++a]);
+    } else if (!strcmp(argv[a], "--filter") && a + 1 < argc) {
+      opt.filter = argv[++a];
+    } else if (!strcmp(argv[a], "--simd") && a + 1 < argc) {
+      simd_level level;
+      if (!parse_simd_level(argv[++a], level)) {
+        std::clog << "未知的指令集: " << argv[a] << "\n";
+        return -1;
+      }
+      set_simd_level(level);
+    } else {
+      std::clog << "用法: rtw_bench_kernels [--min-time 秒] [--filter 名字]"
+                   " [--simd scalar|sse42|avx2|avx512]\n";
+      return -1;
+    }
+  }
+
+  std::cout << "标量类型: " << (sizeof(real) == 4 ? "float" : "double")
+            << ", sizeof(vec3) = " << sizeof(vec3)
+            << ", sizeof(aabb) = " << sizeof(aabb)
+            << ", sizeof(ray) = " << sizeof(ray) << "\n";
+  std::cout << "指令集: " << simd_level_name(simd().level) << " (CPU 支持 "
+            << simd_level_name(detect_simd_level()) << ")\n";
+
+  if (!check_mesh_loaders()) return 1;
+
+  const size_t n = 4096;
+  auto rays = make_rays(n, 10, 2);
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  const interval ray_t(0.001, infinity);
+
+  {
+    aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+    run_bench(opt, "aabb::hit", "rays", n, [&] {
+      double hits = 0;
+      for (const auto& r : rays) hits += box.hit(r, ray_t);
+      return hits;
+    });
+  }
+  {
+    sphere s(point3(0, 0, 0), 1.5, mat);
+    run_bench(opt, "sphere::hit (static)", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += s.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+    sphere m(point3(0, -0.5, 0), point3(0, 0.5, 0), 1.5, mat);
+    run_bench(opt, "sphere::hit (moving)", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += m.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+  }
+  {
+    quad q(point3(-1.5, -1.5, 0), vec3(3, 0, 0), vec3(0, 3, 0), mat);
+    run_bench(opt, "quad::hit", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += q.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+  }
+  {
+    // hittable_list 中的球与平行四边形走批量求交
+    seed_random(12345);
+    hittable_list spheres;
+    for (int k = 0; k < 64; k++) {
+      spheres.add(make_shared<sphere>(vec3::random(-2, 2), 0.3, mat));
+    }
+    run_bench(opt, "hittable_list::hit (64 spheres)", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += spheres.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+    auto sides = box(point3(-1, -1, -1), point3(1, 1, 1), mat);
+    run_bench(opt, "hittable_list::hit (box quads)", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += sides->hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+    axis_aligned_box solid(point3(-1, -1, -1), point3(1, 1, 1), mat);
+    run_bench(opt, "axis_aligned_box::hit", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += solid.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+  }
+  {
+    // 与 final_scene 中 boxes2 类似的 1000 个小球
+    seed_random(54321);
+    hittable_list spheres;
+    for (int k = 0; k < 1000; k++) {
+      spheres.add(make_shared<sphere>(vec3::random(-2, 2), 0.1, mat));
+    }
+    bvh_node bvh(spheres);
+    run_bench(opt, "bvh_node::hit (1000 spheres)", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += bvh.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+  }
+  {
+    auto boundary = make_shared<sphere>(point3(0, 0, 0), 1.5, mat);
+    constant_medium fog(boundary, 0.5, color(1, 1, 1));
+    run_bench(opt, "constant_medium::hit", "rays", n, [&] {
+      double acc = 0;
+      hit_record rec;
+      for (const auto& r : rays) acc += fog.hit(r, ray_t, rec) ? rec.t : 0;
+      return acc;
+    });
+  }
+  {
+    perlin noise;
+    std::vector<point3> points;
+    for (size_t k = 0; k < n; k++) points.push_back(vec3::random(-50, 50));
+    run_bench(opt, "perlin::turb", "lookups", n, [&] {
+      double acc = 0;
+      for (const auto& p : points) acc += noise.turb(p);
+      return acc;
+    });
+  }
+  {
+    image_texture earth("earthmap.jpg");
+    std::vector<double> uv;
+    for (size_t k = 0; k < 2 * n; k++) uv.push_back(random_double());
+    run_bench(opt, "image_texture::value", "lookups", n, [&] {
+      double acc = 0;
+      for (size_t k = 0; k < n; k++) {
+        acc += earth.value(uv[2 * k], uv[2 * k + 1], point3()).x();
+      }
+      return acc;
+    });
+  }
+  {
+    // 三层嵌套的网格纹理. 外层奇数格子中与外层格子大小相同的网格纹理
+    // 在编译时折叠为常量, 其余叶子内联为 checker_constant
+    auto leaf = [](double scale, double shade) {
+      return make_shared<checker_texture>(scale, color(shade, .1, .1),
+                                          color(.1, shade, .1));
+    };
+    auto folded = make_shared<checker_texture>(1.0, color(.1, .1, .8),
+                                               color(.9, .9, .9));
+    auto even = make_shared<checker_texture>(0.5, leaf(0.25, .8), leaf(0.1, .6));
+    auto odd = make_shared<checker_texture>(0.5, leaf(0.2, .4), folded);
+    checker_texture graph(1.0, even, odd);
+    texture_program program(&graph);
+    std::vector<point3> points;
+    for (size_t k = 0; k < n; k++) points.push_back(vec3::random(-10, 10));
+    run_bench(opt, "texture graph (virtual)", "lookups", n, [&] {
+      double acc = 0;
+      for (const auto& p : points) acc += graph.value(0, 0, p).x();
+      return acc;
+    });
+    run_bench(opt, "texture graph (compiled)", "lookups", n, [&] {
+      double acc = 0;
+      for (const auto& p : points) acc += program.evaluate(0, 0, p).x();
+      return acc;
+    });
+  }
+  run_bench(opt, "random_unit_vector", "samples", n, [&] {
+    double acc = 0;
+    for (size_t k = 0; k < n; k++) acc += random_unit_vector().x();
+    return acc;
+  });
+  return 0;
+}
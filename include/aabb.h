@@ -11,55 +11,63 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include "render_stats.h"
 #include "rtweekend.h"
 
 /**
- * @brief AABB 包围盒类
+ * @brief AABB 包围盒类, 标量类型 T 为 float 或 double
  *
  */
-class aabb {
+template <typename T>
+class basic_aabb {
  public:
+  using interval_type = basic_interval<T>;
+  using vec_type = basic_vec3<T>;
+
   // AABBA包围盒在x,y,z三个维度上的间距
-  interval x, y, z;
+  interval_type x, y, z;
 
-  aabb() {}  // The default AABB is empty, since intervals are empty by default.
+  // The default AABB is empty, since intervals are empty by default.
+  basic_aabb() {}
 
-  aabb(const interval& ix, const interval& iy, const interval& iz)
+  basic_aabb(const interval_type& ix, const interval_type& iy,
+             const interval_type& iz)
       : x(ix), y(iy), z(iz) {}
   // 使用两个点构造三维包围盒
-  aabb(const point3& a, const point3& b) {
+  basic_aabb(const vec_type& a, const vec_type& b) {
     // Treat the two points a and b as extrema for the bounding box, so we don't
     // require a particular minimum/maximum coordinate order.
-    x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
-    y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
-    z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+    x = interval_type(fmin(a[0], b[0]), fmax(a[0], b[0]));
+    y = interval_type(fmin(a[1], b[1]), fmax(a[1], b[1]));
+    z = interval_type(fmin(a[2], b[2]), fmax(a[2], b[2]));
   }
   // 使用两个 AABB包围盒 构造
-  aabb(const aabb& box0, const aabb& box1) {
-    x = interval(box0.x, box1.x);
-    y = interval(box0.y, box1.y);
-    z = interval(box0.z, box1.z);
+  basic_aabb(const basic_aabb& box0, const basic_aabb& box1) {
+    x = interval_type(box0.x, box1.x);
+    y = interval_type(box0.y, box1.y);
+    z = interval_type(box0.z, box1.z);
   }
-  aabb pad() {
+  basic_aabb pad() {
     // Return an AABB that has no side narrower than some delta, padding if
     // necessary.
-    double delta = 0.0001;
-    interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-    interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-    interval new_z = (z.size() >= delta) ? z : z.expand(delta);
-    return aabb(new_x, new_y, new_z);
+    T delta = 0.0001;
+    interval_type new_x = (x.size() >= delta) ? x : x.expand(delta);
+    interval_type new_y = (y.size() >= delta) ? y : y.expand(delta);
+    interval_type new_z = (z.size() >= delta) ? z : z.expand(delta);
+    return basic_aabb(new_x, new_y, new_z);
   }
   // 取出包围盒的某一维的 interval
-  const interval& axis(int n) const {
+  const interval_type& axis(int n) const {
     if (n == 1) return y;
     if (n == 2) return z;
     return x;
   }
   // 计算光线是否与包围盒相交，如果相交返回true并把相交范围存储在 ray_t 中
-  bool hit(const ray& r, interval ray_t) const {
+  bool hit(const basic_ray<T>& r, interval_type ray_t) const {
+    RTW_STAT_INC(aabb_tests);
     for (int a = 0; a < 3; a++) {
       // 计算第 a 维度的交点 t0,t1
-      auto invD = 1.0 / r.direction()[a];
+      T invD = 1 / r.direction()[a];
       auto orig = r.origin()[a];
 
       auto t0 = (axis(a).min - orig) * invD;
@@ -82,9 +90,17 @@ class aabb {
   }
 };
 
+// 渲染器使用的包围盒类型, 精度由 real 决定(见 rtweekend.h)
+using aabb = basic_aabb<real>;
+
 // aabb包围盒平移运算
-aabb operator+(const aabb& bbox, const vec3& offset) {
-  return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
+template <typename T>
+basic_aabb<T> operator+(const basic_aabb<T>& bbox, const basic_vec3<T>& offset) {
+  return basic_aabb<T>(bbox.x + offset.x(), bbox.y + offset.y(),
+                       bbox.z + offset.z());
+}
+template <typename T>
+basic_aabb<T> operator+(const basic_vec3<T>& offset, const basic_aabb<T>& bbox) {
+  return bbox + offset;
 }
-aabb operator+(const vec3& offset, const aabb& bbox) { return bbox + offset; }
 #endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+/**
+ * @file asset_cache.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 进程内共享的资源缓存: 按解析后的路径缓存只读的图片与 mip 金字塔
+ * @version 0.1
+ * @date 2023-09-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mipmap.h"
+#include "parallel.h"
+#include "rtw_stb_image.h"
+#include "texel_storage.h"
+#include "trace.h"
+
+/**
+ * @brief 资源缓存. 同一个文件(按 find_image_file() 解析后的路径区分)
+ * 只解码一次, 所有 image_texture 共享同一份只读的图片与 mip 金字塔.
+ * 多个线程同时请求同一个资源时只有一个线程解码, 其他线程等待其结果
+ *
+ */
+class asset_cache {
+ public:
+  static asset_cache& instance() {
+    static asset_cache cache;
+    return cache;
+  }
+
+  asset_cache(const asset_cache&) = delete;
+  asset_cache& operator=(const asset_cache&) = delete;
+
+  // 解析图片文件名, 每个文件名只查找一次. 找不到时返回文件名本身
+  std::string resolve(const std::string& filename) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = resolved.find(filename);
+      if (it != resolved.end()) return it->second;
+    }
+    auto path = find_image_file(filename);
+    if (path.empty()) path = filename;
+    std::lock_guard<std::mutex> lock(mutex);
+    return resolved.emplace(filename, path).first->second;
+  }
+
+  // 解码后的图片, 加载失败时宽高为 0
+  std::shared_ptr<const rtw_image> image(const std::string& filename) {
+    auto path = resolve(filename);
+    return get_or_create(images, path, [&] { return load_image(path); });
+  }
+
+  /**
+   * @brief 图片以 options 指定的存储方式构建的 mip 金字塔, 加载失败时没有任何层.
+   * 金字塔复制了原图, 因此只为构建金字塔而解码的图片不会留在缓存中
+   *
+   */
+  std::shared_ptr<const mip_pyramid> pyramid(
+      const std::string& filename,
+      texel_storage_options options = default_texel_storage()) {
+    auto path = resolve(filename);
+    auto key = path + "|" + texel_layout_name(options.layout) + "|" +
+               texel_format_name(options.format);
+    return get_or_create(pyramids, key, [&] {
+      auto img = find(images, path);
+      if (!img) img = load_image(path);
+      auto mips = std::make_shared<mip_pyramid>();
+      if (img->height() > 0) {
+        mips->build(img->pixel_data(0, 0), img->width(), img->height(),
+                    options);
+      }
+      return std::shared_ptr<const mip_pyramid>(mips);
+    });
+  }
+
+  /**
+   * @brief 在构建场景之前并行解码图片并以默认存储方式构建 mip 金字塔
+   *
+   * @param filenames 图片文件名, 重复或已缓存的文件不会再次解码
+   * @param thread_count 线程数, <=0 时使用全部硬件线程
+   */
+  void preload(const std::vector<std::string>& filenames,
+               int thread_count = 0) {
+    trace_scope scope("asset_cache::preload", "texture");
+    auto options = default_texel_storage();
+    // 只有一张图片时直接在当前线程读入
+    if (filenames.size() == 1) {
+      pyramid(filenames[0], options);
+      return;
+    }
+    parallel_for(static_cast<int>(filenames.size()),
+                 resolve_thread_count(thread_count),
+                 [&](int k, int) { pyramid(filenames[k], options); });
+  }
+
+  // 所有缓存的资源占用的内存(字节)
+  size_t memory_bytes() {
+    size_t bytes = 0;
+    for (const auto& entry : snapshot(images)) {
+      bytes += entry.second->memory_bytes();
+    }
+    for (const auto& entry : snapshot(pyramids)) {
+      bytes += entry.second->memory_bytes();
+    }
+    return bytes;
+  }
+
+  // 输出每个缓存资源的内存占用与共享数(缓存之外的引用数), 以及缓存的命中次数
+  void report(std::ostream& out) {
+    out << "asset cache: " << hits << " hits, " << misses << " loads, "
+        << memory_bytes() / 1024 << " KB\n";
+    for (const auto& entry : snapshot(images)) {
+      out << "  image    " << std::setw(10)
+          << entry.second->memory_bytes() / 1024 << " KB  "
+          << entry.second->width() << "x" << entry.second->height()
+          << "  users " << entry.second.use_count() - 2 << "  " << entry.first
+          << '\n';
+    }
+    for (const auto& entry : snapshot(pyramids)) {
+      out << "  mipmap   " << std::setw(10)
+          << entry.second->memory_bytes() / 1024 << " KB  "
+          << entry.second->level_count() << " levels  users "
+          << entry.second.use_count() - 2 << "  " << entry.first << '\n';
+    }
+  }
+
+  // 释放缓存中的资源, 仍被纹理引用的资源在最后一个引用消失时释放
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    images.clear();
+    pyramids.clear();
+    resolved.clear();
+  }
+
+ private:
+  template <typename T>
+  using entry_map =
+      std::map<std::string, std::shared_future<std::shared_ptr<const T>>>;
+
+  std::mutex mutex;
+  std::map<std::string, std::string> resolved;  // 文件名 -> 解析后的路径
+  entry_map<rtw_image> images;                  // 路径 -> 图片
+  entry_map<mip_pyramid> pyramids;  // 路径|排列|格式 -> mip 金字塔
+  std::atomic<std::uint64_t> hits{0}, misses{0};
+
+  asset_cache() {}
+
+  static std::shared_ptr<const rtw_image> load_image(const std::string& path) {
+    auto img = std::make_shared<rtw_image>();
+    if (!img->load(path)) {
+      std::cerr << "ERROR: Could not load image file '" << path << "'.\n";
+    }
+    return img;
+  }
+
+  // 查找 key 对应的资源, 不存在时由当前线程调用 make() 创建.
+  // 创建与等待其他线程创建时都不持有锁
+  template <typename T, typename Make>
+  std::shared_ptr<const T> get_or_create(entry_map<T>& map,
+                                         const std::string& key,
+                                         const Make& make) {
+    std::promise<std::shared_ptr<const T>> promise;
+    std::shared_future<std::shared_ptr<const T>> existing;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = map.find(key);
+      if (it != map.end()) {
+        existing = it->second;
+      } else {
+        map.emplace(key, promise.get_future().share());
+      }
+    }
+    if (existing.valid()) {
+      hits++;
+      return existing.get();
+    }
+    misses++;
+    auto value = make();
+    promise.set_value(value);
+    return value;
+  }
+
+  // 已经创建完成的资源 key 对应的值, 不存在或正在创建时返回空
+  template <typename T>
+  std::shared_ptr<const T> find(entry_map<T>& map, const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = map.find(key);
+    if (it == map.end() || it->second.wait_for(std::chrono::seconds(0)) !=
+                               std::future_status::ready) {
+      return nullptr;
+    }
+    return it->second.get();
+  }
+
+  // 已经创建完成的资源, 正在创建的资源不包括在内
+  template <typename T>
+  std::vector<std::pair<std::string, std::shared_ptr<const T>>> snapshot(
+      entry_map<T>& map) {
+    std::vector<std::pair<std::string, std::shared_ptr<const T>>> entries;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry : map) {
+      if (entry.second.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready) {
+        entries.emplace_back(entry.first, entry.second.get());
+      }
+    }
+    return entries;
+  }
+};
+
+#endif
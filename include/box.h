@@ -0,0 +1,129 @@
+/**
+ * @file box.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 轴对齐长方体类: 一次 slab 测试求交, 代替六个四边形
+ * @version 0.1
+ * @date 2023-09-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef BOX_H
+#define BOX_H
+
+#include <cmath>
+
+#include "hittable.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+
+/**
+ * @brief 轴对齐长方体. 只保存两个角点与材料; 交点的法向与纹理坐标由击中的
+ * 坐标轴与面(最小/最大)得到, 与 box() 构造的六个四边形的参数化相同
+ *
+ */
+class axis_aligned_box : public hittable {
+ public:
+  // 以两个相对的顶点构造, 不要求坐标的大小顺序
+  axis_aligned_box(const point3& a, const point3& b, shared_ptr<material> m)
+      : bounds(a, b), mat(m) {}
+
+  aabb bounding_box() const override {
+    aabb box = bounds;
+    return box.pad();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RTW_STAT_INC(box_tests);
+    // 光线进入与离开长方体的距离, 以及对应的坐标轴
+    real t_near = -infinity, t_far = infinity;
+    int near_axis = -1, far_axis = -1;
+    for (int a = 0; a < 3; a++) {
+      real inv_d = 1 / r.direction()[a];
+      real t0 = (bounds.axis(a).min - r.origin()[a]) * inv_d;
+      real t1 = (bounds.axis(a).max - r.origin()[a]) * inv_d;
+      if (inv_d < 0) std::swap(t0, t1);
+      // 光线在平面上时 0*inf 为 NaN, 比较为 false, 这一维不限制范围
+      if (t0 > t_near) {
+        t_near = t0;
+        near_axis = a;
+      }
+      if (t1 < t_far) {
+        t_far = t1;
+        far_axis = a;
+      }
+    }
+    if (t_near > t_far) return false;
+    // 起点在长方体外时交于进入的面, 在内部(或进入点不在范围内)时交于离开的面
+    real t;
+    int axis;
+    bool max_face;
+    if (near_axis >= 0 && ray_t.surrounds(t_near)) {
+      t = t_near;
+      axis = near_axis;
+      max_face = r.direction()[axis] < 0;
+    } else if (far_axis >= 0 && ray_t.surrounds(t_far)) {
+      t = t_far;
+      axis = far_axis;
+      max_face = r.direction()[axis] > 0;
+    } else {
+      return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.mat = mat;
+    vec3 outward(0, 0, 0);
+    outward[axis] = max_face ? 1 : -1;
+    rec.set_face_normal(r, outward);
+    set_face_uv(rec, axis, max_face);
+    set_face_footprint(r, rec, axis);
+    return true;
+  }
+
+ private:
+  aabb bounds;  // 长方体本身, 不填充厚度
+  shared_ptr<material> mat;
+
+  // 点 p 在 axis 维上的相对位置, from_max 为 true 时从最大值一侧开始计算
+  real relative(const point3& p, int axis, bool from_max) const {
+    const auto& i = bounds.axis(axis);
+    real size = i.size();
+    if (size <= 0) return 0;
+    return (from_max ? i.max - p[axis] : p[axis] - i.min) / size;
+  }
+
+  // 与 box() 中六个四边形相同的纹理坐标
+  void set_face_uv(hit_record& rec, int axis, bool max_face) const {
+    switch (axis) {
+      case 0:  // 右(max, u 沿 -z)与左(min, u 沿 +z), v 沿 +y
+        rec.u = relative(rec.p, 2, max_face);
+        rec.v = relative(rec.p, 1, false);
+        break;
+      case 1:  // 上(max, v 沿 -z)与下(min, v 沿 +z), u 沿 +x
+        rec.u = relative(rec.p, 0, false);
+        rec.v = relative(rec.p, 2, max_face);
+        break;
+      default:  // 前(max, u 沿 +x)与后(min, u 沿 -x), v 沿 +y
+        rec.u = relative(rec.p, 0, !max_face);
+        rec.v = relative(rec.p, 1, false);
+    }
+  }
+
+  // 纹理坐标 [0,1] 对应面的两条边长
+  void set_face_footprint(const ray& r, hit_record& rec, int axis) const {
+    real dx = bounds.x.size(), dy = bounds.y.size(), dz = bounds.z.size();
+    switch (axis) {
+      case 0:
+        rec.set_footprint(r, dz, dy);
+        break;
+      case 1:
+        rec.set_footprint(r, dx, dz);
+        break;
+      default:
+        rec.set_footprint(r, dx, dy);
+    }
+  }
+};
+
+#endif
@@ -14,7 +14,10 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "render_stats.h"
 #include "rtweekend.h"
+#include "simd_dispatch.h"
+#include "trace.h"
 
 /**
  * @brief BVH 类,
@@ -27,9 +30,176 @@ class bvh_node : public hittable {
 
   bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start,
            size_t end) {
-    auto objects =
-        src_objects;  // Create a modifiable array of the source scene objects
+    trace_scope scope("bvh_node build", "scene", end - start);
+    // 整棵树共用一个可修改的数组, 每个节点只排序自己的区间
+    auto objects = src_objects;
+    build(objects, start, end);
+  }
+
+  // 只供 build() 创建子节点使用
+  struct build_tag {};
+  explicit bvh_node(build_tag) {}
+
+  /**
+   * @brief 判断光线是否与 bvh 树中的某个物体在合法范围内相交,如果相交返回true，
+   * 并将交点为信息存储在 rec 中
+   * @param r 入射光线
+   * @param ray_t 入射光线的合法范围
+   * @param rec 如果存在合法的交点, rec内部存储交点信息
+   * @return true
+   * @return false
+   */
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RTW_STAT_INC(bvh_nodes_visited);
+    if (!bbox.hit(r, ray_t)) return false;
+    return hit_children(r, node_ray(r), ray_t, rec);
+  }
+
+  /**
+   * @brief 光线包与 bvh 树求交: 每个节点先用整个包的视锥测试子节点的包围盒,
+   * 再只对仍可能相交的光线逐条测试; 只剩一条光线时退回单条光线的遍历
+   *
+   */
+  std::uint32_t hit_packet(ray_packet& packet, std::uint32_t active,
+                           hit_record* recs) const override {
+    RTW_STAT_INC(bvh_nodes_visited);
+    std::uint32_t inside = 0;
+    for_each_lane(active, [&](int l) {
+      if (bbox.hit(packet.rays[l], interval(packet.tmin[l], packet.tmax[l])))
+        inside |= 1u << l;
+    });
+    if (!inside) return 0;
+    return hit_children_packet(packet, inside, recs);
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+ private:
+  /**
+   * @brief box_hit2 需要的光线数据, 每条光线在根节点计算一次
+   *
+   */
+  struct node_ray {
+    real orig[8];
+    real inv_dir[8];
+
+    explicit node_ray(const ray& r) {
+      for (int c = 0; c < 2; c++) {
+        for (int a = 0; a < 3; a++) {
+          orig[c * 4 + a] = r.origin()[a];
+          inv_dir[c * 4 + a] = 1 / r.direction()[a];
+        }
+        orig[c * 4 + 3] = 0;
+        inv_dir[c * 4 + 3] = 1;
+      }
+    }
+
+    // 光线包中的第 l 条光线, 方向的倒数已经在 ray_packet::prepare() 中算好
+    node_ray(const ray_packet& packet, int l) {
+      for (int c = 0; c < 2; c++) {
+        for (int a = 0; a < 3; a++) {
+          orig[c * 4 + a] = packet.orig[a][l];
+          inv_dir[c * 4 + a] = packet.inv_dir[a][l];
+        }
+        orig[c * 4 + 3] = 0;
+        inv_dir[c * 4 + 3] = 1;
+      }
+    }
+  };
+
+  shared_ptr<hittable> left;
+  shared_ptr<hittable> right;
+  aabb bbox;
+  alignas(64) real child_min[8];
+  alignas(64) real child_max[8];
+  // 子节点也是 bvh_node 时直接调用 hit_children(), 省去重复的包围盒测试
+  const bvh_node* left_node = nullptr;
+  const bvh_node* right_node = nullptr;
+
+  // 深度搜索(递归), 调用前光线已经与本节点的包围盒相交,
+  // 只进入包围盒与光线相交的孩子节点
+  bool hit_children(const ray& r, const node_ray& nr, interval ray_t,
+                    hit_record& rec) const {
+    // 与逐层调用 hit() 的计数相同: 测试过包围盒的 bvh_node 子节点都算访问过
+    RTW_STAT_ADD(bvh_nodes_visited,
+                 (left_node ? 1 : 0) + (right_node && right != left ? 1 : 0));
+    RTW_STAT_ADD(aabb_tests, 2);
+    int mask = simd().box_hit2(child_min, child_max, nr.orig, nr.inv_dir,
+                               ray_t.min, ray_t.max);
+
+    bool hit_left =
+        (mask & 1) && hit_child(left, left_node, r, nr, ray_t, rec);
+    // 只有一个物体时 left 与 right 相同
+    bool hit_right =
+        (mask & 2) && right != left &&
+        hit_child(right, right_node, r, nr,
+                  interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+    return hit_left || hit_right;
+  }
+
+  static bool hit_child(const shared_ptr<hittable>& child, const bvh_node* node,
+                        const ray& r, const node_ray& nr, interval ray_t,
+                        hit_record& rec) {
+    if (node) return node->hit_children(r, nr, ray_t, rec);
+    return child->hit(r, ray_t, rec);
+  }
+
+  // hit_children() 的光线包版本, 调用前 active 中的光线都与本节点的包围盒相交
+  std::uint32_t hit_children_packet(ray_packet& packet, std::uint32_t active,
+                                    hit_record* recs) const {
+    if ((active & (active - 1)) == 0) {
+      // 光线包已经分散到只剩一条光线
+      int l = lowest_lane(active);
+      if (!hit_children(packet.rays[l], node_ray(packet, l),
+                        interval(packet.tmin[l], packet.tmax[l]), recs[l]))
+        return 0;
+      packet.tmax[l] = recs[l].t;
+      return active;
+    }
+
+    std::uint32_t hits = 0;
+    // 先左后右, 与 hit_children() 相同; 右节点使用左节点更新后的 tmax
+    for (int c = 0; c < 2; c++) {
+      if (c == 1 && right == left) break;
+      const bvh_node* node = c == 0 ? left_node : right_node;
+      if (node) RTW_STAT_INC(bvh_nodes_visited);
+      std::uint32_t mask = child_mask(packet, active, c);
+      if (!mask) continue;
+      const auto& child = c == 0 ? left : right;
+      hits |= node ? node->hit_children_packet(packet, mask, recs)
+                   : child->hit_packet(packet, mask, recs);
+    }
+    return hits;
+  }
+
+  // active 中与第 c 个子节点的包围盒相交的光线
+  std::uint32_t child_mask(const ray_packet& packet, std::uint32_t active,
+                           int c) const {
+    const real* box_min = child_min + c * 4;
+    const real* box_max = child_max + c * 4;
+    real tmax_hi = -infinity;
+    for_each_lane(active,
+                  [&](int l) { tmax_hi = std::fmax(tmax_hi, packet.tmax[l]); });
+    RTW_STAT_INC(frustum_tests);
+    if (!packet.frustum_may_hit(box_min, box_max, tmax_hi)) {
+      RTW_STAT_INC(frustum_culls);
+      return 0;
+    }
+    std::uint32_t mask = 0;
+    for_each_lane(active, [&](int l) {
+      RTW_STAT_INC(aabb_tests);
+      if (packet.lane_hit(l, box_min, box_max)) mask |= 1u << l;
+    });
+    return mask;
+  }
 
+  /**
+   * @brief 在 objects 的 [start, end) 上递归构建, 会修改这一区间内物体的顺序
+   *
+   */
+  void build(std::vector<shared_ptr<hittable>>& objects, size_t start,
+             size_t end) {
     // 随机选择一个对比轴进行划分
     int axis = random_int(0, 2);
     auto comparator = (axis == 0)   ? box_x_compare
@@ -59,42 +229,31 @@ class bvh_node : public hittable {
 
       auto mid = start + object_span / 2;
       // 前一半的物体放到 left 节点
-      left = make_shared<bvh_node>(objects, start, mid);
+      auto left_child = make_shared<bvh_node>(build_tag());
+      left_child->build(objects, start, mid);
+      left = left_child;
       // 后一半的物体放到 right 节点
-      right = make_shared<bvh_node>(objects, mid, end);
+      auto right_child = make_shared<bvh_node>(build_tag());
+      right_child->build(objects, mid, end);
+      right = right_child;
     }
     // 根据左右节点的 bbox 更新本节点的 bbox
     bbox = aabb(left->bounding_box(), right->bounding_box());
-  }
 
-  /**
-   * @brief 判断光线是否与 bvh 树中的某个物体在合法范围内相交,如果相交返回true，
-   * 并将交点为信息存储在 rec 中
-   * @param r 入射光线
-   * @param ray_t 入射光线的合法范围
-   * @param rec 如果存在合法的交点, rec内部存储交点信息
-   * @return true
-   * @return false
-   */
-  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    if (!bbox.hit(r, ray_t)) return false;
-
-    // 深度搜索(递归), 不断搜索节点 bvh_node 的孩子节点
-    // 直到与 bvh_node 没有相交或者直到叶子节点
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right =
-        right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-    return hit_left || hit_right;
+    // 两个子节点的包围盒按 [x0,y0,z0,pad,x1,y1,z1,pad] 存放, 供 box_hit2 使用
+    for (int c = 0; c < 2; c++) {
+      auto box = (c == 0 ? left : right)->bounding_box();
+      for (int a = 0; a < 3; a++) {
+        child_min[c * 4 + a] = box.axis(a).min;
+        child_max[c * 4 + a] = box.axis(a).max;
+      }
+      child_min[c * 4 + 3] = -infinity;
+      child_max[c * 4 + 3] = +infinity;
+    }
+    left_node = dynamic_cast<const bvh_node*>(left.get());
+    right_node = dynamic_cast<const bvh_node*>(right.get());
   }
 
-  aabb bounding_box() const override { return bbox; }
-
- private:
-  shared_ptr<hittable> left;
-  shared_ptr<hittable> right;
-  aabb bbox;
-
   // 按照某维度进行比较的函数
   static bool box_compare(const shared_ptr<hittable> a,
                           const shared_ptr<hittable> b, int axis_index) {
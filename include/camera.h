@@ -10,11 +10,35 @@
  */
 #ifndef CAMERA_H
 #define CAMERA_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
 #include "color.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "parallel.h"
+#include "perf_counter.h"
+#include "render_stats.h"
 #include "rtweekend.h"
+#include "trace.h"
+#include "wavefront.h"
 /**
  * @brief class camera
  *
@@ -36,34 +60,79 @@ class camera {
   double defocus_angle = 0;  // 模拟实际相机的散射角度(以实现景深效果
   double focus_dist = 10;  // 模拟实际相机的理想焦距(以实现景深效果)
 
+  bool progressive = false;  // 渐进式渲染: 整幅图像按采样数逐轮翻倍的方式多轮渲染
+  std::string preview_path = "preview.ppm";  // 渐进式渲染的预览图路径
+  double preview_interval = 10;  // 渐进式渲染写出预览图的最小时间间隔(秒)
+
+  int thread_count = 0;  // 渲染线程数, <=0 时使用硬件支持的并发线程数
+  // 渲染时间预算(秒), >0 时忽略 samples_per_pixel,
+  // 在截止时间之前不断地为整幅图像追加采样
+  double time_budget = 0;
+  // 渲染结束时以 JSON 格式写出性能计数器的路径, 为空则只输出到 std::clog
+  std::string stats_json_path;
+  // 代价热力图的输出路径, 不为空时记录每个像素的求交代价并输出伪彩色图
+  std::string heatmap_path;
+  // 热力图的代价度量: true 使用 CPU 周期数(rdtsc), false 使用 BVH
+  // 节点访问数+图元求交测试数(需要 RTW_ENABLE_STATS)
+  bool heatmap_cycles = false;
+  // 相机光线的光线包大小(4/8/16), 同一行相邻像素的光线打包后与场景求交;
+  // <=1 时逐条光线求交. 打包改变了随机数的使用顺序, 图像只在噪声上不同
+  int packet_size = 0;
+  // wavefront 渲染: 一次生成一大批路径, 按求交, 着色等阶段分别在整批光线上
+  // 并行执行. 与逐条光线递归追踪的图像只在噪声上不同
+  bool wavefront = false;
+  int wavefront_size = 1 << 18;  // 每批路径数的上限
+  // wavefront 渲染时, 在每次反射光线求交之前按起点与方向的 Morton 码排序,
+  // 使相邻的光线访问相近的 BVH 节点
+  bool wavefront_sort = false;
+
+  bool show_progress = true;  // 是否在 std::clog 输出渲染进度
+
   /* Public Camera Parameters Here */
   /**
-   * @brief
+   * @brief 渲染场景 world, 并将 PPM 格式的图像写到 std::cout
    *
    * @param world
    */
-  void render(const hittable_list& world) {
+  void render(const hittable_list& world) { render(world, std::cout); }
+
+  /**
+   * @brief 渲染场景 world, 并将 PPM 格式的图像写到 out
+   *
+   * @param world
+   * @param out 输出流
+   */
+  void render(const hittable_list& world, std::ostream& out) {
+    trace_scope scope("camera::render", "render");
     initialize();
-    // Render
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-    for (int j = 0; j < image_height; ++j) {
-      std::clog << "\rScanlines remaining: " << (image_height - j) << ' '
-                << std::flush;
-      for (int i = 0; i < image_width; ++i) {
-        color pixel_color;
-        for (int sample = 0; sample < samples_per_pixel; sample++) {
-          // 计算像素(i,j)位置处的入射光线
-          auto r = get_ray(i, j);
-          // 光线跟踪主程序, 计算入射光线r经过"光线跟踪"后所附带的颜色值
-          pixel_color += ray_color(r, max_depth, world);
-        }
-        write_color(std::cout, pixel_color, samples_per_pixel);
-      }
+    if (time_budget > 0) {
+      render_time_budget(world);
+    } else if (progressive) {
+      render_progressive(world);
+    } else if (wavefront) {
+      render_wavefront(world);
+    } else {
+      render_scanlines(world);
     }
+    write_image(out);
 
-    std::clog << "\rDone.                 \n";
+    if (show_progress) std::clog << "\rDone.                 \n";
+    report_stats();
+    if (record_heatmap) write_heatmap();
   }
 
+  // 最近一次渲染的性能计数器(需要定义 RTW_ENABLE_STATS)
+  const render_stats& stats() const { return last_stats; }
+
+  // 最近一次渲染追踪的光线总数
+  std::uint64_t rays_traced() const { return traced_rays; }
+
+  // 最近一次 wavefront 渲染中求交阶段的耗时与缓存未命中数
+  const wavefront_profile& wavefront_stats() const { return profile; }
+
+  // 最近一次渲染中调度器记录的每个线程的忙碌/空闲时间
+  const parallel_stats& schedule_stats() const { return schedule; }
+
  private:
   int image_height;    // 图像的高(像素数)
   point3 center;       // 相机位置, 与 lookfrom 相同
@@ -76,6 +145,19 @@ class camera {
   vec3 defocus_disk_u;  // u方向散焦半径
   vec3 defocus_disk_v;  // v方向散焦半径
 
+  std::vector<color> accum;        // 每个像素累加的颜色值
+  std::vector<int> pixel_samples;  // 每个像素已累加的采样光线数
+  std::vector<double> pixel_cost;  // 每个像素累加的求交代价(热力图)
+  bool record_heatmap = false;     // 本次渲染是否记录热力图
+  bool cost_in_cycles = false;     // 本次渲染的热力图是否以 CPU 周期数为代价
+  std::vector<std::mutex> row_locks;  // 每行累加结果时使用的锁
+  int threads;                        // 实际使用的渲染线程数
+  render_stats last_stats;            // 本次渲染的性能计数器
+  std::atomic<std::uint64_t> traced_rays{0};  // 本次渲染追踪的光线总数
+  parallel_stats schedule;  // 本次渲染的调度统计
+  wavefront_profile profile;  // 本次 wavefront 渲染的求交阶段统计
+  std::mutex stats_mutex;             // 合并各线程计数器时使用的锁
+
   /* Private Camera Variables Here */
   void initialize() {
     // Calculate the image height, and ensure that it's at least 1.
@@ -127,6 +209,633 @@ class camera {
     defocus_disk_u = defocus_radius * u;
     // v方向的散焦向量
     defocus_disk_v = defocus_radius * v;
+
+    accum.assign(image_width * image_height, color(0, 0, 0));
+    pixel_samples.assign(image_width * image_height, 0);
+    if (wavefront && (progressive || time_budget > 0)) {
+      std::clog << "Wavefront mode is ignored with progressive or time budget "
+                   "rendering.\n";
+    }
+    // 用户设置的 heatmap_path/heatmap_cycles 保持不变, 实际使用的设置
+    // 保存在 record_heatmap/cost_in_cycles 中
+    record_heatmap = !heatmap_path.empty();
+    cost_in_cycles = heatmap_cycles;
+    if (record_heatmap && wavefront) {
+      std::clog << "Traversal cost heatmap is not supported in wavefront "
+                   "mode.\n";
+      record_heatmap = false;
+    }
+#ifndef RTW_ENABLE_STATS
+    if (record_heatmap && !cost_in_cycles) {
+      std::clog << "Traversal cost heatmap needs -DRTW_ENABLE_STATS=ON, "
+                   "using CPU cycles instead.\n";
+      cost_in_cycles = true;
+    }
+#endif
+    pixel_cost.assign(record_heatmap ? image_width * image_height : 0, 0.0);
+    row_locks = std::vector<std::mutex>(image_height);
+    threads = resolve_thread_count(thread_count);
+    last_stats = render_stats();
+    traced_rays = 0;
+    schedule = parallel_stats();
+    profile = wavefront_profile();
+  }
+
+  /**
+   * @brief 逐行渲染, 每个像素一次性采样 samples_per_pixel 条光线,
+   * 各线程动态领取扫描行
+   *
+   * @param world
+   */
+  void render_scanlines(const hittable_list& world) {
+    std::atomic<int> remaining(image_height);
+    std::mutex log_mutex;
+    parallel_for(
+        image_height, threads,
+        [&](int j, int) {
+          render_scanline(world, j, samples_per_pixel, 0);
+          int left = --remaining;
+          if (!show_progress) return;
+          std::lock_guard<std::mutex> lock(log_mutex);
+          std::clog << "\rScanlines remaining: " << left << ' ' << std::flush;
+        },
+        &schedule);
+  }
+
+  /**
+   * @brief 渐进式渲染, 每一轮对整幅图像的每个像素采样 1,2,4,8... 条光线,
+   * 直到累计采样数达到 samples_per_pixel. 每隔 preview_interval
+   * 秒把当前结果写到 preview_path, 便于尽早发现有问题的渲染任务
+   *
+   * @param world
+   */
+  void render_progressive(const hittable_list& world) {
+    using clock = std::chrono::steady_clock;
+    auto last_preview = clock::now();
+    int total = 0;
+    int pass_samples = 1;
+    for (int pass = 1; total < samples_per_pixel; ++pass) {
+      int n = std::min(pass_samples, samples_per_pixel - total);
+      parallel_for(
+          image_height, threads,
+          [&](int j, int) { render_scanline(world, j, n, pass); }, &schedule);
+      total += n;
+      pass_samples *= 2;
+      if (show_progress) {
+        std::clog << "\rPass " << pass << ": " << total << '/'
+                  << samples_per_pixel << " samples per pixel " << std::flush;
+      }
+
+      auto now = clock::now();
+      if (std::chrono::duration<double>(now - last_preview).count() >=
+              preview_interval ||
+          total == samples_per_pixel) {
+        write_preview();
+        last_preview = now;
+      }
+    }
+  }
+
+  /**
+   * @brief 按时间预算渲染: 所有线程不断领取 (轮次, 扫描行) 任务,
+   * 每个任务为该行每个像素追加一条采样光线, 直到超过 time_budget.
+   * 结束时各像素按实际获得的采样数归一化, 并报告实际的 spp 和 rays/s
+   *
+   * @param world
+   */
+  void render_time_budget(const hittable_list& world) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto deadline =
+        start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(time_budget));
+
+    parallel_until(
+        threads,
+        [&](int index, int) {
+          if (clock::now() >= deadline) return false;
+          int pass = index / image_height;
+          int j = index % image_height;
+          render_scanline(world, j, 1, pass);
+          if (show_progress && j == image_height - 1) {
+            std::clog << "\rPass " << pass + 1 << " done " << std::flush;
+          }
+          return true;
+        },
+        &schedule);
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    auto minmax =
+        std::minmax_element(pixel_samples.begin(), pixel_samples.end());
+    double mean = 0;
+    for (auto n : pixel_samples) mean += n;
+    mean /= pixel_samples.size();
+    std::clog << "\nTime budget: " << time_budget << "s, rendered "
+              << seconds << "s with " << threads << " threads\n"
+              << "Achieved spp: min " << *minmax.first << ", mean " << mean
+              << ", max " << *minmax.second << '\n'
+              << "Rays: " << traced_rays << " (" << traced_rays / seconds
+              << " rays/s)\n";
+  }
+
+  /**
+   * @brief 对第 j 行的每个像素追加 n 条采样光线, 结果累加到 accum 中.
+   * 随机数种子只由 (pass, j) 决定, 因此结果与线程数及调度顺序无关
+   *
+   * @param world
+   * @param j 行号
+   * @param n 每个像素追加的采样光线数
+   * @param pass 渲染轮次
+   * @return std::uint64_t 本次追踪的光线数
+   */
+  std::uint64_t render_scanline(const hittable_list& world, int j, int n,
+                                int pass) {
+    trace_scope scope("scanline", "render", j);
+    seed_random(scanline_seed(pass, j));
+    std::uint64_t rays = 0;
+    std::vector<color> row(image_width);
+    std::vector<double> row_cost(record_heatmap ? image_width : 0);
+    if (packet_size > 1 && max_depth > 0) {
+      render_packets(world, j, n, row, row_cost, rays);
+    } else {
+      for (int i = 0; i < image_width; ++i) {
+        double cost_start = row_cost.empty() ? 0 : pixel_work();
+        for (int sample = 0; sample < n; sample++) {
+          // 计算像素(i,j)位置处的入射光线
+          auto r = get_ray(i, j);
+          RTW_STAT_INC(camera_rays);
+          // 光线跟踪主程序, 计算入射光线r经过"光线跟踪"后所附带的颜色值
+          row[i] += ray_color(r, max_depth, world, rays);
+        }
+        if (!row_cost.empty()) row_cost[i] = pixel_work() - cost_start;
+      }
+    }
+
+    // 时间预算模式下同一行的不同轮次可能同时被不同线程渲染
+    std::lock_guard<std::mutex> lock(row_locks[j]);
+    for (int i = 0; i < image_width; ++i) {
+      accum[j * image_width + i] += row[i];
+      pixel_samples[j * image_width + i] += n;
+      if (!row_cost.empty()) pixel_cost[j * image_width + i] += row_cost[i];
+    }
+    traced_rays += rays;
+    flush_thread_stats();
+    return rays;
+  }
+
+  /**
+   * @brief render_scanline() 的光线包版本: 第 j 行每 packet_size
+   * 个相邻像素的同一次采样组成一个光线包, 整包与场景求交后再逐条着色.
+   * 只有相机光线打包, 反射光线仍逐条追踪
+   *
+   */
+  void render_packets(const hittable_list& world, int j, int n,
+                      std::vector<color>& row, std::vector<double>& row_cost,
+                      std::uint64_t& rays) const {
+    int size = std::min(packet_size, ray_packet::max_size);
+    ray_packet packet;
+    hit_record recs[ray_packet::max_size];
+    for (int i0 = 0; i0 < image_width; i0 += size) {
+      packet.size = std::min(size, image_width - i0);
+      double cost_start = row_cost.empty() ? 0 : pixel_work();
+      for (int sample = 0; sample < n; sample++) {
+        for (int l = 0; l < packet.size; l++) {
+          packet.rays[l] = get_ray(i0 + l, j);
+          packet.tmin[l] = 0.001;
+          packet.tmax[l] = infinity;
+        }
+        packet.prepare();
+        RTW_STAT_ADD(camera_rays, packet.size);
+        rays += packet.size;
+        auto all = (std::uint32_t(1) << packet.size) - 1;
+        auto hits = world.hit_packet(packet, all, recs);
+        for (int l = 0; l < packet.size; l++) {
+          const hit_record* rec = (hits >> l & 1) ? &recs[l] : nullptr;
+          row[i0 + l] += shade(packet.rays[l], rec, max_depth, world, rays);
+        }
+      }
+      if (!row_cost.empty()) {
+        // 光线包的代价无法区分到每个像素, 平均分给包中的像素
+        double cost = (pixel_work() - cost_start) / packet.size;
+        for (int l = 0; l < packet.size; l++) row_cost[i0 + l] = cost;
+      }
+    }
+  }
+
+  /**
+   * @brief wavefront 渲染: 每次取一段像素与一段采样(一批最多 wavefront_size
+   * 条路径, 能放下时按整行划分), 为每个像素生成这些采样的路径,
+   * 然后按阶段处理整批光线:
+   * 1. 求交: 所有光线与场景求交, 未击中的路径累加背景色后结束;
+   * 2. 分组: 击中的光线按材料种类做稳定的计数排序;
+   * 3. 着色: 在排好的顺序上做一个并行循环, 内置材料按 material_record 的
+   *    标签直接调用对应的着色函数, 自定义材料仍通过虚函数;
+   * 4. 压缩: 仍有反射光线的路径组成下一批光线.
+   * 每个阶段都是在整批光线上的并行循环. 随机数种子由 (批次, 深度, 阶段, 块)
+   * 决定, 因此结果与线程数无关
+   *
+   * @param world
+   */
+  void render_wavefront(const hittable_list& world) {
+    int n = samples_per_pixel;
+    int limit = std::max(1, wavefront_size);
+    // 每批的采样数, 一行像素的全部采样放不下时按采样再分批
+    int samples = std::max(1, std::min(n, limit / std::max(1, image_width)));
+    // 每批的像素数, 尽量取整行; 一行的单次采样也放不下时按像素分批
+    size_t pixels = size_t(limit) / samples;
+    if (pixels >= size_t(image_width)) pixels -= pixels % image_width;
+    size_t pixel_count = size_t(image_width) * image_height;
+    size_t pixel_waves = (pixel_count + pixels - 1) / pixels;
+    int sample_waves = (n + samples - 1) / samples;
+    wavefront_state state;
+    // 每个渲染线程在求交阶段前后读取自己的计数器, 差值累加到这里
+    std::atomic<std::uint64_t> cache_misses{0};
+    profile.cache_misses_available = perf_counter::this_thread().available();
+    int wave = 0;
+    for (int s0 = 0; s0 < n; s0 += samples) {
+      for (size_t p0 = 0; p0 < pixel_count; p0 += pixels, wave++) {
+        wave_range range;
+        range.pixel_begin = p0;
+        range.pixel_end = std::min(pixel_count, p0 + pixels);
+        range.samples = std::min(samples, n - s0);
+        render_wave(world, wave, range, state, cache_misses);
+        if (show_progress) {
+          std::clog << "\rWaves remaining: "
+                    << pixel_waves * sample_waves - wave - 1 << ' '
+                    << std::flush;
+        }
+      }
+    }
+    profile.cache_misses = cache_misses.load();
+    if (show_progress) {
+      std::clog << "\nWavefront extension: " << profile.extension_rays
+                << " rays in " << profile.extension_seconds << "s ("
+                << profile.extension_rays / profile.extension_seconds
+                << " rays/s), sort " << profile.sort_seconds << "s, cache misses ";
+      if (profile.cache_misses_available) {
+        std::clog << profile.cache_misses << '\n';
+      } else {
+        std::clog << "unavailable\n";
+      }
+    }
+  }
+
+  // 一批 wavefront 路径: 像素 [pixel_begin, pixel_end) 的各 samples 次采样
+  struct wave_range {
+    size_t pixel_begin = 0;
+    size_t pixel_end = 0;
+    int samples = 0;
+  };
+
+  // wavefront 渲染在各批之间复用的队列
+  struct wavefront_state {
+    ray_queue rays, next;
+    hit_queue hits;
+    std::vector<color> radiance;  // 每条路径累加的颜色
+    std::vector<unsigned char> alive;
+    std::vector<int> order;
+    std::vector<size_t> bucket_start;
+    std::vector<std::uint32_t> keys;
+  };
+
+  // 渲染一批路径, 路径 k 属于像素 (pixel_begin + k / samples)
+  void render_wave(const hittable_list& world, int wave,
+                   const wave_range& range, wavefront_state& s,
+                   std::atomic<std::uint64_t>& cache_misses) {
+    using clock = std::chrono::steady_clock;
+    trace_scope scope("wave", "render", wave);
+    int n = range.samples;
+    size_t paths = (range.pixel_end - range.pixel_begin) * n;
+    s.radiance.assign(paths, color(0, 0, 0));
+    s.rays.resize(paths);
+
+    // 以块为单位并行执行 stage(k), 每块使用独立的随机数种子.
+    // misses 不为空时统计各块的缓存未命中数
+    auto run_stage = [&](size_t count, int depth, int stage, auto&& fn,
+                         std::atomic<std::uint64_t>* misses = nullptr) {
+      if (count == 0) return;
+      parallel_for(
+          wavefront_chunk_count(count), threads,
+          [&](int c, int) {
+            seed_random(wave_seed(wave, depth, stage, c));
+            size_t end = std::min(count, size_t(c + 1) * wavefront_chunk);
+            std::uint64_t rays = 0;
+            auto& counter = perf_counter::this_thread();
+            std::uint64_t before = 0;
+            if (misses) {
+              counter.start();
+              before = counter.value();
+            }
+            for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+              fn(k, rays);
+            }
+            if (misses) {
+              *misses += counter.value() - before;
+              counter.stop();
+            }
+            traced_rays += rays;
+            flush_thread_stats();
+          },
+          &schedule);
+    };
+
+    // 生成相机光线, 路径 k 属于像素 (pixel_begin + k / n) 的一次采样
+    run_stage(paths, max_depth, 0, [&](size_t k, std::uint64_t&) {
+      size_t pixel = range.pixel_begin + k / n;
+      int i = static_cast<int>(pixel % image_width);
+      int j = static_cast<int>(pixel / image_width);
+      s.rays.set_ray(k, get_ray(i, j));
+      s.rays.throughput[k] = color(1, 1, 1);
+      s.rays.path[k] = static_cast<int>(k);
+      RTW_STAT_INC(camera_rays);
+    });
+
+    for (int depth = max_depth; depth > 0 && s.rays.size() > 0; depth--) {
+      size_t count = s.rays.size();
+      s.hits.resize(count);
+      s.next.resize(count);
+      s.alive.assign(count, 0);
+
+      if (wavefront_sort && depth < max_depth) {
+        auto start = clock::now();
+        sort_rays(world.bounding_box(), s);
+        profile.sort_seconds +=
+            std::chrono::duration<double>(clock::now() - start).count();
+      }
+
+      // 求交阶段
+      auto extension_start = clock::now();
+      run_stage(
+          count, depth, 1,
+          [&](size_t k, std::uint64_t& rays) {
+            rays++;
+            if (depth < max_depth) RTW_STAT_INC(secondary_rays);
+            hit_record rec;
+            if (world.hit(s.rays.get_ray(k), interval(0.001, infinity), rec)) {
+              s.hits.set(k, rec);
+            } else {
+              s.hits.set_miss(k);
+              s.radiance[s.rays.path[k]] += s.rays.throughput[k] * background;
+              RTW_STAT_PATH_LENGTH(max_depth - depth + 1);
+            }
+          },
+          &cache_misses);
+      profile.extension_seconds +=
+          std::chrono::duration<double>(clock::now() - extension_start).count();
+      profile.extension_rays += count;
+
+      // 按材料种类分组, 未击中的光线排在最后并被忽略
+      parallel_counting_sort(
+          count, static_cast<int>(material_type::count) + 1,
+          [&](size_t k) { return s.hits.type[k]; }, threads, s.order,
+          s.bucket_start, &schedule);
+
+      // 着色阶段: 在按材料排好的顺序上做一个并行循环, 同种材料连续排列,
+      // 内置材料按标签直接调用着色函数
+      auto shade = [&](auto tag, int k) {
+        constexpr material_type T = decltype(tag)::value;
+        auto r_in = s.rays.get_ray(k);
+        auto rec = s.hits.get(k);
+        const material* mat = s.hits.mat[k];
+        auto throughput = s.rays.throughput[k];
+        if constexpr (emits_as<T>()) {
+          s.radiance[s.rays.path[k]] +=
+              throughput * emitted_as<T>(mat, rec.u, rec.v, rec.p);
+        }
+
+        ray scattered;
+        color attenuation;
+        RTW_STAT_INC(scatter_calls);
+        if (scatter_as<T>(mat, r_in, rec, attenuation, scattered)) {
+          scattered = continue_ray(r_in, rec, scattered);
+          if (depth == 1) RTW_STAT_PATH_LENGTH(max_depth);
+          s.next.set_ray(k, scattered);
+          s.next.throughput[k] = throughput * attenuation;
+          s.next.path[k] = s.rays.path[k];
+          s.alive[k] = 1;
+        } else {
+          RTW_STAT_PATH_LENGTH(max_depth - depth + 1);
+        }
+      };
+      using mt = material_type;
+      size_t hit_count = s.bucket_start[int(mt::count)];
+      run_stage(hit_count, depth, 4, [&](size_t o, std::uint64_t&) {
+        int k = s.order[o];
+        switch (static_cast<mt>(s.hits.type[k])) {
+          case mt::lambertian:
+            shade(std::integral_constant<mt, mt::lambertian>(), k);
+            break;
+          case mt::metal:
+            shade(std::integral_constant<mt, mt::metal>(), k);
+            break;
+          case mt::dielectric:
+            shade(std::integral_constant<mt, mt::dielectric>(), k);
+            break;
+          case mt::diffuse_light:
+            shade(std::integral_constant<mt, mt::diffuse_light>(), k);
+            break;
+          case mt::isotropic:
+            shade(std::integral_constant<mt, mt::isotropic>(), k);
+            break;
+          default:
+            shade(std::integral_constant<mt, mt::other>(), k);
+        }
+      });
+
+      // 压缩阶段: 仍然存活的路径按原来的顺序组成下一批光线
+      parallel_counting_sort(
+          count, 2, [&](size_t k) { return 1 - s.alive[k]; }, threads, s.order,
+          s.bucket_start, &schedule);
+      size_t alive_count = s.bucket_start[1];
+      s.rays.resize(alive_count);
+      run_stage(alive_count, depth, 3, [&](size_t o, std::uint64_t&) {
+        s.rays.copy_from(s.next, s.order[o], o);
+      });
+    }
+
+    // 把每条路径的颜色累加到所属的像素
+    for (size_t pixel = range.pixel_begin; pixel < range.pixel_end;) {
+      size_t j = pixel / image_width;
+      size_t row_end = std::min(range.pixel_end, (j + 1) * image_width);
+      std::lock_guard<std::mutex> lock(row_locks[j]);
+      for (; pixel < row_end; pixel++) {
+        size_t first = (pixel - range.pixel_begin) * n;
+        for (int sample = 0; sample < n; sample++) {
+          accum[pixel] += s.radiance[first + sample];
+        }
+        pixel_samples[pixel] += n;
+      }
+    }
+  }
+
+  // 把 s.rays 按 ray_sort_key 的顺序重新排列
+  void sort_rays(const aabb& bounds, wavefront_state& s) const {
+    size_t count = s.rays.size();
+    s.keys.resize(count);
+    parallel_for(
+        wavefront_chunk_count(count), threads,
+        [&](int c, int) {
+          size_t end = std::min(count, size_t(c + 1) * wavefront_chunk);
+          for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+            s.keys[k] = ray_sort_key(s.rays.origin[k], s.rays.direction[k],
+                                     bounds);
+          }
+        });
+    parallel_radix_sort(s.keys, threads, s.order);
+    s.next.resize(count);
+    parallel_for(wavefront_chunk_count(count), threads, [&](int c, int) {
+      size_t end = std::min(count, size_t(c + 1) * wavefront_chunk);
+      for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+        s.next.copy_from(s.rays, s.order[k], k);
+      }
+    });
+    std::swap(s.rays, s.next);
+  }
+
+  // 由 wavefront 渲染的批次, 深度, 阶段和块号得到随机数种子
+  unsigned int wave_seed(int wave, int depth, int stage, int chunk) const {
+    std::uint64_t x = ((std::uint64_t(wave) * (max_depth + 1) + depth) * 16 +
+                       stage) * 0x100000001b3ULL + chunk + 1;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<unsigned int>(x ^ (x >> 31));
+  }
+
+  // 把当前线程的计数器合并到本次渲染的统计结果中, 并清零
+  void flush_thread_stats() {
+#ifdef RTW_ENABLE_STATS
+    auto& local = thread_render_stats();
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    last_stats.merge(local);
+    local = render_stats();
+#endif
+  }
+
+  // 输出本次渲染的统计结果
+  void report_stats() const {
+#ifdef RTW_ENABLE_STATS
+    last_stats.print(std::clog);
+    if (!stats_json_path.empty()) {
+      std::ofstream out(stats_json_path);
+      last_stats.write_json(out);
+    }
+#else
+    if (!stats_json_path.empty()) {
+      std::clog << "Render stats are disabled, "
+                   "rebuild with -DRTW_ENABLE_STATS=ON.\n";
+    }
+#endif
+  }
+
+  // 当前线程到目前为止的工作量, 用于计算每个像素的求交代价
+  double pixel_work() const {
+    if (cost_in_cycles) return static_cast<double>(read_cycle_counter());
+#ifdef RTW_ENABLE_STATS
+    const auto& s = thread_render_stats();
+    return static_cast<double>(s.bvh_nodes_visited + s.sphere_tests +
+                               s.quad_tests + s.box_tests + s.triangle_tests +
+                               s.instance_tests + s.medium_tests);
+#else
+    return 0;
+#endif
+  }
+
+  // 读取 CPU 周期计数器, 非 x86 平台退化为纳秒计时
+  static std::uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  /**
+   * @brief 把每个像素每条采样光线的平均求交代价写成伪彩色 PPM 图像.
+   * 代价按第 99 百分位数归一化, 避免少数极端像素压暗整幅图像
+   *
+   */
+  void write_heatmap() const {
+    std::vector<double> cost(pixel_cost.size());
+    for (size_t k = 0; k < cost.size(); k++) {
+      cost[k] = pixel_samples[k] > 0 ? pixel_cost[k] / pixel_samples[k] : 0;
+    }
+    auto sorted = cost;
+    auto p99 = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), p99, sorted.end());
+    double scale = *p99 > 0 ? 1.0 / *p99 : 0.0;
+
+    std::ofstream out(heatmap_path);
+    if (!out) {
+      std::clog << "ERROR: Could not write heatmap '" << heatmap_path
+                << "'.\n";
+      return;
+    }
+    out << "P3\n" << image_width << " " << image_height << "\n255\n";
+    for (auto c : cost) {
+      // heatmap_color 的结果已经是显示空间的颜色, 抵消 write_color 的 gamma
+      auto hc = heatmap_color(c * scale);
+      write_color(out, hc * hc, 1);
+    }
+    std::clog << "Heatmap: " << (cost_in_cycles ? "cycles" : "traversal steps")
+              << " per sample, p99 " << *p99 << ", max "
+              << *std::max_element(cost.begin(), cost.end()) << " -> "
+              << heatmap_path << '\n';
+  }
+
+  // 由渲染轮次和行号得到随机数种子
+  unsigned int scanline_seed(int pass, int j) const {
+    std::uint64_t x = static_cast<std::uint64_t>(pass) * image_height + j + 1;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<unsigned int>(x ^ (x >> 31));
+  }
+
+  /**
+   * @brief 以 PPM 格式写出当前累加的图像
+   *
+   * @param out 输出流
+   */
+  void write_image(std::ostream& out) const {
+    trace_scope scope("write_image", "output");
+    out << "P3\n" << image_width << " " << image_height << "\n255\n";
+    for (int j = 0; j < image_height; ++j) {
+      for (int i = 0; i < image_width; ++i) {
+        write_color(out, accum[j * image_width + i],
+                    pixel_samples[j * image_width + i]);
+      }
+    }
+  }
+
+  /**
+   * @brief 原子地写出预览图: 先写到临时文件, 再 rename 覆盖 preview_path,
+   * 这样查看预览图的程序不会读到写了一半的文件
+   *
+   */
+  void write_preview() const {
+    auto tmp_path = preview_path + ".tmp";
+    {
+      std::ofstream out(tmp_path);
+      if (!out) {
+        std::clog << "\nERROR: Could not write preview '" << tmp_path
+                  << "'.\n";
+        return;
+      }
+      write_image(out);
+      out.close();
+      if (!out) {
+        std::clog << "\nERROR: Could not write preview '" << tmp_path
+                  << "'.\n";
+        std::remove(tmp_path.c_str());
+        return;
+      }
+    }
+    if (std::rename(tmp_path.c_str(), preview_path.c_str()) != 0) {
+      std::clog << "\nERROR: Could not rename preview '" << tmp_path
+                << "' to '" << preview_path << "'.\n";
+      std::remove(tmp_path.c_str());
+    }
   }
 
   /**
@@ -135,33 +844,59 @@ class camera {
    * @param r 入射光线
    * @param depth 光线传播的深度
    * @param world 世界场景
+   * @param rays 累计追踪的光线数
    * @return color
    */
-  color ray_color(const ray& r, int depth, const hittable_list& world) {
+  color ray_color(const ray& r, int depth, const hittable_list& world,
+                  std::uint64_t& rays) const {
     if (depth <= 0) {
+      RTW_STAT_PATH_LENGTH(max_depth);
       return color(0, 0, 0);
     }
+    rays++;
+    if (depth < max_depth) RTW_STAT_INC(secondary_rays);
     hit_record rec;
 
-    // 如果击中场景中的某个物体
     // 忽略距离在[0,0.001)范围内的交点，避免浮点运算误差
-    if (world.hit(r, interval(0.001, infinity), rec)) {
+    bool hit = world.hit(r, interval(0.001, infinity), rec);
+    return shade(r, hit ? &rec : nullptr, depth, world, rays);
+  }
+
+  /**
+   * @brief 根据光线 r 的求交结果计算颜色, 反射光线继续调用 ray_color()
+   *
+   * @param r 入射光线
+   * @param hit 交点信息, 没有击中任何物体时为 nullptr
+   * @param depth 光线传播的深度
+   * @param world 世界场景
+   * @param rays 累计追踪的光线数
+   * @return color
+   */
+  color shade(const ray& r, const hit_record* hit, int depth,
+              const hittable_list& world, std::uint64_t& rays) const {
+    // 如果击中场景中的某个物体
+    if (hit) {
+      const hit_record& rec = *hit;
       // 物体反射光线
       ray scattered;
       // 物体材质颜色
       color attenuation;
       // 物体自发光
       color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+      RTW_STAT_INC(scatter_calls);
       if (rec.mat->scatter(r, rec, attenuation, scattered)) {
+        scattered = continue_ray(r, rec, scattered);
         // 如果材料存在反射, 则返回 自发光+物体颜色*反射光
         return color_from_emission +
-               attenuation * ray_color(scattered, depth - 1, world);
+               attenuation * ray_color(scattered, depth - 1, world, rays);
       } else {
         // 如果材料不存在反射, 则返回 自发光
+        RTW_STAT_PATH_LENGTH(max_depth - depth + 1);
         return color_from_emission;
       }
     } else {
       // 如果没有击中场景中的物体, 则返回场景背景
+      RTW_STAT_PATH_LENGTH(max_depth - depth + 1);
       return background;
     }
 
@@ -187,7 +922,28 @@ class camera {
     auto ray_direction = pixel_sample - ray_origin;
     // 生成有time属性的ray
     auto ray_time = random_double();
-    return ray(ray_origin, ray_direction, ray_time);
+    ray r(ray_origin, ray_direction, ray_time);
+    // 光线锥: 在对焦平面(t=1)处的宽度为一个像素
+    r.set_cone(0, pixel_delta_u.length() / ray_direction.length());
+    return r;
+  }
+
+  /**
+   * @brief 由材料给出的反射光线得到继续追踪的光线:
+   * 单精度下需要把反射光的起点推离表面, 双精度下起点保持不变;
+   * 反射光线的锥从入射光线在交点处的宽度开始, 张角不变
+   *
+   * @param r_in 入射光线
+   * @param rec 交点
+   * @param scattered 材料给出的反射光线
+   */
+  static ray continue_ray(const ray& r_in, const hit_record& rec,
+                          const ray& scattered) {
+    ray next(offset_ray_origin(scattered.origin(), rec.normal,
+                               scattered.direction()),
+             scattered.direction(), scattered.time());
+    next.set_cone(r_in.footprint(rec.t), r_in.cone_spread());
+    return next;
   }
   /**
    * @brief 在单位正方形内随机采样
@@ -41,7 +41,8 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
   auto g = pixel_color.y();
   auto b = pixel_color.z();
 
-  auto scale = 1.0 / samples_per_pixel;
+  // 时间预算模式下可能有像素没有获得任何采样
+  auto scale = samples_per_pixel > 0 ? 1.0 / samples_per_pixel : 0.0;
   r *= scale;
   g *= scale;
   b *= scale;
@@ -57,4 +58,22 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
       << static_cast<int>(255.999 * intensity.clamp(b)) << '\n';
 }
 
+/**
+ * @brief 将 [0,1] 内的代价映射为伪彩色(黑-蓝-品红-橙-黄白), 用于代价热力图
+ *
+ * @param t 归一化后的代价
+ * @return color
+ */
+inline color heatmap_color(double t) {
+  static const color stops[] = {color(0, 0, 0), color(0.1, 0.1, 0.6),
+                                color(0.7, 0.1, 0.6), color(1.0, 0.5, 0.1),
+                                color(1.0, 1.0, 0.8)};
+  const int n = sizeof(stops) / sizeof(stops[0]) - 1;
+  t = interval(0, 1).clamp(t) * n;
+  int k = static_cast<int>(t);
+  if (k >= n) return stops[n];
+  double f = t - k;
+  return (1 - f) * stops[k] + f * stops[k + 1];
+}
+
 #endif
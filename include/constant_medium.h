@@ -12,6 +12,7 @@
 #define CONSTANT_MEDIUM_H
 #include "hittable.h"
 #include "material.h"
+#include "render_stats.h"
 #include "rtweekend.h"
 #include "texture.h"
 
@@ -36,6 +37,7 @@ class constant_medium : public hittable {
         phase_function(make_shared<isotropic>(c)) {}
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RTW_STAT_INC(medium_tests);
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
@@ -89,6 +91,7 @@ class constant_medium : public hittable {
 
     rec.normal = vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;       // also arbitrary
+    rec.du = rec.dv = 0;         // 介质内部的散射点不做纹理预滤波
     rec.mat = phase_function;
 
     return true;
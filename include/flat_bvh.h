@@ -0,0 +1,302 @@
+/**
+ * @file flat_bvh.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 按下标引用图元的扁平 BVH: 分桶 SAH 构建, 节点存放在一个数组中,
+ * 用显式栈遍历. 三角形网格与实例的顶层 BVH 共用
+ * @version 0.1
+ * @date 2023-09-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "interval.h"
+#include "ray.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+
+/**
+ * @brief 扁平 BVH. 节点按深度优先顺序存放, 内部节点的左孩子紧跟在其后,
+ * 右孩子的下标保存在节点中. 叶子引用构建后图元数组中的一段连续区间,
+ * 图元本身由使用者保存
+ *
+ */
+class flat_bvh {
+ public:
+  // 叶子的最大深度, 也是遍历栈的大小. 接近上限时改为按中位数划分
+  static constexpr int max_depth = 64;
+
+  // 32 字节的节点, 包围盒以单精度保存并向外取整
+  struct node {
+    float bmin[3], bmax[3];
+    std::uint32_t offset;  // 叶子: 第一个图元; 内部节点: 右孩子的下标
+    std::uint16_t count;   // 叶子中的图元数, 内部节点为 0
+    std::uint16_t axis;    // 内部节点的划分轴
+  };
+
+  // 构建时使用的图元包围盒与质心
+  struct build_prim {
+    real lo[3], hi[3], c[3];
+    std::uint32_t index;  // 图元原来的下标
+  };
+
+  // 构建时的包围盒
+  struct build_bounds {
+    real lo[3], hi[3];
+
+    build_bounds() {
+      for (int a = 0; a < 3; a++) {
+        lo[a] = std::numeric_limits<real>::infinity();
+        hi[a] = -std::numeric_limits<real>::infinity();
+      }
+    }
+    void grow(const real* l, const real* h) {
+      for (int a = 0; a < 3; a++) {
+        lo[a] = std::min(lo[a], l[a]);
+        hi[a] = std::max(hi[a], h[a]);
+      }
+    }
+    void grow(const build_bounds& b) { grow(b.lo, b.hi); }
+    // 半表面积, 空包围盒为 0
+    real half_area() const {
+      if (lo[0] > hi[0]) return 0;
+      real dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+      return dx * dy + dy * dz + dz * dx;
+    }
+  };
+
+  // 遍历时每条光线只计算一次的数据
+  struct ray_data {
+    real org[3], dir[3], inv_dir[3];
+    bool negative[3];
+
+    explicit ray_data(const ray& r) {
+      for (int a = 0; a < 3; a++) {
+        org[a] = r.origin()[a];
+        dir[a] = r.direction()[a];
+        inv_dir[a] = 1 / dir[a];
+        negative[a] = dir[a] < 0;
+      }
+    }
+  };
+
+  /**
+   * @brief 构建 BVH. 构建结束后 prims 按叶子顺序重新排列,
+   * prims[k].index 为叶子中第 k 个图元原来的下标
+   *
+   * @param prims 图元的包围盒与质心
+   * @param max_leaf_size 叶子节点最多包含的图元数
+   * @param bounds 所有图元的包围盒
+   */
+  void build(std::vector<build_prim>& prims, int max_leaf_size,
+             build_bounds& bounds) {
+    nodes.clear();
+    bounds = build_bounds();
+    if (prims.empty()) return;
+    leaf_size = max_leaf_size;
+    build_bounds centroid_box;
+    for (const auto& prim : prims) {
+      bounds.grow(prim.lo, prim.hi);
+      centroid_box.grow(prim.c, prim.c);
+    }
+    nodes.reserve(2 * prims.size() / max_leaf_size + 1);
+    build_node(prims, 0, prims.size(), bounds, centroid_box, 0);
+    nodes.shrink_to_fit();
+  }
+
+  bool empty() const { return nodes.empty(); }
+  size_t node_count() const { return nodes.size(); }
+  size_t memory_bytes() const { return nodes.capacity() * sizeof(node); }
+
+  /**
+   * @brief 遍历与光线相交的叶子, 先访问光线方向上较近的孩子.
+   * leaf(first, count, ray_t) 与叶子中的图元求交, 击中时缩短 ray_t.max
+   *
+   */
+  template <typename Leaf>
+  void traverse(const ray_data& rd, interval& ray_t, const Leaf& leaf) const {
+    if (nodes.empty()) return;
+    // 每层内部节点最多压入一个孩子, 构建保证叶子深度不超过 max_depth
+    std::uint32_t stack[max_depth];
+    int stack_size = 0;
+    std::uint32_t index = 0;
+    for (;;) {
+      const node& n = nodes[index];
+      RTW_STAT_INC(bvh_nodes_visited);
+      if (node_hit(n, rd, ray_t)) {
+        if (n.count > 0) {
+          leaf(n.offset, n.count, ray_t);
+        } else {
+          bool far_first = rd.negative[n.axis];
+          stack[stack_size++] = far_first ? index + 1 : n.offset;
+          index = far_first ? n.offset : index + 1;
+          continue;
+        }
+      }
+      if (stack_size == 0) break;
+      index = stack[--stack_size];
+    }
+  }
+
+ private:
+  std::vector<node> nodes;
+  int leaf_size = 8;
+
+  static bool node_hit(const node& n, const ray_data& rd, interval ray_t) {
+    RTW_STAT_INC(aabb_tests);
+    for (int a = 0; a < 3; a++) {
+      real t0 = (n.bmin[a] - rd.org[a]) * rd.inv_dir[a];
+      real t1 = (n.bmax[a] - rd.org[a]) * rd.inv_dir[a];
+      if (rd.negative[a]) std::swap(t0, t1);
+      if (t0 > ray_t.min) ray_t.min = t0;
+      if (t1 < ray_t.max) ray_t.max = t1;
+      if (ray_t.max < ray_t.min) return false;
+    }
+    return true;
+  }
+
+  static float round_down(real x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity())
+                 : f;
+  }
+  static float round_up(real x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity())
+                 : f;
+  }
+
+  /**
+   * @brief 分桶 SAH. 图元直接在数组中划分, 每个节点只需一遍分桶与一遍划分,
+   * 孩子的包围盒由桶合并得到. 所有质心落在同一个桶中时按质心的中位数划分.
+   * 剩余的深度只够按中位数划分到单个图元时, 不再使用 SAH, 保证深度不超过
+   * max_depth
+   *
+   */
+  std::uint32_t build_node(std::vector<build_prim>& prims, size_t begin,
+                           size_t end, const build_bounds& box,
+                           const build_bounds& centroid_box, int depth) {
+    std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+    for (int a = 0; a < 3; a++) {
+      nodes[index].bmin[a] = round_down(box.lo[a]);
+      nodes[index].bmax[a] = round_up(box.hi[a]);
+    }
+    size_t count = end - begin;
+    auto make_leaf = [&] {
+      nodes[index].offset = static_cast<std::uint32_t>(begin);
+      nodes[index].count = static_cast<std::uint16_t>(count);
+      nodes[index].axis = 0;
+      return index;
+    };
+    if (count <= 1) return make_leaf();
+    // 按中位数划分到单个图元需要的层数 ceil(log2(count))
+    int median_depth = 0;
+    while ((size_t(1) << median_depth) < count) median_depth++;
+    bool median_only = depth + median_depth >= max_depth;
+
+    // 质心包围盒最长的轴
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+      if (centroid_box.hi[a] - centroid_box.lo[a] >
+          centroid_box.hi[axis] - centroid_box.lo[axis])
+        axis = a;
+    }
+    real lo = centroid_box.lo[axis];
+    real extent = centroid_box.hi[axis] - lo;
+
+    constexpr int bin_count = 16;
+    build_bounds bin_box[bin_count], bin_centroid[bin_count];
+    size_t bin_size[bin_count] = {};
+    int split = -1;
+    build_bounds left_box, left_centroid, right_box, right_centroid;
+    size_t mid = begin;
+    real scale = extent > 0 ? bin_count / extent : 0;
+    auto bin_of = [&](const build_prim& prim) {
+      int b = static_cast<int>((prim.c[axis] - lo) * scale);
+      return std::min(b, bin_count - 1);
+    };
+    if (extent > 0 && !median_only) {
+      for (size_t k = begin; k < end; k++) {
+        int b = bin_of(prims[k]);
+        bin_box[b].grow(prims[k].lo, prims[k].hi);
+        bin_centroid[b].grow(prims[k].c, prims[k].c);
+        bin_size[b]++;
+      }
+      // 从右向左累计, 再从左向右扫描每个划分位置的代价
+      real right_area[bin_count];
+      size_t right_count[bin_count];
+      build_bounds acc;
+      size_t acc_count = 0;
+      for (int b = bin_count - 1; b > 0; b--) {
+        acc.grow(bin_box[b]);
+        acc_count += bin_size[b];
+        right_area[b] = acc.half_area();
+        right_count[b] = acc_count;
+      }
+      acc = build_bounds();
+      acc_count = 0;
+      real best_cost = infinity;
+      for (int b = 1; b < bin_count; b++) {
+        acc.grow(bin_box[b - 1]);
+        acc_count += bin_size[b - 1];
+        if (acc_count == 0 || right_count[b] == 0) continue;
+        real cost = acc.half_area() * acc_count + right_area[b] * right_count[b];
+        if (cost < best_cost) {
+          best_cost = cost;
+          split = b;
+        }
+      }
+      // 代价以图元求交为单位, 访问一个内部节点的代价记为 1
+      real area = box.half_area();
+      bool leaf_cheaper =
+          split < 0 || (area > 0 && 1 + best_cost / area >= real(count));
+      if (count <= size_t(leaf_size) && leaf_cheaper) return make_leaf();
+      if (split > 0) {
+        for (int b = 0; b < bin_count; b++) {
+          (b < split ? left_box : right_box).grow(bin_box[b]);
+          (b < split ? left_centroid : right_centroid).grow(bin_centroid[b]);
+        }
+        auto it = std::partition(
+            prims.begin() + begin, prims.begin() + end,
+            [&](const build_prim& prim) { return bin_of(prim) < split; });
+        mid = static_cast<size_t>(it - prims.begin());
+      }
+    } else if (count <= size_t(leaf_size)) {
+      return make_leaf();
+    }
+    if (mid == begin || mid == end) {
+      // 质心重合或分桶失败: 按质心的中位数划分
+      mid = begin + count / 2;
+      std::nth_element(prims.begin() + begin, prims.begin() + mid,
+                       prims.begin() + end,
+                       [&](const build_prim& a, const build_prim& b) {
+                         return a.c[axis] < b.c[axis];
+                       });
+      left_box = left_centroid = right_box = right_centroid = build_bounds();
+      for (size_t k = begin; k < end; k++) {
+        bool left = k < mid;
+        (left ? left_box : right_box).grow(prims[k].lo, prims[k].hi);
+        (left ? left_centroid : right_centroid).grow(prims[k].c, prims[k].c);
+      }
+    }
+
+    nodes[index].count = 0;
+    nodes[index].axis = static_cast<std::uint16_t>(axis);
+    build_node(prims, begin, mid, left_box, left_centroid, depth + 1);
+    std::uint32_t right =
+        build_node(prims, mid, end, right_box, right_centroid, depth + 1);
+    nodes[index].offset = right;
+    return index;
+  }
+};
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "rtweekend.h"
 
 class material;
@@ -26,10 +27,13 @@ class hit_record {
   // 交点处的法向, 与入射光方向相反(可能指向物体外也可能指向物体内)
   vec3 normal;
   shared_ptr<material> mat;  // 交点处材料属性
-  double t;                  // 光线的传播距离
-  double u;                  // 用于计算纹理的坐标参数(u,v)
-  double v;
+  real t;                    // 光线的传播距离
+  real u;                    // 用于计算纹理的坐标参数(u,v)
+  real v;
   bool front_face;  // 该交点是否是物体的外表面
+  // 光线在交点处覆盖的纹理坐标范围, 用于选择纹理的 mip 层级, 0 表示未知
+  real du = 0;
+  real dv = 0;
   /**
    * @brief 设置该交点是否是物体的外表面
    *
@@ -40,7 +44,40 @@ class hit_record {
     front_face = dot(r.direction(), outward_normal) < 0;
     normal = front_face ? (outward_normal) : (-outward_normal);
   }
+  /**
+   * @brief 由光线的锥形微分计算交点处的纹理坐标范围 du, dv,
+   * 需要在 t 与 normal 设置之后调用. 斜射时覆盖范围按 1/cos 增大(最多 8 倍)
+   *
+   * @param r 入射光
+   * @param size_u u 方向 [0,1] 对应的世界坐标长度
+   * @param size_v v 方向 [0,1] 对应的世界坐标长度
+   */
+  void set_footprint(const ray& r, real size_u, real size_v) {
+    du = dv = 0;
+    if (!r.has_cone()) return;
+    auto dir = r.direction();
+    auto len = dir.length();
+    real cos_theta = std::fabs(dot(normal, dir)) / len;
+    real width = (r.cone_width() + r.cone_spread() * t * len) /
+                 std::fmax(cos_theta, real(0.125));
+    du = width / size_u;
+    dv = width / size_v;
+  }
 };
+/**
+ * @brief 可批量求交的图元的几何数据, 由 hittable_list 收集成 SoA 数组
+ *
+ */
+struct batch_data {
+  enum kind_t { none, sphere, quad };
+  kind_t kind = none;
+  point3 center;  // sphere: 0 时刻的球心, 运动方向与半径
+  vec3 motion;
+  real radius = 0;
+  point3 Q;  // quad: 左下角与两条边
+  vec3 u, v;
+};
+
 /**
  * @brief 可与光线相交的类, 所有可与光线作用的物体都必须继承该类并实现其中的
  * hit() 函数
@@ -53,6 +90,27 @@ class hittable {
   virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
   // 该 hittable 的包围盒
   virtual aabb bounding_box() const = 0;
+  // 可批量求交的图元返回自己的几何数据, 其余物体返回 kind == none
+  virtual batch_data get_batch_data() const { return batch_data(); }
+  /**
+   * @brief 光线包中 active 掩码对应的光线同时求交. 第 l 条光线的合法范围为
+   * [packet.tmin[l], packet.tmax[l]], 击中时把交点写入 recs[l] 并把
+   * packet.tmax[l] 更新为交点距离. 默认实现逐条调用 hit()
+   *
+   * @return std::uint32_t 击中的光线的掩码
+   */
+  virtual std::uint32_t hit_packet(ray_packet& packet, std::uint32_t active,
+                                   hit_record* recs) const {
+    std::uint32_t hits = 0;
+    for_each_lane(active, [&](int l) {
+      if (hit(packet.rays[l], interval(packet.tmin[l], packet.tmax[l]),
+              recs[l])) {
+        packet.tmax[l] = recs[l].t;
+        hits |= 1u << l;
+      }
+    });
+    return hits;
+  }
 };
 
 /**
@@ -76,6 +134,7 @@ class translate : public hittable {
     // 不考虑 r 与场景中其他物体的碰撞, 假如该物体的前面存在某个其他物体
     // 遮挡了该物体, 那么要么程序不会到达这里, 要么此处的交点会被更近的交点替换
     ray offset_r(r.origin() - offset, r.direction(), r.time());
+    offset_r.set_cone(r.cone_width(), r.cone_spread());
 
     // Determine where (if any) an intersection occurs along the offset ray
     if (!object->hit(offset_r, ray_t, rec)) return false;
@@ -147,6 +206,7 @@ class rotate_y : public hittable {
     direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
 
     ray rotated_r(origin, direction, r.time());
+    rotated_r.set_cone(r.cone_width(), r.cone_spread());
 
     // Determine where (if any) an intersection occurs in object space
     if (!object->hit(rotated_r, ray_t, rec)) return false;
@@ -171,8 +231,8 @@ class rotate_y : public hittable {
 
  private:
   shared_ptr<hittable> object;
-  double sin_theta;
-  double cos_theta;
+  real sin_theta;
+  real cos_theta;
   aabb bbox;  // hittable 的包围盒
 };
 
@@ -11,10 +11,13 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
 #include "hittable.h"
+#include "render_stats.h"
+#include "simd_dispatch.h"
 
 using std::make_shared;
 using std::shared_ptr;
@@ -27,12 +30,35 @@ class hittable_list : public hittable {
   hittable_list() {}
   hittable_list(shared_ptr<hittable> object) { add(object); }
 
-  void clear() { objects.clear(); }
+  void clear() {
+    objects.clear();
+    spheres = primitive_batch();
+    quads = primitive_batch();
+    others.clear();
+  }
 
   void add(shared_ptr<hittable> object) {
     objects.push_back(object);
     // 更新 bbox
     bbox = aabb(bbox, object->bounding_box());
+
+    // 球与平行四边形放入 SoA 数组, 在 hit() 中批量求交
+    auto index = objects.size() - 1;
+    auto data = object->get_batch_data();
+    if (data.kind == batch_data::sphere) {
+      const real values[] = {data.center.x(), data.center.y(),
+                             data.center.z(), data.motion.x(),
+                             data.motion.y(), data.motion.z(),
+                             data.radius};
+      spheres.push(values, 7, index);
+    } else if (data.kind == batch_data::quad) {
+      const real values[] = {data.Q.x(), data.Q.y(), data.Q.z(),
+                             data.u.x(), data.u.y(), data.u.z(),
+                             data.v.x(), data.v.y(), data.v.z()};
+      quads.push(values, 9, index);
+    } else {
+      others.push_back(index);
+    }
   }
   /**
    * @brief 计算光线与物体的交点(第一个交点), 有交点则返回true,
@@ -49,19 +75,147 @@ class hittable_list : public hittable {
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
-    for (const auto& object : objects) {
-      if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+    // 球与平行四边形按 objects 中的顺序分段批量求交, 每段之后才是
+    // 不能批量求交的物体, 使 constant_medium 等物体看到的 ray_t 与逐个求交时相同
+    batch_cursor cursor;
+    for (auto i : others) {
+      hit_anything |= hit_batches(r, i, cursor, ray_t.min, closest_so_far, rec);
+      if (objects[i]->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
         hit_anything = true;
         closest_so_far = temp_rec.t;
         rec = temp_rec;
       }
     }
+    hit_anything |= hit_batches(r, objects.size(), cursor, ray_t.min,
+                                closest_so_far, rec);
     return hit_anything;
   }
+
+  // 与 hit() 的顺序相同: 批量求交的图元逐条光线处理, 其余物体整包求交
+  std::uint32_t hit_packet(ray_packet& packet, std::uint32_t active,
+                           hit_record* recs) const override {
+    std::uint32_t hits = 0;
+    batch_cursor cursors[ray_packet::max_size];
+    auto lane_batches = [&](size_t limit) {
+      for_each_lane(active, [&](int l) {
+        if (hit_batches(packet.rays[l], limit, cursors[l], packet.tmin[l],
+                        packet.tmax[l], recs[l]))
+          hits |= 1u << l;
+      });
+    };
+
+    hit_record temp_recs[ray_packet::max_size];
+    for (auto i : others) {
+      lane_batches(i);
+      auto object_hits = objects[i]->hit_packet(packet, active, temp_recs);
+      for_each_lane(object_hits, [&](int l) { recs[l] = temp_recs[l]; });
+      hits |= object_hits;
+    }
+    lane_batches(objects.size());
+    return hits;
+  }
+
   aabb bounding_box() const override { return bbox; }
 
  private:
+  /**
+   * @brief 同一类图元的 SoA 数组, 每个数组的长度补齐到 simd_batch_align 的倍数
+   *
+   */
+  struct primitive_batch {
+    std::vector<real> fields[9];
+    std::vector<size_t> index;  // 图元在 objects 中的下标, 递增
+    int count = 0;
+
+    const real* data(int field, int begin) const {
+      return fields[field].data() + begin;
+    }
+
+    // 在 objects 中的下标小于 limit 的第一个之后的图元位置
+    int end_before(size_t limit, int begin) const {
+      return static_cast<int>(
+          std::lower_bound(index.begin() + begin, index.end(), limit) -
+          index.begin());
+    }
+
+    void push(const real* values, int n, size_t object_index) {
+      // 从任意位置开始按向量宽度读取时都不能越界
+      if (fields[0].size() < static_cast<size_t>(count + simd_batch_align)) {
+        for (int f = 0; f < n; f++) {
+          fields[f].resize(count + 2 * simd_batch_align);
+        }
+      }
+      for (int f = 0; f < n; f++) fields[f][count] = values[f];
+      index.push_back(object_index);
+      count++;
+    }
+  };
+
+  // 已经求交过的球与平行四边形的个数
+  struct batch_cursor {
+    int spheres = 0;
+    int quads = 0;
+  };
+
+  /**
+   * @brief 对 objects 中下标小于 limit 且尚未求交的球与平行四边形批量求交.
+   * 批量求交只找出最近的图元, 交点信息仍由该图元的 hit() 计算
+   *
+   * @return true 找到了比 closest_so_far 更近的交点, 并写入 rec
+   */
+  bool hit_batches(const ray& r, size_t limit, batch_cursor& cursor, real tmin,
+                   real& closest_so_far, hit_record& rec) const {
+    int sphere_end = spheres.end_before(limit, cursor.spheres);
+    int quad_end = quads.end_before(limit, cursor.quads);
+    if (sphere_end == cursor.spheres && quad_end == cursor.quads) return false;
+
+    const real orig[] = {r.origin().x(), r.origin().y(), r.origin().z()};
+    const real dir[] = {r.direction().x(), r.direction().y(),
+                        r.direction().z()};
+    bool hit_anything = false;
+    hit_record temp_rec;
+    real t;
+    int k = -1, n = sphere_end - cursor.spheres;
+    if (n > 0) {
+      RTW_STAT_ADD(sphere_tests, n);
+      int b = cursor.spheres;
+      const real* c[] = {spheres.data(0, b), spheres.data(1, b),
+                         spheres.data(2, b)};
+      const real* m[] = {spheres.data(3, b), spheres.data(4, b),
+                         spheres.data(5, b)};
+      k = simd().sphere_hit_n(c, m, spheres.data(6, b), n, orig, dir, r.time(),
+                              tmin, closest_so_far, &t);
+      if (k >= 0 && objects[spheres.index[b + k]]->hit(
+                        r, interval(tmin, closest_so_far), temp_rec)) {
+        hit_anything = true;
+        closest_so_far = temp_rec.t;
+        rec = temp_rec;
+      }
+    }
+    n = quad_end - cursor.quads;
+    if (n > 0) {
+      RTW_STAT_ADD(quad_tests, n);
+      int b = cursor.quads;
+      const real* q[] = {quads.data(0, b), quads.data(1, b), quads.data(2, b)};
+      const real* u[] = {quads.data(3, b), quads.data(4, b), quads.data(5, b)};
+      const real* v[] = {quads.data(6, b), quads.data(7, b), quads.data(8, b)};
+      k = simd().quad_hit_n(q, u, v, n, orig, dir, tmin, closest_so_far, &t);
+      if (k >= 0 && objects[quads.index[b + k]]->hit(
+                        r, interval(tmin, closest_so_far), temp_rec)) {
+        hit_anything = true;
+        closest_so_far = temp_rec.t;
+        rec = temp_rec;
+      }
+    }
+    cursor.spheres = sphere_end;
+    cursor.quads = quad_end;
+    return hit_anything;
+  }
+
   aabb bbox;
+  primitive_batch spheres;
+  primitive_batch quads;
+  std::vector<size_t> others;  // 不能批量求交的物体
 };
 
 #endif
\ No newline at end of file
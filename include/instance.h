@@ -0,0 +1,274 @@
+/**
+ * @file instance.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 两层加速结构: 实例带有 3x4 仿射变换及其逆变换, 引用共享的底层结构,
+ * 顶层 BVH 建立在实例的世界包围盒上
+ * @version 0.1
+ * @date 2023-09-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+/**
+ * @brief 3x4 仿射变换 [L | t], 点 p 变换为 L p + t, 向量 v 变换为 L v
+ *
+ */
+struct affine_transform {
+  real m[3][4];
+
+  affine_transform() {
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 4; j++) m[i][j] = i == j ? 1 : 0;
+    }
+  }
+
+  static affine_transform translation(const vec3& offset) {
+    affine_transform a;
+    for (int i = 0; i < 3; i++) a.m[i][3] = offset[i];
+    return a;
+  }
+
+  static affine_transform scaling(const vec3& s) {
+    affine_transform a;
+    for (int i = 0; i < 3; i++) a.m[i][i] = s[i];
+    return a;
+  }
+
+  static affine_transform scaling(real s) { return scaling(vec3(s, s, s)); }
+
+  /**
+   * @brief 绕过原点的轴 axis 逆时针旋转 angle 度(右手系, Rodrigues 公式)
+   *
+   */
+  static affine_transform rotation(const vec3& axis, double angle) {
+    auto k = unit_vector(axis);
+    auto radians = degrees_to_radians(angle);
+    real c = std::cos(radians), s = std::sin(radians);
+    affine_transform a;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) a.m[i][j] = (1 - c) * k[i] * k[j];
+      a.m[i][i] += c;
+    }
+    a.m[0][1] -= s * k[2];
+    a.m[0][2] += s * k[1];
+    a.m[1][0] += s * k[2];
+    a.m[1][2] -= s * k[0];
+    a.m[2][0] -= s * k[1];
+    a.m[2][1] += s * k[0];
+    return a;
+  }
+
+  // 与 rotate_y 方向相同的绕 y 轴旋转
+  static affine_transform rotation_y(double angle) {
+    return rotation(vec3(0, 1, 0), angle);
+  }
+
+  // 复合变换: 先做 b, 再做 *this
+  affine_transform operator*(const affine_transform& b) const {
+    affine_transform r;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 4; j++) {
+        r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] +
+                    m[i][2] * b.m[2][j] + (j == 3 ? m[i][3] : 0);
+      }
+    }
+    return r;
+  }
+
+  // 线性部分的行列式
+  real determinant() const {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  // 逆变换 [L^-1 | -L^-1 t], 线性部分不可逆时结果没有意义
+  affine_transform inverse() const {
+    affine_transform r;
+    real inv_det = 1 / determinant();
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        // 伴随矩阵: 代数余子式的转置
+        int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+        int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+        r.m[i][j] =
+            (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) * inv_det;
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] +
+                    r.m[i][2] * m[2][3]);
+    }
+    return r;
+  }
+
+  point3 apply_point(const point3& p) const {
+    return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                  m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                  m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+  }
+
+  vec3 apply_vector(const vec3& v) const {
+    return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+
+  // L^T v. 法向从物体坐标系变换到世界坐标系时乘以逆变换的转置
+  vec3 apply_transposed(const vec3& v) const {
+    return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+  }
+
+  // 变换后的包围盒 (Arvo 的方法: 每个分量分别取最小/最大的贡献)
+  aabb apply(const aabb& box) const {
+    point3 lo, hi;
+    for (int i = 0; i < 3; i++) {
+      lo[i] = hi[i] = m[i][3];
+      for (int j = 0; j < 3; j++) {
+        real a = m[i][j] * box.axis(j).min;
+        real b = m[i][j] * box.axis(j).max;
+        lo[i] += std::fmin(a, b);
+        hi[i] += std::fmax(a, b);
+      }
+    }
+    return aabb(lo, hi);
+  }
+};
+
+/**
+ * @brief 实例化的两层加速结构. 底层结构(任意 hittable, 通常是 bvh_node 或
+ * triangle_mesh)只保存一份, 每个实例只有两个 3x4 变换与底层结构的下标.
+ * 求交时把光线变换到物体坐标系(方向不归一化, 因此 t 在两个坐标系中相同),
+ * 交点与法向再变换回世界坐标系.
+ * 使用方式: 先 add_blas/add_instance, 再调用一次 build, 之后才能求交或
+ * 取包围盒(加入 hittable_list 之前)
+ *
+ */
+class instance_bvh : public hittable {
+ public:
+  static constexpr int max_leaf_size = 2;  // 叶子节点最多包含的实例数
+
+  /**
+   * @brief 添加一个底层结构
+   *
+   * @return int 底层结构的下标, 传给 add_instance
+   */
+  int add_blas(shared_ptr<hittable> object) {
+    blas.push_back(object);
+    blas_bounds.push_back(object->bounding_box());
+    return static_cast<int>(blas.size()) - 1;
+  }
+
+  /**
+   * @brief 添加一个实例
+   *
+   * @param blas_index add_blas 返回的下标
+   * @param to_world 物体坐标系到世界坐标系的变换, 线性部分需要可逆
+   */
+  void add_instance(int blas_index, const affine_transform& to_world) {
+    instance in;
+    in.to_world = to_world;
+    in.to_object = to_world.inverse();
+    in.blas = static_cast<std::uint32_t>(blas_index);
+    // 物体坐标系中光线锥的宽度按平均缩放比例换算
+    real scale = std::cbrt(std::fabs(in.to_object.determinant()));
+    in.cone_scale = std::fabs(scale - 1) < 1e-6 ? 1 : scale;
+    instances.push_back(in);
+  }
+
+  // 构建顶层 BVH, 实例按叶子顺序重新排列
+  void build() {
+    trace_scope scope("instance_bvh build", "scene", instances.size());
+    size_t n = instances.size();
+    std::vector<flat_bvh::build_prim> prims(n);
+    for (size_t k = 0; k < n; k++) {
+      auto box = instances[k].to_world.apply(blas_bounds[instances[k].blas]);
+      auto& prim = prims[k];
+      prim.index = static_cast<std::uint32_t>(k);
+      for (int a = 0; a < 3; a++) {
+        prim.lo[a] = box.axis(a).min;
+        prim.hi[a] = box.axis(a).max;
+        prim.c[a] = (prim.lo[a] + prim.hi[a]) / 2;
+      }
+    }
+    flat_bvh::build_bounds box;
+    tlas.build(prims, max_leaf_size, box);
+    std::vector<instance> sorted(n);
+    for (size_t k = 0; k < n; k++) sorted[k] = instances[prims[k].index];
+    instances.swap(sorted);
+    bbox = n ? aabb(point3(box.lo[0], box.lo[1], box.lo[2]),
+                    point3(box.hi[0], box.hi[1], box.hi[2]))
+                   .pad()
+             : aabb();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool hit_anything = false;
+    tlas.traverse(flat_bvh::ray_data(r), ray_t,
+                  [&](std::uint32_t first, std::uint32_t count,
+                      interval& t_range) {
+                    for (auto k = first; k < first + count; k++) {
+                      if (hit_instance(instances[k], r, t_range, rec)) {
+                        t_range.max = rec.t;
+                        hit_anything = true;
+                      }
+                    }
+                  });
+    return hit_anything;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  size_t instance_count() const { return instances.size(); }
+  size_t blas_count() const { return blas.size(); }
+  size_t node_count() const { return tlas.node_count(); }
+  // 实例与顶层 BVH 占用的内存(字节), 不包括底层结构
+  size_t memory_bytes() const {
+    return instances.capacity() * sizeof(instance) + tlas.memory_bytes();
+  }
+
+ private:
+  struct instance {
+    affine_transform to_world;   // 物体坐标系 -> 世界坐标系
+    affine_transform to_object;  // 世界坐标系 -> 物体坐标系
+    std::uint32_t blas;          // 底层结构的下标
+    real cone_scale;  // 世界坐标系的长度换算到物体坐标系的比例
+  };
+
+  std::vector<shared_ptr<hittable>> blas;
+  std::vector<aabb> blas_bounds;
+  std::vector<instance> instances;
+  flat_bvh tlas;
+  aabb bbox;
+
+  bool hit_instance(const instance& in, const ray& r, interval ray_t,
+                    hit_record& rec) const {
+    RTW_STAT_INC(instance_tests);
+    ray local(in.to_object.apply_point(r.origin()),
+              in.to_object.apply_vector(r.direction()), r.time());
+    local.set_cone(r.cone_width() * in.cone_scale, r.cone_spread());
+    if (!blas[in.blas]->hit(local, ray_t, rec)) return false;
+    rec.p = in.to_world.apply_point(rec.p);
+    // 法向乘以逆变换的转置, 有缩放时需要重新归一化
+    rec.normal = unit_vector(in.to_object.apply_transposed(rec.normal));
+    return true;
+  }
+};
+
+#endif
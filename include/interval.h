@@ -15,44 +15,58 @@
  * 例如：用于判断光线(射线) r(t) 中的t参数是否合法
  *
  */
-class interval {
+template <typename T>
+class basic_interval {
  public:
-  double min, max;
+  using value_type = T;
+  T min, max;
   // 默认的 interval 为空
-  interval() : min(+infinity), max(-infinity) {}  // Default interval is empty
+  basic_interval()
+      : min(+infinity), max(-infinity) {}  // Default interval is empty
 
-  interval(double _min, double _max) : min(_min), max(_max) {}
+  basic_interval(T _min, T _max) : min(_min), max(_max) {}
 
-  interval(const interval& a, const interval& b)
+  basic_interval(const basic_interval& a, const basic_interval& b)
       : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
   // 判断 x 是否在目标范围内部(包含边界)
-  bool contains(double x) const { return min <= x && x <= max; }
+  bool contains(T x) const { return min <= x && x <= max; }
   // 判断 x 是否在目标范围内部(不包含边界)
-  bool surrounds(double x) const { return min < x && x < max; }
+  bool surrounds(T x) const { return min < x && x < max; }
   // 将 x 夹到目标范围内部
-  double clamp(double x) const {
+  T clamp(T x) const {
     if (x < min) return min;
     if (x > max) return max;
     return x;
   }
-  double size() const { return max - min; }
-  interval expand(double delta) const {
-    auto padding = delta / 2.0;
-    return interval(min - padding, max + padding);
+  T size() const { return max - min; }
+  basic_interval expand(T delta) const {
+    auto padding = delta / 2;
+    return basic_interval(min - padding, max + padding);
   }
 
-  static const interval empty, universe;
+  static const basic_interval empty, universe;
 };
 // 全局静态范围, empty 空范围, universe 正负无限范围
-const interval interval::empty = interval(+infinity, -infinity);
-const interval interval::universe = interval(-infinity, +infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::empty =
+    basic_interval<T>(+infinity, -infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::universe =
+    basic_interval<T>(-infinity, +infinity);
+
+// 渲染器使用的范围类型, 精度由 real 决定(见 rtweekend.h)
+using interval = basic_interval<real>;
 
 // interval 运算
-interval operator+(const interval& ival, double displacement) {
-  return interval(ival.min + displacement, ival.max + displacement);
+template <typename T>
+basic_interval<T> operator+(const basic_interval<T>& ival,
+                            typename basic_interval<T>::value_type displacement) {
+  return basic_interval<T>(ival.min + displacement, ival.max + displacement);
 }
 
-interval operator+(double displacement, const interval& ival) {
+template <typename T>
+basic_interval<T> operator+(typename basic_interval<T>::value_type displacement,
+                            const basic_interval<T>& ival) {
   return ival + displacement;
 }
 #endif
\ No newline at end of file
@@ -14,11 +14,109 @@
 #include "hittable.h"
 #include "rtweekend.h"
 #include "texture.h"
+#include "texture_program.h"
 
 class hit_record;
+class material;
+
+// 材料的种类, 用于 wavefront 渲染时按种类分组着色
+enum class material_type {
+  lambertian = 0,
+  metal,
+  dielectric,
+  diffuse_light,
+  isotropic,
+  other,  // 其他自定义材料, 只能通过虚函数着色
+  count
+};
+
+/**
+ * @brief 材料的紧凑记录: 种类标签加上该种类需要的参数.
+ * 内置的五种材料是封闭的集合, 可以按标签直接调用对应的着色函数而不经过虚函数
+ *
+ */
+struct material_record {
+  material_type tag = material_type::other;
+  // lambertian/isotropic 的颜色, diffuse_light 的发光, 为编译后的纹理
+  const texture_program* tex = nullptr;
+  color albedo;               // metal 的衰减系数
+  double fuzz = 0;            // metal 的散射系数
+  double etai_over_etat = 1;  // dielectric 的 入射介质折射率/出射介质折射率
+};
+
+// 各种内置材料的着色函数, 虚函数与按标签着色共用同一份实现
+
+inline bool lambertian_scatter(const material_record& m, const ray& r_in,
+                               const hit_record& rec, color& attenuation,
+                               ray& scattered) {
+  vec3 scatter_direction = rec.normal + random_unit_vector();
+  if (scatter_direction.near_zero()) {
+    scatter_direction = rec.normal;
+  }
+
+  scattered = ray(rec.p, scatter_direction, r_in.time());
+  attenuation = m.tex->evaluate(rec.u, rec.v, rec.p, rec.du, rec.dv);
+  return true;
+}
+
+inline bool metal_scatter(const material_record& m, const ray& r_in,
+                          const hit_record& rec, color& attenuation,
+                          ray& scattered) {
+  // 理想反射光线方向
+  vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+  scattered = ray(rec.p, reflected + m.fuzz * random_unit_vector(), r_in.time());
+  attenuation = m.albedo;
+  return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+// 计算 反射折射比率
+inline double dielectric_reflectance(double cosine, double ref_idx) {
+  // 使用 Schlick's 逼近公式计算
+  auto r0 = (1 - ref_idx) / (1 + ref_idx);
+  r0 = r0 * r0;
+  return r0 + (1 - r0) * pow((1 - cosine), 5);
+}
+
+inline bool dielectric_scatter(const material_record& m, const ray& r_in,
+                               const hit_record& rec, color& attenuation,
+                               ray& scattered) {
+  attenuation = color(1.0, 1.0, 1.0);
+  // 根据入射光的方向进行判断 eta/eta' 的值
+  double refraction_ratio =
+      rec.front_face ? (1.0 / m.etai_over_etat) : (m.etai_over_etat);
+  vec3 unit_direction = unit_vector(r_in.direction());
+
+  // 入射角若很大则只发生反射, 没有折射
+  double cos_theta = fmin(dot(rec.normal, -unit_direction), 1.0);
+
+  double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+  bool cannot_refraction = refraction_ratio * sin_theta > 1.0;
+  vec3 direction;
+  if (cannot_refraction ||
+      dielectric_reflectance(cos_theta, refraction_ratio) > random_double()) {
+    // 若为反射
+    direction = reflect(unit_direction, rec.normal);
+  } else {
+    // 若为折射
+    direction = refract(unit_direction, rec.normal, refraction_ratio);
+  }
+  scattered = ray(rec.p, direction, r_in.time());
+  return true;
+}
+
+inline bool isotropic_scatter(const material_record& m, const ray& r_in,
+                              const hit_record& rec, color& attenuation,
+                              ray& scattered) {
+  // 反射光线在一个单元球内均匀的分布
+  scattered = ray(rec.p, random_unit_vector(), r_in.time());
+  attenuation = m.tex->evaluate(rec.u, rec.v, rec.p, rec.du, rec.dv);
+  return true;
+}
+
 /**
  * @brief 材料类, 所有特定的材料都必须继承该类并实现其中的
- * scatter() 函数, 如果材料有自发光可以重载 emitted() 函数
+ * scatter() 函数, 如果材料有自发光可以重载 emitted() 函数.
+ * 内置材料同时在 record() 中提供紧凑记录, 自定义材料的标签为 other
  *
  */
 class material {
@@ -40,6 +138,11 @@ class material {
   virtual color emitted(double u, double v, const point3& p) const {
     return color(0, 0, 0);
   }
+  const material_record& record() const { return data; }
+  material_type type() const { return data.tag; }
+
+ protected:
+  material_record data;
 };
 
 /**
@@ -50,23 +153,25 @@ class material {
  */
 class lambertian : public material {
  public:
-  lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
-  lambertian(shared_ptr<texture> _texture) : albedo(_texture){};
+  lambertian(const color& a) : lambertian(make_shared<solid_color>(a)) {}
+  lambertian(shared_ptr<texture> _texture)
+      : albedo(_texture), program(albedo.get()) {
+    data.tag = material_type::lambertian;
+    data.tex = &program;
+  }
+
+  // data.tex 指向自身的 program, 复制后会指向原对象, 因此禁止复制
+  lambertian(const lambertian&) = delete;
+  lambertian& operator=(const lambertian&) = delete;
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
                ray& scattered) const override {
-    vec3 scatter_direction = rec.normal + random_unit_vector();
-    if (scatter_direction.near_zero()) {
-      scatter_direction = rec.normal;
-    }
-
-    scattered = ray(rec.p, scatter_direction, r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
-    return true;
+    return lambertian_scatter(data, r_in, rec, attenuation, scattered);
   }
 
  private:
   shared_ptr<texture> albedo;  // 颜色
+  texture_program program;     // 编译后的 albedo
 };
 
 /**
@@ -77,20 +182,15 @@ class lambertian : public material {
  */
 class metal : public material {
  public:
-  metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+  metal(const color& a, double f) {
+    data.tag = material_type::metal;
+    data.albedo = a;            // 衰减系数
+    data.fuzz = f < 1 ? f : 1;  // 散射系数
+  }
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
                ray& scattered) const override {
-    // 理想反射光线方向
-    vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-    scattered =
-        ray(rec.p, reflected + fuzz * random_unit_vector(), r_in.time());
-    attenuation = albedo;
-    return (dot(scattered.direction(), rec.normal) > 0);
+    return metal_scatter(data, r_in, rec, attenuation, scattered);
   }
-
- private:
-  color albedo;  // 衰减系数
-  double fuzz;   // 散射系数
 };
 
 /**
@@ -100,43 +200,14 @@ class metal : public material {
  */
 class dielectric : public material {
  public:
-  dielectric(double _etai_over_etat) : etai_over_etat(_etai_over_etat) {}
+  dielectric(double _etai_over_etat) {
+    data.tag = material_type::dielectric;
+    data.etai_over_etat = _etai_over_etat;
+  }
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
                ray& scattered) const override {
-    attenuation = color(1.0, 1.0, 1.0);
-    // 根据入射光的方向进行判断 eta/eta' 的值
-    double refraction_ratio =
-        rec.front_face ? (1.0 / etai_over_etat) : (etai_over_etat);
-    vec3 unit_direction = unit_vector(r_in.direction());
-
-    // 入射角若很大则只发生反射, 没有折射
-    double cos_theta = fmin(dot(rec.normal, -unit_direction), 1.0);
-
-    double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
-    bool cannot_refraction = refraction_ratio * sin_theta > 1.0;
-    vec3 direction;
-    if (cannot_refraction ||
-        reflectance(cos_theta, refraction_ratio) > random_double()) {
-      // 若为反射
-      direction = reflect(unit_direction, rec.normal);
-    } else {
-      // 若为折射
-      direction = refract(unit_direction, rec.normal, refraction_ratio);
-    }
-    scattered = ray(rec.p, direction, r_in.time());
-    return true;
-  }
-
- private:
-  double etai_over_etat;  // 入射介质折射率/出射介质折射率
-
-  // 计算 反射折射比率
-  static double reflectance(double cosine, double ref_idx) {
-    // 使用 Schlick's 逼近公式计算
-    auto r0 = (1 - ref_idx) / (1 + ref_idx);
-    r0 = r0 * r0;
-    return r0 + (1 - r0) * pow((1 - cosine), 5);
+    return dielectric_scatter(data, r_in, rec, attenuation, scattered);
   }
 };
 
@@ -146,8 +217,14 @@ class dielectric : public material {
  */
 class diffuse_light : public material {
  public:
-  diffuse_light(shared_ptr<texture> a) : emit(a) {}
-  diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
+  diffuse_light(shared_ptr<texture> a) : emit(a), program(emit.get(), false) {
+    data.tag = material_type::diffuse_light;
+    data.tex = &program;
+  }
+  diffuse_light(color c) : diffuse_light(make_shared<solid_color>(c)) {}
+
+  diffuse_light(const diffuse_light&) = delete;
+  diffuse_light& operator=(const diffuse_light&) = delete;
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
                ray& scattered) const override {
@@ -155,11 +232,12 @@ class diffuse_light : public material {
   }
 
   color emitted(double u, double v, const point3& p) const override {
-    return emit->value(u, v, p);
+    return program.evaluate(u, v, p);
   }
 
  private:
   shared_ptr<texture> emit;  // 发出的光
+  texture_program program;   // 编译后的 emit
 };
 
 /**
@@ -168,18 +246,66 @@ class diffuse_light : public material {
  */
 class isotropic : public material {
  public:
-  isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
-  isotropic(shared_ptr<texture> a) : albedo(a) {}
+  isotropic(color c) : isotropic(make_shared<solid_color>(c)) {}
+  isotropic(shared_ptr<texture> a) : albedo(a), program(albedo.get()) {
+    data.tag = material_type::isotropic;
+    data.tex = &program;
+  }
+
+  isotropic(const isotropic&) = delete;
+  isotropic& operator=(const isotropic&) = delete;
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation,
                ray& scattered) const override {
-    // 反射光线在一个单元球内均匀的分布
-    scattered = ray(rec.p, random_unit_vector(), r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
-    return true;
+    return isotropic_scatter(data, r_in, rec, attenuation, scattered);
   }
 
  private:
   shared_ptr<texture> albedo;
+  texture_program program;  // 编译后的 albedo
 };
+
+/**
+ * @brief 按编译期已知的材料种类着色, 内置材料直接调用对应的着色函数,
+ * other 通过虚函数调用. 用于按种类分组的批量着色
+ *
+ * @return true 存在反射光线
+ */
+template <material_type T>
+inline bool scatter_as(const material* mat, const ray& r_in,
+                       const hit_record& rec, color& attenuation,
+                       ray& scattered) {
+  const auto& m = mat->record();
+  if constexpr (T == material_type::lambertian) {
+    return lambertian_scatter(m, r_in, rec, attenuation, scattered);
+  } else if constexpr (T == material_type::metal) {
+    return metal_scatter(m, r_in, rec, attenuation, scattered);
+  } else if constexpr (T == material_type::dielectric) {
+    return dielectric_scatter(m, r_in, rec, attenuation, scattered);
+  } else if constexpr (T == material_type::diffuse_light) {
+    return false;
+  } else if constexpr (T == material_type::isotropic) {
+    return isotropic_scatter(m, r_in, rec, attenuation, scattered);
+  } else {
+    return mat->scatter(r_in, rec, attenuation, scattered);
+  }
+}
+
+// 与 scatter_as 对应的自发光, 只有 diffuse_light 与自定义材料可能发光
+template <material_type T>
+constexpr bool emits_as() {
+  return T == material_type::diffuse_light || T == material_type::other;
+}
+
+template <material_type T>
+inline color emitted_as(const material* mat, double u, double v,
+                        const point3& p) {
+  if constexpr (T == material_type::diffuse_light) {
+    return mat->record().tex->evaluate(u, v, p);
+  } else if constexpr (T == material_type::other) {
+    return mat->emitted(u, v, p);
+  } else {
+    return color(0, 0, 0);
+  }
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,749 @@
+/**
+ * @file mesh_loader.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 三角形网格的读取: 并行解析的 Wavefront OBJ 与二进制 PLY
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "rtweekend.h"
+#include "trace.h"
+#include "triangle_mesh.h"
+
+namespace mesh_io {
+
+// 读取整个文件
+inline bool read_file(const std::string& path, std::string& bytes) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "ERROR: Could not open mesh file '" << path << "'.\n";
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  bytes.resize(static_cast<size_t>(in.tellg()));
+  in.seekg(0, std::ios::beg);
+  in.read(&bytes[0], static_cast<std::streamsize>(bytes.size()));
+  return static_cast<bool>(in);
+}
+
+// 标记缺失的纹理坐标/法向下标
+constexpr std::uint32_t missing_index = std::numeric_limits<std::uint32_t>::max();
+
+/**
+ * @brief OBJ 的一个分块, 从行首开始到行尾结束. 第一遍统计每个分块中各种
+ * 元素的个数, 前缀和得到每个分块在结果数组中的起始位置, 第二遍并行解析
+ *
+ */
+struct obj_chunk {
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  size_t v = 0, vt = 0, vn = 0, triangles = 0;  // 分块中的个数
+  size_t v_offset = 0, vt_offset = 0, vn_offset = 0, triangle_offset = 0;
+  bool ok = true;
+  size_t error_line = 0;  // 解析失败的行在分块中的行号(从 1 开始)
+};
+
+inline const char* skip_blank(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  return p;
+}
+
+inline const char* line_end(const char* p, const char* end) {
+  auto e = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return e ? e : end;
+}
+
+// 行的类型: v, vt, vn, f 或其他(忽略)
+enum class obj_line { other, v, vt, vn, f };
+
+inline obj_line classify(const char*& p, const char* end) {
+  p = skip_blank(p, end);
+  if (end - p < 2) return obj_line::other;
+  auto separated = [&](int n) {
+    return p + n < end && (p[n] == ' ' || p[n] == '\t');
+  };
+  if (p[0] == 'v') {
+    if (separated(1)) return p += 1, obj_line::v;
+    if (p[1] == 't' && separated(2)) return p += 2, obj_line::vt;
+    if (p[1] == 'n' && separated(2)) return p += 2, obj_line::vn;
+  } else if (p[0] == 'f' && separated(1)) {
+    return p += 1, obj_line::f;
+  }
+  return obj_line::other;
+}
+
+// 面的顶点数, 即空白分隔的记号数
+inline size_t count_tokens(const char* p, const char* end) {
+  size_t n = 0;
+  for (;;) {
+    p = skip_blank(p, end);
+    if (p == end || *p == '\r' || *p == '#') return n;
+    n++;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+  }
+}
+
+inline bool parse_real(const char*& p, const char* end, real& value) {
+  p = skip_blank(p, end);
+  // from_chars 不接受前导的 '+'
+  if (p < end && *p == '+') p++;
+  auto result = std::from_chars(p, end, value);
+  if (result.ec != std::errc()) return false;
+  p = result.ptr;
+  return true;
+}
+
+/**
+ * @brief OBJ 的下标从 1 开始, 负数表示相对于当前已定义元素个数的位置
+ *
+ * @param count 这一行之前已经定义的元素个数
+ */
+inline bool parse_index(const char*& p, const char* end, size_t count,
+                        std::uint32_t& index) {
+  long value;
+  auto result = std::from_chars(p, end, value);
+  if (result.ec != std::errc() || value == 0) return false;
+  p = result.ptr;
+  long resolved = value > 0 ? value - 1 : static_cast<long>(count) + value;
+  if (resolved < 0) return false;
+  index = static_cast<std::uint32_t>(resolved);
+  return true;
+}
+
+// 第一遍: 统计分块中的元素个数, 多边形按扇形拆分为三角形
+inline void count_obj_chunk(obj_chunk& c) {
+  for (const char* p = c.begin; p < c.end;) {
+    const char* e = line_end(p, c.end);
+    const char* q = p;
+    switch (classify(q, e)) {
+      case obj_line::v:
+        c.v++;
+        break;
+      case obj_line::vt:
+        c.vt++;
+        break;
+      case obj_line::vn:
+        c.vn++;
+        break;
+      case obj_line::f: {
+        size_t n = count_tokens(q, e);
+        if (n >= 3) c.triangles += n - 2;
+        break;
+      }
+      default:
+        break;
+    }
+    p = e + 1;
+  }
+}
+
+// 第二遍: 把分块中的元素写入 mesh 中已经分配好的位置
+inline void parse_obj_chunk(obj_chunk& c, mesh_data& mesh,
+                            std::vector<std::uint32_t>& uv_indices,
+                            std::vector<std::uint32_t>& normal_indices) {
+  size_t v = c.v_offset, vt = c.vt_offset, vn = c.vn_offset;
+  size_t t = c.triangle_offset;
+  size_t line = 0;
+  std::vector<std::uint32_t> corners[3];
+  for (const char* p = c.begin; p < c.end && c.ok;) {
+    const char* e = line_end(p, c.end);
+    line++;
+    const char* q = p;
+    bool ok = true;
+    switch (classify(q, e)) {
+      case obj_line::v:
+        ok = parse_real(q, e, mesh.px[v]) && parse_real(q, e, mesh.py[v]) &&
+             parse_real(q, e, mesh.pz[v]);
+        v++;
+        break;
+      case obj_line::vt:
+        // 只使用前两个分量, 没有 v 分量时取 0
+        ok = parse_real(q, e, mesh.tu[vt]);
+        if (ok && !parse_real(q, e, mesh.tv[vt])) mesh.tv[vt] = 0;
+        vt++;
+        break;
+      case obj_line::vn:
+        ok = parse_real(q, e, mesh.nx[vn]) && parse_real(q, e, mesh.ny[vn]) &&
+             parse_real(q, e, mesh.nz[vn]);
+        vn++;
+        break;
+      case obj_line::f: {
+        for (auto& list : corners) list.clear();
+        // 每个角的形式为 v, v/vt, v//vn 或 v/vt/vn
+        for (;;) {
+          q = skip_blank(q, e);
+          if (q == e || *q == '\r' || *q == '#') break;
+          std::uint32_t index[3] = {missing_index, missing_index,
+                                    missing_index};
+          size_t counts[3] = {v, vt, vn};
+          for (int k = 0; k < 3 && ok; k++) {
+            if (k > 0) {
+              if (q == e || *q != '/') break;
+              q++;
+              if (q < e && *q == '/') continue;  // v//vn
+            }
+            ok = parse_index(q, e, counts[k], index[k]);
+          }
+          if (ok && q < e && *q != ' ' && *q != '\t' && *q != '\r') ok = false;
+          if (!ok) break;
+          for (int k = 0; k < 3; k++) corners[k].push_back(index[k]);
+        }
+        size_t n = corners[0].size();
+        for (size_t k = 1; ok && k + 1 < n; k++, t++) {
+          const size_t fan[3] = {0, k, k + 1};
+          for (int j = 0; j < 3; j++) {
+            mesh.indices[3 * t + j] = corners[0][fan[j]];
+            uv_indices[3 * t + j] = corners[1][fan[j]];
+            normal_indices[3 * t + j] = corners[2][fan[j]];
+          }
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    if (!ok) {
+      c.ok = false;
+      c.error_line = line;
+    }
+    p = e + 1;
+  }
+}
+
+// 下标数组中有缺失的下标时返回 true
+inline bool has_missing(const std::vector<std::uint32_t>& indices) {
+  return std::find(indices.begin(), indices.end(), missing_index) !=
+         indices.end();
+}
+
+/**
+ * @brief 二进制 PLY 的标量类型
+ *
+ */
+enum class ply_type { invalid, int8, uint8, int16, uint16, int32, uint32,
+                      float32, float64 };
+
+inline ply_type parse_ply_type(const std::string& name) {
+  if (name == "char" || name == "int8") return ply_type::int8;
+  if (name == "uchar" || name == "uint8") return ply_type::uint8;
+  if (name == "short" || name == "int16") return ply_type::int16;
+  if (name == "ushort" || name == "uint16") return ply_type::uint16;
+  if (name == "int" || name == "int32") return ply_type::int32;
+  if (name == "uint" || name == "uint32") return ply_type::uint32;
+  if (name == "float" || name == "float32") return ply_type::float32;
+  if (name == "double" || name == "float64") return ply_type::float64;
+  return ply_type::invalid;
+}
+
+inline size_t ply_type_size(ply_type type) {
+  switch (type) {
+    case ply_type::int8:
+    case ply_type::uint8:
+      return 1;
+    case ply_type::int16:
+    case ply_type::uint16:
+      return 2;
+    case ply_type::int32:
+    case ply_type::uint32:
+    case ply_type::float32:
+      return 4;
+    case ply_type::float64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+// 读取一个标量, swap 为 true 时先交换字节序
+template <typename T>
+inline T read_ply_raw(const char* p, bool swap) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap) std::reverse(bytes, bytes + sizeof(T));
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+inline double read_ply_scalar(const char* p, ply_type type, bool swap) {
+  switch (type) {
+    case ply_type::int8:
+      return read_ply_raw<std::int8_t>(p, swap);
+    case ply_type::uint8:
+      return read_ply_raw<std::uint8_t>(p, swap);
+    case ply_type::int16:
+      return read_ply_raw<std::int16_t>(p, swap);
+    case ply_type::uint16:
+      return read_ply_raw<std::uint16_t>(p, swap);
+    case ply_type::int32:
+      return read_ply_raw<std::int32_t>(p, swap);
+    case ply_type::uint32:
+      return read_ply_raw<std::uint32_t>(p, swap);
+    case ply_type::float32:
+      return read_ply_raw<float>(p, swap);
+    case ply_type::float64:
+      return read_ply_raw<double>(p, swap);
+    default:
+      return 0;
+  }
+}
+
+struct ply_property {
+  std::string name;
+  ply_type type = ply_type::invalid;        // 标量属性的类型, 列表元素的类型
+  ply_type count_type = ply_type::invalid;  // 列表长度的类型, 标量属性为 invalid
+  size_t offset = 0;  // 在定长元素中的字节偏移
+
+  bool is_list() const { return count_type != ply_type::invalid; }
+};
+
+struct ply_element {
+  std::string name;
+  size_t count = 0;
+  std::vector<ply_property> properties;
+  size_t stride = 0;  // 没有列表属性时每个元素的字节数, 否则为 0
+
+  const ply_property* find(std::initializer_list<const char*> names) const {
+    for (const auto& prop : properties) {
+      for (auto n : names) {
+        if (prop.name == n) return &prop;
+      }
+    }
+    return nullptr;
+  }
+};
+
+// 从 p 开始的一个(可能含列表属性的)元素的字节数, 越界时返回 0
+inline size_t ply_element_size(const ply_element& element, const char* p,
+                               const char* end, bool swap) {
+  if (element.stride) return element.stride;
+  size_t size = 0;
+  for (const auto& prop : element.properties) {
+    if (prop.is_list()) {
+      size_t count_size = ply_type_size(prop.count_type);
+      if (size_t(end - p) < size + count_size) return 0;
+      double n = read_ply_scalar(p + size, prop.count_type, swap);
+      // 负数, NaN 或超出文件长度的列表长度
+      if (!(n >= 0 && n <= double(end - p))) return 0;
+      size += count_size + static_cast<size_t>(n) * ply_type_size(prop.type);
+    } else {
+      size += ply_type_size(prop.type);
+    }
+  }
+  return size > size_t(end - p) ? 0 : size;
+}
+
+// 读取列表中的一个顶点下标, 不是 [0, vertex_count) 内的数时返回 false
+inline bool read_ply_index(const char* p, ply_type type, bool swap,
+                           size_t vertex_count, std::uint32_t& index) {
+  double value = read_ply_scalar(p, type, swap);
+  if (!(value >= 0 && value < double(vertex_count))) return false;
+  index = static_cast<std::uint32_t>(value);
+  return true;
+}
+
+}  // namespace mesh_io
+
+/**
+ * @brief 读取 Wavefront OBJ 的顶点, 纹理坐标, 法向与面. 多边形按扇形拆分为
+ * 三角形, 其他语句(o, g, usemtl ...)被忽略. 文件按行切分为多个分块并行解析,
+ * 只有任意一个角缺少纹理坐标/法向时才丢弃整个网格的这一属性
+ *
+ * @param path 文件路径
+ * @param mesh 读取的网格
+ * @param threads 线程数, <=0 时使用全部硬件线程
+ * @return true 读取成功
+ */
+inline bool load_obj(const std::string& path, mesh_data& mesh,
+                     int threads = 0) {
+  using namespace mesh_io;
+  trace_scope scope("load_obj", "scene");
+  std::string bytes;
+  if (!read_file(path, bytes)) return false;
+  threads = resolve_thread_count(threads);
+
+  // 按换行符切分, 每块至少 1MB, 块数为线程数的若干倍以平衡负载
+  const char* data = bytes.data();
+  const char* end = data + bytes.size();
+  size_t target = std::max<size_t>(bytes.size() / (size_t(threads) * 8), 1 << 20);
+  std::vector<obj_chunk> chunks;
+  for (const char* p = data; p < end;) {
+    obj_chunk c;
+    c.begin = p;
+    const char* e = p + std::min<size_t>(target, end - p);
+    c.end = e < end ? line_end(e, end) : end;
+    if (c.end < end) c.end++;  // 包含换行符
+    chunks.push_back(c);
+    p = c.end;
+  }
+  int chunk_count = static_cast<int>(chunks.size());
+  parallel_for(chunk_count, threads,
+               [&](int i, int) { count_obj_chunk(chunks[i]); });
+
+  size_t v = 0, vt = 0, vn = 0, triangles = 0;
+  for (auto& c : chunks) {
+    c.v_offset = v;
+    c.vt_offset = vt;
+    c.vn_offset = vn;
+    c.triangle_offset = triangles;
+    v += c.v;
+    vt += c.vt;
+    vn += c.vn;
+    triangles += c.triangles;
+  }
+  if (v > missing_index || 3 * triangles > missing_index) {
+    std::cerr << "ERROR: Mesh file '" << path << "' is too large.\n";
+    return false;
+  }
+
+  mesh = mesh_data();
+  mesh.px.resize(v);
+  mesh.py.resize(v);
+  mesh.pz.resize(v);
+  mesh.tu.resize(vt);
+  mesh.tv.resize(vt);
+  mesh.nx.resize(vn);
+  mesh.ny.resize(vn);
+  mesh.nz.resize(vn);
+  mesh.indices.resize(3 * triangles);
+  std::vector<std::uint32_t> uv_indices(3 * triangles);
+  std::vector<std::uint32_t> normal_indices(3 * triangles);
+  parallel_for(chunk_count, threads, [&](int i, int) {
+    parse_obj_chunk(chunks[i], mesh, uv_indices, normal_indices);
+  });
+
+  size_t line = 0;
+  for (const auto& c : chunks) {
+    if (!c.ok) {
+      std::cerr << "ERROR: Could not parse line " << line + c.error_line
+                << " of mesh file '" << path << "'.\n";
+      return false;
+    }
+    line += std::count(c.begin, c.end, '\n');
+  }
+
+  // 缺少纹理坐标/法向的网格丢弃这一属性, 与顶点下标相同的下标数组不保存
+  if (vt == 0 || has_missing(uv_indices)) {
+    mesh.tu.clear();
+    mesh.tv.clear();
+  } else if (uv_indices != mesh.indices) {
+    mesh.uv_indices.swap(uv_indices);
+  }
+  if (vn == 0 || has_missing(normal_indices)) {
+    mesh.nx.clear();
+    mesh.ny.clear();
+    mesh.nz.clear();
+  } else if (normal_indices != mesh.indices) {
+    mesh.normal_indices.swap(normal_indices);
+  }
+  mesh.tu.shrink_to_fit();
+  mesh.tv.shrink_to_fit();
+  mesh.nx.shrink_to_fit();
+  mesh.ny.shrink_to_fit();
+  mesh.nz.shrink_to_fit();
+
+  std::string error;
+  if (!mesh.validate(error)) {
+    std::cerr << "ERROR: Invalid mesh file '" << path << "': " << error
+              << ".\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 读取二进制(大端或小端) PLY. 使用 vertex 元素的 x y z, nx ny nz 与
+ * u v(或 s t, texture_u texture_v) 属性, face 元素的 vertex_indices 列表,
+ * 其他元素与属性被跳过. 顶点按固定步长并行解析; 所有面都是三角形时面也按
+ * 固定步长并行解析, 否则逐个读取并按扇形拆分
+ *
+ * @param path 文件路径
+ * @param mesh 读取的网格
+ * @param threads 线程数, <=0 时使用全部硬件线程
+ * @return true 读取成功
+ */
+inline bool load_ply(const std::string& path, mesh_data& mesh,
+                     int threads = 0) {
+  using namespace mesh_io;
+  trace_scope scope("load_ply", "scene");
+  std::string bytes;
+  if (!read_file(path, bytes)) return false;
+  threads = resolve_thread_count(threads);
+  auto fail = [&](const std::string& reason) {
+    std::cerr << "ERROR: Invalid PLY file '" << path << "': " << reason
+              << ".\n";
+    return false;
+  };
+
+  // 文件头: 逐行解析, 直到恰好为 end_header 的一行
+  if (bytes.compare(0, 3, "ply") != 0) return fail("missing header");
+  std::vector<ply_element> elements;
+  bool big_endian = false;
+  size_t body = std::string::npos;
+  for (size_t pos = 0; pos < bytes.size();) {
+    size_t eol = bytes.find('\n', pos);
+    if (eol == std::string::npos) break;
+    std::string line = bytes.substr(pos, eol - pos);
+    pos = eol + 1;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line == "end_header") {
+      body = pos;
+      break;
+    }
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      words >> format;
+      if (format == "binary_big_endian") {
+        big_endian = true;
+      } else if (format != "binary_little_endian") {
+        return fail("unsupported format '" + format + "'");
+      }
+    } else if (keyword == "element") {
+      ply_element element;
+      words >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) return fail("property outside of an element");
+      ply_property prop;
+      std::string type;
+      words >> type;
+      if (type == "list") {
+        std::string count_type, item_type;
+        words >> count_type >> item_type;
+        prop.count_type = parse_ply_type(count_type);
+        prop.type = parse_ply_type(item_type);
+        if (prop.count_type == ply_type::invalid) return fail("bad list type");
+      } else {
+        prop.type = parse_ply_type(type);
+      }
+      if (prop.type == ply_type::invalid) return fail("bad property type");
+      words >> prop.name;
+      elements.back().properties.push_back(prop);
+    }
+  }
+  if (body == std::string::npos) return fail("missing header");
+  for (auto& element : elements) {
+    size_t offset = 0;
+    bool fixed = true;
+    for (auto& prop : element.properties) {
+      prop.offset = offset;
+      fixed = fixed && !prop.is_list();
+      offset += ply_type_size(prop.type);
+    }
+    element.stride = fixed ? offset : 0;
+  }
+  const std::uint16_t one = 1;
+  bool host_little = *reinterpret_cast<const char*>(&one) == 1;
+  bool swap = big_endian == host_little;
+
+  // 面中的顶点下标需要小于顶点数, 与元素的先后顺序无关
+  size_t vertex_count = 0;
+  for (const auto& element : elements) {
+    if (element.name == "vertex") vertex_count = element.count;
+  }
+
+  mesh = mesh_data();
+  const char* p = bytes.data() + body;
+  const char* end = bytes.data() + bytes.size();
+  bool has_vertex = false, has_face = false;
+  for (const auto& element : elements) {
+    if (element.name == "vertex") {
+      has_vertex = true;
+      if (!element.stride) return fail("list property in vertex element");
+      if (element.count > missing_index) return fail("too many vertices");
+      if (size_t(end - p) / element.stride < element.count)
+        return fail("truncated vertex data");
+      auto x = element.find({"x"}), y = element.find({"y"}),
+           z = element.find({"z"});
+      if (!x || !y || !z) return fail("vertex element without x y z");
+      auto nx = element.find({"nx"}), ny = element.find({"ny"}),
+           nz = element.find({"nz"});
+      auto u = element.find({"u", "s", "texture_u"}),
+           v = element.find({"v", "t", "texture_v"});
+      bool normals = nx && ny && nz, uvs = u && v;
+      size_t n = element.count;
+      mesh.px.resize(n);
+      mesh.py.resize(n);
+      mesh.pz.resize(n);
+      if (normals) {
+        mesh.nx.resize(n);
+        mesh.ny.resize(n);
+        mesh.nz.resize(n);
+      }
+      if (uvs) {
+        mesh.tu.resize(n);
+        mesh.tv.resize(n);
+      }
+      // 固定步长, 每个任务解析一段连续的顶点
+      const size_t block = 1 << 16;
+      int blocks = static_cast<int>((n + block - 1) / block);
+      const char* base = p;
+      parallel_for(blocks, threads, [&](int b, int) {
+        size_t last = std::min(n, (size_t(b) + 1) * block);
+        for (size_t i = size_t(b) * block; i < last; i++) {
+          const char* q = base + i * element.stride;
+          auto get = [&](const ply_property* prop) {
+            return static_cast<real>(
+                read_ply_scalar(q + prop->offset, prop->type, swap));
+          };
+          mesh.px[i] = get(x);
+          mesh.py[i] = get(y);
+          mesh.pz[i] = get(z);
+          if (normals) {
+            mesh.nx[i] = get(nx);
+            mesh.ny[i] = get(ny);
+            mesh.nz[i] = get(nz);
+          }
+          if (uvs) {
+            mesh.tu[i] = get(u);
+            mesh.tv[i] = get(v);
+          }
+        }
+      });
+      p += n * element.stride;
+    } else if (element.name == "face") {
+      has_face = true;
+      auto list = element.find({"vertex_indices", "vertex_index"});
+      if (!list || !list->is_list()) return fail("face element without list");
+      // 列表之前的属性都是标量, 偏移是固定的
+      size_t list_offset = 0;
+      for (const auto& prop : element.properties) {
+        if (&prop == list) break;
+        if (prop.is_list()) return fail("unsupported face layout");
+        list_offset += ply_type_size(prop.type);
+      }
+      size_t count_size = ply_type_size(list->count_type);
+      size_t index_size = ply_type_size(list->type);
+      size_t tail = 0;  // 列表之后的属性
+      bool fixed_tail = true;
+      for (auto it = element.properties.begin() + (list - &element.properties[0]) + 1;
+           it != element.properties.end(); ++it) {
+        fixed_tail = fixed_tail && !it->is_list();
+        tail += ply_type_size(it->type);
+      }
+      size_t n = element.count;
+      size_t stride = list_offset + count_size + 3 * index_size + tail;
+
+      // 假设所有面都是三角形, 并行检查. 第一个不是三角形的面之前的面都是
+      // 三角形, 所以它的位置是正确的, 一定会被检查出来
+      std::atomic<bool> triangles_only(fixed_tail &&
+                                       size_t(end - p) / stride >= n);
+      const size_t block = 1 << 16;
+      int blocks = static_cast<int>((n + block - 1) / block);
+      const char* base = p;
+      std::atomic<bool> bad_index(false);
+      if (triangles_only) {
+        if (3 * n > missing_index) return fail("too many faces");
+        mesh.indices.resize(3 * n);
+        parallel_for(blocks, threads, [&](int b, int) {
+          size_t last = std::min(n, (size_t(b) + 1) * block);
+          for (size_t i = size_t(b) * block; i < last; i++) {
+            const char* q = base + i * stride + list_offset;
+            if (read_ply_scalar(q, list->count_type, swap) != 3) {
+              triangles_only = false;
+              return;
+            }
+            for (int k = 0; k < 3; k++) {
+              if (!read_ply_index(q + count_size + k * index_size, list->type,
+                                  swap, vertex_count,
+                                  mesh.indices[3 * i + k])) {
+                bad_index = true;
+                return;
+              }
+            }
+          }
+        });
+      }
+      // 存在非三角形的面时, 其后的块读到的是错位的数据, 由逐个读取重新检查
+      if (triangles_only && bad_index)
+        return fail("vertex index out of range");
+      if (triangles_only) {
+        p += n * stride;
+      } else {
+        // 含有多边形: 逐个读取, 按扇形拆分
+        mesh.indices.clear();
+        for (size_t i = 0; i < n; i++) {
+          size_t size = ply_element_size(element, p, end, swap);
+          if (size == 0) return fail("truncated face data");
+          const char* q = p + list_offset;
+          auto count = static_cast<size_t>(
+              read_ply_scalar(q, list->count_type, swap));
+          std::uint32_t first, prev, next;
+          auto index = [&](size_t k, std::uint32_t& i) {
+            return read_ply_index(q + count_size + k * index_size, list->type,
+                                  swap, vertex_count, i);
+          };
+          if (count >= 3 && (!index(0, first) || !index(1, prev)))
+            return fail("vertex index out of range");
+          for (size_t k = 1; k + 1 < count; k++) {
+            if (!index(k + 1, next)) return fail("vertex index out of range");
+            mesh.indices.push_back(first);
+            mesh.indices.push_back(prev);
+            mesh.indices.push_back(next);
+            prev = next;
+          }
+          p += size;
+        }
+        if (mesh.indices.size() > missing_index) return fail("too many faces");
+      }
+    } else {
+      // 跳过其他元素
+      if (element.stride) {
+        if (size_t(end - p) / element.stride < element.count)
+          return fail("truncated data");
+        p += element.count * element.stride;
+      } else {
+        for (size_t i = 0; i < element.count; i++) {
+          size_t size = ply_element_size(element, p, end, swap);
+          if (size == 0) return fail("truncated data");
+          p += size;
+        }
+      }
+    }
+  }
+  if (!has_vertex || !has_face) return fail("missing vertex or face element");
+
+  std::string error;
+  if (!mesh.validate(error)) return fail(error);
+  return true;
+}
+
+/**
+ * @brief 按扩展名(.obj 或 .ply, 不区分大小写)选择读取方式
+ *
+ */
+inline bool load_mesh(const std::string& path, mesh_data& mesh,
+                      int threads = 0) {
+  auto dot = path.find_last_of('.');
+  std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+  for (auto& ch : ext) ch = static_cast<char>(std::tolower(ch));
+  if (ext == "obj") return load_obj(path, mesh, threads);
+  if (ext == "ply") return load_ply(path, mesh, threads);
+  std::cerr << "ERROR: Unsupported mesh file '" << path
+            << "' (expected .obj or .ply).\n";
+  return false;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file mipmap.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 图片纹理的 mip 金字塔与双线性/三线性滤波
+ * @version 0.1
+ * @date 2023-09-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "color.h"
+#include "rtweekend.h"
+#include "texel_storage.h"
+#include "trace.h"
+
+// 纹理的滤波方式
+enum class texture_filter {
+  nearest,    // 最近邻, 只使用第 0 层
+  bilinear,   // 第 0 层上的双线性插值
+  trilinear,  // 按光线覆盖的纹理范围选择相邻两层, 层内双线性插值, 层间线性插值
+};
+
+/**
+ * @brief 把 8 位 RGB 图像缩小为一半(宽高向下取整, 至少为 1), 每个像素为原图
+ * 2x2 像素的平均值. 宽高为大于 1 的奇数时丢弃最后一行/列; 宽或高为 1 时
+ * 这一行/列与自身平均
+ *
+ * @param src 按行存放的原图
+ * @param width 原图的宽
+ * @param height 原图的高
+ * @param dst 输出: 缩小后的图像
+ */
+inline void downsample_rgb8(const std::vector<unsigned char>& src, int width,
+                            int height, std::vector<unsigned char>& dst) {
+  int w = std::max(1, width / 2), h = std::max(1, height / 2);
+  dst.resize(size_t(w) * h * 3);
+  auto at = [&](int x, int y) {
+    x = std::min(x, width - 1);
+    y = std::min(y, height - 1);
+    return src.data() + (size_t(y) * width + x) * 3;
+  };
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = at(2 * x, 2 * y)[c] + at(2 * x + 1, 2 * y)[c] +
+                  at(2 * x, 2 * y + 1)[c] + at(2 * x + 1, 2 * y + 1)[c];
+        dst[(size_t(y) * w + x) * 3 + c] =
+            static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+/**
+ * @brief 三线性滤波: 由覆盖范围(以第 0 层的像素为单位)的 log2 选择相邻两层,
+ * 在两层上分别双线性插值后再线性插值
+ *
+ * @param level_count 层数
+ * @param footprint 覆盖范围, <=1 时只在第 0 层双线性插值
+ * @param bilinear color bilinear(int level), 第 level 层上的双线性插值
+ */
+template <typename Bilinear>
+color trilinear_filter(int level_count, double footprint,
+                       const Bilinear& bilinear) {
+  if (!(footprint > 1)) return bilinear(0);
+  double lod = std::min(std::log2(footprint), double(level_count - 1));
+  int l0 = static_cast<int>(lod);
+  double f = lod - l0;
+  if (l0 + 1 >= level_count || f == 0) return bilinear(l0);
+  return (1 - f) * bilinear(l0) + f * bilinear(l0 + 1);
+}
+
+/**
+ * @brief 图像的 mip 金字塔. 第 0 层为原图, 之后每层的宽高减半
+ * (至少为 1), 由上一层的 2x2 像素取平均得到. 各层的像素按
+ * texel_storage_options 指定的格式与排列方式存储
+ *
+ */
+class mip_pyramid {
+ public:
+  mip_pyramid() {}
+
+  /**
+   * @brief 由 8 位 RGB 图像构建金字塔
+   *
+   * @param rgb 按行存放的像素, 每个像素 3 个字节
+   * @param width 图像的宽
+   * @param height 图像的高
+   * @param options 各层像素的存储方式
+   */
+  void build(const unsigned char* rgb, int width, int height,
+             texel_storage_options options = default_texel_storage()) {
+    trace_scope scope("mip_pyramid::build", "texture");
+    levels.clear();
+    if (!rgb || width <= 0 || height <= 0) return;
+    // 先以 8 位整数逐层求平均, 再转换为各层的存储格式
+    std::vector<unsigned char> src(rgb, rgb + size_t(width) * height * 3);
+    levels.emplace_back();
+    levels.back().assign(src.data(), width, height, options);
+    while (width > 1 || height > 1) {
+      std::vector<unsigned char> dst;
+      downsample_rgb8(src, width, height, dst);
+      src.swap(dst);
+      width = std::max(1, width / 2);
+      height = std::max(1, height / 2);
+      levels.emplace_back();
+      levels.back().assign(src.data(), width, height, options);
+    }
+  }
+
+  int level_count() const { return static_cast<int>(levels.size()); }
+  int width() const { return levels.empty() ? 0 : levels[0].grid_width(); }
+  int height() const { return levels.empty() ? 0 : levels[0].grid_height(); }
+
+  // 所有层占用的内存(字节)
+  size_t memory_bytes() const {
+    size_t bytes = 0;
+    for (const auto& l : levels) bytes += l.memory_bytes();
+    return bytes;
+  }
+
+  // 第 0 层上的最近邻采样, s,t 为 [0,1] 内的图像坐标(t 向下)
+  color nearest(double s, double t) const { return levels[0].nearest(s, t); }
+
+  // 第 level 层上的双线性插值, 边界外的像素取边界值
+  color bilinear(int level_index, double s, double t) const {
+    return levels[level_index].bilinear(s, t);
+  }
+
+  /**
+   * @brief 三线性滤波: 由覆盖范围(以第 0 层的像素为单位)的 log2 选择层级
+   *
+   * @param s 图像坐标
+   * @param t
+   * @param footprint 覆盖范围, <=1 时只在第 0 层双线性插值
+   */
+  color trilinear(double s, double t, double footprint) const {
+    return trilinear_filter(level_count(), footprint, [&](int level) {
+      return bilinear(level, s, t);
+    });
+  }
+
+ private:
+  std::vector<texel_grid> levels;
+};
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * @file parallel.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 简单的多线程并行工具
+ * @version 0.1
+ * @date 2023-09-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 解析线程数, thread_count<=0 时使用硬件支持的并发线程数
+inline int resolve_thread_count(int thread_count) {
+  if (thread_count > 0) return thread_count;
+  int n = static_cast<int>(std::thread::hardware_concurrency());
+  return n > 0 ? n : 1;
+}
+
+/**
+ * @brief 调度器的统计信息, 可以跨多次并行调用累加
+ *
+ */
+struct parallel_stats {
+  double wall_seconds = 0;           // 并行调用的总耗时
+  std::vector<double> busy_seconds;  // 每个线程执行任务的总耗时
+
+  // 第 t 个线程的空闲时间(等待其他线程结束)
+  double idle_seconds(int t) const { return wall_seconds - busy_seconds[t]; }
+};
+
+/**
+ * @brief 进程内共享的常驻线程池. run(thread_count, job) 让调用线程(0 号)与
+ * 线程池中的 1..thread_count-1 号线程各执行一次 job(thread_id), 全部结束后
+ * 返回. 工作线程按需创建并一直保留, 同一编号总是由同一个线程执行.
+ * 嵌套调用(在 job 中再次调用)或其他线程正在使用线程池时, 临时创建线程执行
+ *
+ */
+class thread_pool {
+ public:
+  static thread_pool& instance() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+
+  template <typename Job>
+  void run(int thread_count, const Job& job) {
+    if (thread_count <= 1) {
+      job(0);
+      return;
+    }
+    std::unique_lock<std::mutex> owner(run_mutex, std::try_to_lock);
+    if (inside_job() || !owner.owns_lock()) {
+      std::vector<std::thread> threads;
+      for (int t = 1; t < thread_count; t++) threads.emplace_back(job, t);
+      job(0);
+      for (auto& thread : threads) thread.join();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while (static_cast<int>(workers.size()) < thread_count - 1) {
+        int id = static_cast<int>(workers.size()) + 1;
+        workers.emplace_back([this, id] { worker_loop(id); });
+      }
+      current = [](const void* data, int thread_id) {
+        (*static_cast<const Job*>(data))(thread_id);
+      };
+      current_data = &job;
+      participants = thread_count;
+      remaining = thread_count - 1;
+      generation++;
+    }
+    wake.notify_all();
+    inside_job() = true;
+    job(0);
+    inside_job() = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return remaining == 0; });
+  }
+
+  // 已创建的工作线程数(不包括调用线程)
+  int worker_count() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<int>(workers.size());
+  }
+
+ private:
+  std::mutex run_mutex;  // 同一时刻只有一个调用者使用线程池
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::vector<std::thread> workers;
+  void (*current)(const void*, int) = nullptr;
+  const void* current_data = nullptr;
+  int participants = 0;  // 本次参与的线程数(包括调用线程)
+  int remaining = 0;     // 尚未完成的工作线程数
+  std::uint64_t generation = 0;
+  bool quit = false;
+
+  static bool& inside_job() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  void worker_loop(int id) {
+    inside_job() = true;
+    std::uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [&] { return quit || generation != seen; });
+      if (quit) return;
+      seen = generation;
+      if (id >= participants) continue;
+      auto fn = current;
+      auto data = current_data;
+      lock.unlock();
+      fn(data, id);
+      lock.lock();
+      if (--remaining == 0) done.notify_one();
+    }
+  }
+};
+
+/**
+ * @brief 使用线程池中的 thread_count 个线程(包含调用线程)动态领取任务,
+ * 依次执行 task(index, thread_id), index 从 0 开始递增,
+ * 直到某个线程的 task 返回 false 为止
+ *
+ * @param thread_count 线程数
+ * @param task bool task(int index, int thread_id)
+ * @param stats 不为空时累加每个线程的忙碌时间和总耗时
+ */
+template <typename Task>
+void parallel_until(int thread_count, const Task& task,
+                    parallel_stats* stats = nullptr) {
+  using clock = std::chrono::steady_clock;
+  std::atomic<int> next(0);
+  std::atomic<bool> stop(false);
+  std::vector<double> busy(thread_count, 0.0);
+  auto worker = [&](int thread_id) {
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto start = stats ? clock::now() : clock::time_point();
+      if (!task(next.fetch_add(1), thread_id)) stop = true;
+      if (stats) {
+        busy[thread_id] +=
+            std::chrono::duration<double>(clock::now() - start).count();
+      }
+    }
+  };
+
+  auto start = clock::now();
+  thread_pool::instance().run(thread_count, worker);
+
+  if (stats) {
+    stats->wall_seconds +=
+        std::chrono::duration<double>(clock::now() - start).count();
+    stats->busy_seconds.resize(thread_count, 0.0);
+    for (int t = 0; t < thread_count; t++) stats->busy_seconds[t] += busy[t];
+  }
+}
+
+/**
+ * @brief 使用 thread_count 个线程并行执行 task(index, thread_id),
+ * index 取 [0, count)
+ *
+ * @param count 任务数
+ * @param thread_count 线程数
+ * @param task void task(int index, int thread_id)
+ * @param stats 不为空时累加每个线程的忙碌时间和总耗时
+ */
+template <typename Task>
+void parallel_for(int count, int thread_count, const Task& task,
+                  parallel_stats* stats = nullptr) {
+  parallel_until(
+      thread_count,
+      [&](int index, int thread_id) {
+        if (index >= count) return false;
+        task(index, thread_id);
+        return true;
+      },
+      stats);
+}
+
+#endif
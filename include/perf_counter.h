@@ -0,0 +1,92 @@
+/**
+ * @file perf_counter.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 基于 Linux perf_event_open 的硬件计数器(缓存未命中数)
+ * @version 0.1
+ * @date 2023-09-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef PERF_COUNTER_H
+#define PERF_COUNTER_H
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+/**
+ * @brief 统计创建计数器的线程的缓存未命中数. 渲染线程是线程池中长期存在的
+ * 线程, 因此每个线程使用自己的计数器(this_thread()), 在被测的代码前后
+ * 读取计数并累加差值.
+ * 在不支持的平台上, 或内核/容器不允许访问性能计数器时 available() 为 false,
+ * 此时 start()/stop() 为空操作, value() 为 0
+ *
+ */
+class perf_counter {
+ public:
+  perf_counter() {
+#if defined(__linux__)
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+
+  ~perf_counter() {
+#if defined(__linux__)
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+  perf_counter(const perf_counter&) = delete;
+  perf_counter& operator=(const perf_counter&) = delete;
+
+  // 当前线程的计数器, 第一次调用时创建
+  static perf_counter& this_thread() {
+    thread_local perf_counter counter;
+    return counter;
+  }
+
+  bool available() const { return fd >= 0; }
+
+  void start() {
+#if defined(__linux__)
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  void stop() {
+#if defined(__linux__)
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+  }
+
+  // 到目前为止的计数
+  std::uint64_t value() const {
+    std::uint64_t count = 0;
+#if defined(__linux__)
+    if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+    return count;
+  }
+
+ private:
+  int fd = -1;
+};
+
+#endif
@@ -11,30 +11,76 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+
 #include "rtweekend.h"
+#include "simd_dispatch.h"
+
 /**
- * @brief perlin noise 类
+ * @brief perlin noise 的梯度表与置换表, 放在一块按缓存行对齐的连续内存中.
+ * 表只由种子决定, 使用自己的随机数生成器, 不改变全局随机数的状态,
+ * 因此场景中其他物体的随机参数与噪声纹理的创建顺序无关
  *
  */
-class perlin {
- public:
-  perlin() {
-    ranvec = new vec3[point_count];
+struct alignas(64) perlin_tables {
+  static constexpr int point_count = 256;
+  real gradient[3][point_count];  // 梯度向量的 x,y,z 分量
+  int perm[3][point_count];       // x,y,z 三个方向的置换表
+
+  explicit perlin_tables(std::uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    auto uniform = [&](double min, double max) {
+      return min + (max - min) * distribution(generator);
+    };
     for (int i = 0; i < point_count; ++i) {
-      ranvec[i] = unit_vector(vec3::random(-1, 1));
+      auto g = unit_vector(
+          vec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)));
+      gradient[0][i] = g.x();
+      gradient[1][i] = g.y();
+      gradient[2][i] = g.z();
+    }
+    for (int a = 0; a < 3; a++) {
+      for (int i = 0; i < point_count; i++) perm[a][i] = i;
+      for (int i = point_count - 1; i > 0; i--) {
+        int target = static_cast<int>(uniform(0, i + 1));
+        std::swap(perm[a][i], perm[a][target]);
+      }
     }
-
-    perm_x = perlin_generate_perm();
-    perm_y = perlin_generate_perm();
-    perm_z = perlin_generate_perm();
   }
 
-  ~perlin() {
-    delete[] ranvec;
-    delete[] perm_x;
-    delete[] perm_y;
-    delete[] perm_z;
+  /**
+   * @brief 种子为 seed 的表, 每个种子只构建一次, 之后的调用返回同一份只读的表
+   *
+   * @param seed 种子
+   * @return shared_ptr<const perlin_tables>
+   */
+  static shared_ptr<const perlin_tables> shared(std::uint32_t seed) {
+    static std::mutex mutex;
+    static std::map<std::uint32_t, shared_ptr<const perlin_tables>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = tables[seed];
+    if (!entry) entry = make_shared<perlin_tables>(seed);
+    return entry;
   }
+};
+
+/**
+ * @brief perlin noise 类. 同一个种子的 perlin 对象共享同一份 perlin_tables
+ *
+ */
+class perlin {
+ public:
+  static constexpr std::uint32_t default_seed = 2023;
+
+  explicit perlin(std::uint32_t _seed = default_seed)
+      : tables(perlin_tables::shared(_seed)), seed_value(_seed) {}
+
+  std::uint32_t seed() const { return seed_value; }
 
   // 改函数给出一个随机的 perlin noise 随机数, 在(0,1)范围内
   double noise(const point3& p) const {
@@ -50,91 +96,51 @@ class perlin {
     auto i = static_cast<int>(floor(p.x()));
     auto j = static_cast<int>(floor(p.y()));
     auto k = static_cast<int>(floor(p.z()));
-    vec3 c[2][2][2];
+    // 8 个角点的梯度向量按 SoA 存放, 下标为 di*4+dj*2+dk
+    real gx[8], gy[8], gz[8];
 
-    // 点p跟前后左右上下共6个点进行插值
+    // 点p跟周围 8 个角点进行插值
     for (int di = 0; di < 2; di++)
       for (int dj = 0; dj < 2; dj++)
-        for (int dk = 0; dk < 2; dk++)
-          c[di][dj][dk] =
-              ranvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^
-                     perm_z[(k + dk) & 255]];
+        for (int dk = 0; dk < 2; dk++) {
+          int g = tables->perm[0][(i + di) & 255] ^
+                  tables->perm[1][(j + dj) & 255] ^
+                  tables->perm[2][(k + dk) & 255];
+          int l = di * 4 + dj * 2 + dk;
+          gx[l] = tables->gradient[0][g];
+          gy[l] = tables->gradient[1][g];
+          gz[l] = tables->gradient[2][g];
+        }
 
-    return perlin_interp(c, u, v, w);
+    return simd().perlin_blend(gx, gy, gz, u, v, w);
   }
   /**
-   * @brief turbulence, 使用多个 perlin noise 产生紊流的效果
+   * @brief turbulence, 使用多个 perlin noise 产生紊流的效果.
+   * 各个八度由 simd().perlin_turb 并行计算, 结果与逐个八度调用 noise() 相同
    *
    * @param p
    * @param depth
    * @return double
    */
   double turb(const point3& p, int depth = 7) const {
-    auto accum = 0.0;
-    auto temp_p = p;
-    auto weight = 1.0;
-
-    for (int i = 0; i < depth; i++) {
-      accum += weight * noise(temp_p);
-      weight *= 0.5;
-      temp_p *= 2;
-    }
-
-    return fabs(accum);
-  }
-
- private:
-  static const int point_count = 256;
-  vec3* ranvec;
-  int* perm_x;
-  int* perm_y;
-  int* perm_z;
-
-  static int* perlin_generate_perm() {
-    auto p = new int[point_count];
-
-    for (int i = 0; i < perlin::point_count; i++) p[i] = i;
-
-    permute(p, point_count);
-
-    return p;
+    return periodic_turb(p, depth, perlin_tables::point_count);
   }
 
-  static void permute(int* p, int n) {
-    for (int i = n - 1; i > 0; i--) {
-      int target = random_int(0, i);
-      int tmp = p[i];
-      p[i] = p[target];
-      p[target] = tmp;
-    }
-  }
-  
   /**
-   * @brief 插值函数, 用于平滑
-   * 
-   * @param c 
-   * @param u 
-   * @param v 
-   * @param w 
-   * @return double 
+   * @brief 周期为 period(2 的幂, 不超过 256)的 turbulence: 第 0 个八度的格点
+   * 坐标按 period 取模, 因此结果在每个坐标轴上以 period 为周期.
+   * period 为 256 时与 turb() 相同
+   *
    */
-  static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-    auto uu = u * u * (3 - 2 * u);
-    auto vv = v * v * (3 - 2 * v);
-    auto ww = w * w * (3 - 2 * w);
-    auto accum = 0.0;
-
-    for (int i = 0; i < 2; i++)
-      for (int j = 0; j < 2; j++)
-        for (int k = 0; k < 2; k++) {
-          vec3 weight_v(u - i, v - j, w - k);
-          accum += (i * uu + (1 - i) * (1 - uu)) *
-                   (j * vv + (1 - j) * (1 - vv)) *
-                   (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
-        }
-
-    return accum;
+  double periodic_turb(const point3& p, int depth, int period) const {
+    real xyz[3] = {p.x(), p.y(), p.z()};
+    return simd().perlin_turb(&tables->perm[0][0], &tables->gradient[0][0],
+                              xyz, depth, period);
   }
+
+ private:
+  shared_ptr<const perlin_tables> tables;  // 只读的梯度表与置换表
+  std::uint32_t seed_value;                // 表的种子
 };
 
 #endif
\ No newline at end of file
@@ -13,6 +13,7 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "render_stats.h"
 #include "rtweekend.h"
 
 /**
@@ -29,6 +30,8 @@ class quad : public hittable {
     // 计算光线与平行四边形相交时的辅助量
     D = dot(normal, Q);
     w = n / dot(n, n);
+    u_length = u.length();
+    v_length = v.length();
     set_bounding_box();
   }
 
@@ -36,7 +39,17 @@ class quad : public hittable {
 
   aabb bounding_box() const override { return bbox; }
 
+  batch_data get_batch_data() const override {
+    batch_data data;
+    data.kind = batch_data::quad;
+    data.Q = Q;
+    data.u = u;
+    data.v = v;
+    return data;
+  }
+
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RTW_STAT_INC(quad_tests);
     // 尝试使用 Moller-Trumbore 方法求交点
     vec3 e1 = u;
     vec3 e2 = v;
@@ -62,6 +75,7 @@ class quad : public hittable {
       rec.p = intersection;
       rec.mat = mat;
       rec.set_face_normal(r, normal);
+      rec.set_footprint(r, u_length, v_length);
       return true;  // To be implemented
     }
     return false;
@@ -73,12 +87,13 @@ class quad : public hittable {
   shared_ptr<material> mat;  // 平行四边形的纹理
   aabb bbox;                 // 平行四边形的包围盒
   vec3 normal;               // 平行四边形的法向, 等于 cross(u,v)
-  double D;  // 计算光线与平行四边形相交时的辅助变量
+  real D;  // 计算光线与平行四边形相交时的辅助变量
   vec3 w;  // 计算光线与平行四边形相交点是否在四边形内部的辅助变量
+  real u_length, v_length;  // 两条边的长度, 用于计算纹理坐标范围
 
   // 判断局部参数 a,b 是否合法(是否在[0,1]内)
   // 假如在, 则将参数a,b 赋值给 rec
-  virtual bool is_interior(double a, double b, hit_record& rec) const {
+  virtual bool is_interior(real a, real b, hit_record& rec) const {
     // Given the hit point in plane coordinates, return false if it is outside
     // the primitive, otherwise set the hit record UV coordinates and return
     // true.
@@ -91,7 +106,8 @@ class quad : public hittable {
   }
 };
 
-// 根据两个点构造一个六面体
+// 根据两个点构造一个由六个四边形组成的六面体.
+// 场景中使用一次 slab 测试求交的 axis_aligned_box(box.h)
 inline shared_ptr<hittable_list> box(const point3& a, const point3& b,
                                      shared_ptr<material> mat) {
   // Returns the 3D box (six sides) that contains the two opposite vertices a
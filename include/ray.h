@@ -12,32 +12,106 @@
 #define RAY_H
 
 #include "vec3.h"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 /**
- * @brief 光线类
+ * @brief 光线类, 标量类型 T 为 float 或 double
  *
  */
-class ray {
+template <typename T>
+class basic_ray {
  public:
-  ray() {}
+  using vec_type = basic_vec3<T>;
+
+  basic_ray() {}
 
-  ray(const point3& origin, const vec3& direction)
+  basic_ray(const vec_type& origin, const vec_type& direction)
       : orig(origin), dir(direction) {}
-  ray(const point3& origin, const vec3& direction, double time = 0.0)
+  basic_ray(const vec_type& origin, const vec_type& direction,
+            double time = 0.0)
       : orig(origin), dir(direction), tm(time) {}
 
   // 取 ray 的原点
-  point3 origin() const { return orig; }
+  vec_type origin() const { return orig; }
   // 取 ray 的方向
-  vec3 direction() const { return dir; }
+  vec_type direction() const { return dir; }
   // 取 ray 在t位置处的坐标
-  point3 at(double t) const { return orig + t * dir; }
+  vec_type at(T t) const { return orig + t * dir; }
   // 取 ray 发出的时刻
-  double time() const { return tm; }
+  T time() const { return tm; }
+
+  /**
+   * @brief 设置光线的锥形微分(ray cone): 光线在 t 处覆盖的宽度为
+   * width + spread * t * |dir|, 用于选择纹理的 mip 层级
+   *
+   * @param width 起点处的宽度
+   * @param spread 每单位距离增加的宽度(张角)
+   */
+  void set_cone(T width, T spread) {
+    cone_w = width;
+    cone_s = spread;
+  }
+  T cone_width() const { return cone_w; }
+  T cone_spread() const { return cone_s; }
+  bool has_cone() const { return cone_w > 0 || cone_s > 0; }
+  // 光线在 t 处覆盖的宽度
+  T footprint(T t) const {
+    return has_cone() ? cone_w + cone_s * t * dir.length() : T(0);
+  }
 
  private:
-  point3 orig;  // 光线起点
-  vec3 dir;     // 光线方向
-  double tm;    // 光线的时刻
+  vec_type orig;  // 光线起点
+  vec_type dir;   // 光线方向
+  T tm;           // 光线的时刻
+  T cone_w = 0;   // 锥形微分: 起点处的宽度
+  T cone_s = 0;   // 锥形微分: 张角
 };
 
+// 渲染器使用的光线类型, 精度由 real 决定(见 rtweekend.h)
+using ray = basic_ray<real>;
+
+/**
+ * @brief 计算新光线的起点, 避免光线与刚离开的表面再次相交(自相交, acne).
+ * 双精度下 camera 的 0.001 下限已经足够, 直接返回 p, 结果与之前完全一致;
+ * 单精度下按 Wächter & Binder (Ray Tracing Gems, 第 6 章) 的方法,
+ * 把 p 沿法向(朝 dir 所在一侧)移动与 |p| 成比例的若干个 ulp
+ *
+ * @param p 交点
+ * @param n 交点处的法向
+ * @param dir 新光线的方向
+ * @return basic_vec3<T>
+ */
+template <typename T>
+inline basic_vec3<T> offset_ray_origin(const basic_vec3<T>& p,
+                                       const basic_vec3<T>& n,
+                                       const basic_vec3<T>& dir) {
+  if constexpr (std::is_same<T, double>::value) {
+    return p;
+  } else {
+    const float origin = 1.0f / 32.0f;
+    const float float_scale = 1.0f / 65536.0f;
+    const float int_scale = 256.0f;
+
+    auto side = dot(n, dir) < 0 ? -n : n;
+    basic_vec3<T> result;
+    for (int a = 0; a < 3; a++) {
+      if (fabs(p[a]) < origin) {
+        // 靠近原点时 ulp 太小, 改用固定的偏移量
+        result[a] = p[a] + float_scale * side[a];
+        continue;
+      }
+      auto of_i = static_cast<std::int32_t>(int_scale * side[a]);
+      std::int32_t bits;
+      float value = p[a];
+      std::memcpy(&bits, &value, sizeof(bits));
+      bits += (value < 0) ? -of_i : of_i;
+      std::memcpy(&value, &bits, sizeof(bits));
+      result[a] = value;
+    }
+    return result;
+  }
+}
+
 #endif
\ No newline at end of file
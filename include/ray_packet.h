@@ -0,0 +1,147 @@
+/**
+ * @file ray_packet.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 光线包: 同时求交的一组(最多 16 条)相干光线
+ * @version 0.1
+ * @date 2023-09-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "ray.h"
+#include "rtweekend.h"
+
+/**
+ * @brief 光线包, 求交时用一个 32 位掩码表示哪些光线仍然参与求交.
+ * 除了每条光线各自的数据外, 还记录了整个光线包的视锥(各轴上起点与方向倒数的
+ * 范围), 用于对包围盒做一次保守的整体测试
+ *
+ */
+struct ray_packet {
+  static constexpr int max_size = 16;
+
+  int size = 0;
+  ray rays[max_size];
+  real tmin[max_size];
+  real tmax[max_size];  // 求交过程中更新为当前最近交点的距离
+  real orig[3][max_size];
+  real inv_dir[3][max_size];
+
+  // 视锥: 所有光线在每个轴上的方向符号一致且方向倒数有限时才有效
+  bool coherent = false;
+  real orig_lo[3], orig_hi[3];
+  real inv_lo[3], inv_hi[3];
+  real tmin_lo;
+
+  // 设置好 size, rays, tmin, tmax 之后调用, 计算 SoA 数据与视锥
+  void prepare() {
+    coherent = size > 1;
+    tmin_lo = tmin[0];
+    for (int l = 0; l < size; l++) {
+      tmin_lo = std::fmin(tmin_lo, tmin[l]);
+      for (int a = 0; a < 3; a++) {
+        orig[a][l] = rays[l].origin()[a];
+        inv_dir[a][l] = 1 / rays[l].direction()[a];
+      }
+    }
+    for (int a = 0; a < 3 && coherent; a++) {
+      orig_lo[a] = orig_hi[a] = orig[a][0];
+      inv_lo[a] = inv_hi[a] = inv_dir[a][0];
+      for (int l = 0; l < size; l++) {
+        if (!std::isfinite(inv_dir[a][l]) ||
+            (inv_dir[a][l] < 0) != (inv_dir[a][0] < 0)) {
+          coherent = false;
+          break;
+        }
+        orig_lo[a] = std::fmin(orig_lo[a], orig[a][l]);
+        orig_hi[a] = std::fmax(orig_hi[a], orig[a][l]);
+        inv_lo[a] = std::fmin(inv_lo[a], inv_dir[a][l]);
+        inv_hi[a] = std::fmax(inv_hi[a], inv_dir[a][l]);
+      }
+    }
+  }
+
+  /**
+   * @brief 视锥是否可能与包围盒相交. 返回 false 时包中没有任何光线在
+   * [tmin, tmax_hi] 内与包围盒相交; 视锥无效时总是返回 true.
+   * 舍入是单调的, 所以对区间端点求出的界对每条光线都成立
+   *
+   * @param box_min 包围盒的下界 [x,y,z]
+   * @param box_max 包围盒的上界 [x,y,z]
+   * @param tmax_hi 参与求交的光线中最大的 tmax
+   */
+  bool frustum_may_hit(const real* box_min, const real* box_max,
+                       real tmax_hi) const {
+    if (!coherent) return true;
+    real near_lo = tmin_lo, far_hi = tmax_hi;
+    for (int a = 0; a < 3; a++) {
+      bool neg = inv_lo[a] < 0;
+      real b_near = neg ? box_max[a] : box_min[a];
+      real b_far = neg ? box_min[a] : box_max[a];
+      // 近交点的下界与远交点的上界, 在区间的四个角上取得
+      real n0 = (b_near - orig_hi[a]) * inv_lo[a];
+      real n1 = (b_near - orig_hi[a]) * inv_hi[a];
+      real n2 = (b_near - orig_lo[a]) * inv_lo[a];
+      real n3 = (b_near - orig_lo[a]) * inv_hi[a];
+      real f0 = (b_far - orig_hi[a]) * inv_lo[a];
+      real f1 = (b_far - orig_hi[a]) * inv_hi[a];
+      real f2 = (b_far - orig_lo[a]) * inv_lo[a];
+      real f3 = (b_far - orig_lo[a]) * inv_hi[a];
+      near_lo = std::fmax(near_lo,
+                          std::fmin(std::fmin(n0, n1), std::fmin(n2, n3)));
+      far_hi =
+          std::fmin(far_hi, std::fmax(std::fmax(f0, f1), std::fmax(f2, f3)));
+    }
+    // 有 NaN 时比较结果为 false, 保守地认为可能相交
+    return !(near_lo >= far_hi);
+  }
+
+  // 第 l 条光线与包围盒在 [tmin, tmax] 内是否相交, 与 aabb::hit 的结果相同
+  bool lane_hit(int l, const real* box_min, const real* box_max) const {
+    real t_near = tmin[l], t_far = tmax[l];
+    for (int a = 0; a < 3; a++) {
+      auto invD = inv_dir[a][l];
+      auto t0 = (box_min[a] - orig[a][l]) * invD;
+      auto t1 = (box_max[a] - orig[a][l]) * invD;
+      if (invD < 0) std::swap(t0, t1);
+      if (t0 > t_near) t_near = t0;
+      if (t1 < t_far) t_far = t1;
+      if (t_far <= t_near) return false;
+    }
+    return true;
+  }
+};
+
+// 非零掩码中最低位 1 的下标
+inline int lowest_lane(std::uint32_t mask) {
+#ifdef __GNUC__
+  return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  int index = 0;
+  for (; (mask & 1) == 0; mask >>= 1) index++;
+  return index;
+#endif
+}
+
+// 遍历掩码中的每一位: for_each_lane(mask, [&](int l) {...})
+template <typename F>
+inline void for_each_lane(std::uint32_t mask, F&& f) {
+  for (; mask; mask &= mask - 1) f(lowest_lane(mask));
+}
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * @file render_stats.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 渲染性能计数器
+ * @version 0.1
+ * @date 2023-09-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <cstdint>
+#include <iostream>
+
+/**
+ * @brief 一次渲染的工作量统计.
+ * 每个线程累加自己的 thread_local 计数器, 渲染结束时合并.
+ * 只有定义了 RTW_ENABLE_STATS 时才会计数, 否则计数宏为空操作
+ *
+ */
+struct render_stats {
+  static const int max_path_length = 64;  // 路径长度直方图的桶数
+
+  std::uint64_t camera_rays = 0;        // 相机发出的光线数
+  std::uint64_t secondary_rays = 0;     // 反射/折射/散射产生的光线数
+  std::uint64_t bvh_nodes_visited = 0;  // 访问的 BVH 节点数
+  std::uint64_t aabb_tests = 0;         // 光线与包围盒的相交测试数
+  std::uint64_t sphere_tests = 0;       // 光线与球的相交测试数
+  std::uint64_t quad_tests = 0;         // 光线与四边形的相交测试数
+  std::uint64_t box_tests = 0;          // 光线与长方体的相交测试数
+  std::uint64_t triangle_tests = 0;     // 光线与网格三角形的相交测试数
+  std::uint64_t instance_tests = 0;     // 光线变换到实例坐标系的次数
+  std::uint64_t medium_tests = 0;       // 光线与 constant_medium 的相交测试数
+  std::uint64_t scatter_calls = 0;      // material::scatter 的调用数
+  std::uint64_t frustum_tests = 0;      // 光线包视锥与包围盒的相交测试数
+  std::uint64_t frustum_culls = 0;      // 被视锥测试整体剔除的包围盒数
+  // 路径长度(光线段数)直方图, 最后一个桶包含所有更长的路径
+  std::uint64_t path_length[max_path_length] = {};
+
+  void merge(const render_stats& other) {
+    camera_rays += other.camera_rays;
+    secondary_rays += other.secondary_rays;
+    bvh_nodes_visited += other.bvh_nodes_visited;
+    aabb_tests += other.aabb_tests;
+    sphere_tests += other.sphere_tests;
+    quad_tests += other.quad_tests;
+    box_tests += other.box_tests;
+    triangle_tests += other.triangle_tests;
+    instance_tests += other.instance_tests;
+    medium_tests += other.medium_tests;
+    scatter_calls += other.scatter_calls;
+    frustum_tests += other.frustum_tests;
+    frustum_culls += other.frustum_culls;
+    for (int i = 0; i < max_path_length; i++)
+      path_length[i] += other.path_length[i];
+  }
+
+  // 以可读的形式输出统计结果
+  void print(std::ostream& out) const {
+    out << "Render stats:\n"
+        << "  camera rays:        " << camera_rays << '\n'
+        << "  secondary rays:     " << secondary_rays << '\n'
+        << "  bvh nodes visited:  " << bvh_nodes_visited << '\n'
+        << "  aabb tests:         " << aabb_tests << '\n'
+        << "  sphere tests:       " << sphere_tests << '\n'
+        << "  quad tests:         " << quad_tests << '\n'
+        << "  box tests:          " << box_tests << '\n'
+        << "  triangle tests:     " << triangle_tests << '\n'
+        << "  instance tests:     " << instance_tests << '\n'
+        << "  medium tests:       " << medium_tests << '\n'
+        << "  scatter calls:      " << scatter_calls << '\n'
+        << "  frustum tests:      " << frustum_tests << '\n'
+        << "  frustum culls:      " << frustum_culls << '\n'
+        << "  path length histogram:\n";
+    for (int i = 0; i < max_path_length; i++) {
+      if (path_length[i] == 0) continue;
+      out << "    " << i << (i == max_path_length - 1 ? "+" : "") << ": "
+          << path_length[i] << '\n';
+    }
+  }
+
+  // 以 JSON 的形式输出统计结果
+  void write_json(std::ostream& out) const {
+    out << "{\n"
+        << "  \"camera_rays\": " << camera_rays << ",\n"
+        << "  \"secondary_rays\": " << secondary_rays << ",\n"
+        << "  \"bvh_nodes_visited\": " << bvh_nodes_visited << ",\n"
+        << "  \"aabb_tests\": " << aabb_tests << ",\n"
+        << "  \"sphere_tests\": " << sphere_tests << ",\n"
+        << "  \"quad_tests\": " << quad_tests << ",\n"
+        << "  \"box_tests\": " << box_tests << ",\n"
+        << "  \"triangle_tests\": " << triangle_tests << ",\n"
+        << "  \"instance_tests\": " << instance_tests << ",\n"
+        << "  \"medium_tests\": " << medium_tests << ",\n"
+        << "  \"scatter_calls\": " << scatter_calls << ",\n"
+        << "  \"frustum_tests\": " << frustum_tests << ",\n"
+        << "  \"frustum_culls\": " << frustum_culls << ",\n"
+        << "  \"path_length\": [";
+    for (int i = 0; i < max_path_length; i++) {
+      out << (i ? ", " : "") << path_length[i];
+    }
+    out << "]\n}\n";
+  }
+};
+
+#ifdef RTW_ENABLE_STATS
+// 当前线程的计数器
+inline render_stats& thread_render_stats() {
+  thread_local render_stats stats;
+  return stats;
+}
+
+#define RTW_STAT_INC(counter) (++thread_render_stats().counter)
+#define RTW_STAT_ADD(counter, n) (thread_render_stats().counter += (n))
+#define RTW_STAT_PATH_LENGTH(n)                                          \
+  (++thread_render_stats().path_length[(n) < render_stats::max_path_length \
+                                           ? (n)                          \
+                                           : render_stats::max_path_length - 1])
+#else
+#define RTW_STAT_INC(counter) ((void)0)
+#define RTW_STAT_ADD(counter, n) ((void)0)
+#define RTW_STAT_PATH_LENGTH(n) ((void)0)
+#endif
+
+#endif
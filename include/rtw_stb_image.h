@@ -20,46 +20,73 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "external/stb_image.h"
+#include "trace.h"
+
+/**
+ * @brief 查找图片文件的目录列表, 只在第一次调用时构建. 依次为: 环境变量
+ * RTW_IMAGES 指定的目录, 当前目录, images/ 子目录, 以及向上最多六层父目录
+ * 中的 images/ 子目录, 最后是构建时指定的图片目录
+ *
+ */
+inline const std::vector<std::string>& image_search_dirs() {
+  static const std::vector<std::string> dirs = [] {
+    std::vector<std::string> d;
+    auto imagedir = getenv("RTW_IMAGES");
+    if (imagedir) d.push_back(std::string(imagedir) + "/");
+    d.push_back("");
+    std::string prefix = "images/";
+    for (int level = 0; level <= 6; level++) {
+      d.push_back(prefix);
+      prefix = "../" + prefix;
+    }
+#ifdef RTW_DEFAULT_IMAGES
+    // 最后尝试构建时指定的图片目录(源码目录中的 images/)
+    d.push_back(std::string(RTW_DEFAULT_IMAGES) + "/");
+#endif
+    return d;
+  }();
+  return dirs;
+}
+
+// 在 image_search_dirs() 中查找图片文件, 返回第一个存在的路径, 找不到时返回空串
+inline std::string find_image_file(const std::string& filename) {
+  for (const auto& dir : image_search_dirs()) {
+    std::ifstream file(dir + filename, std::ios::binary);
+    if (file.good()) return dir + filename;
+  }
+  return "";
+}
 
 class rtw_image {
  public:
   rtw_image() : data(nullptr) {}
 
-  rtw_image(const char* image_filename) {
-    // Loads image data from the specified file. If the RTW_IMAGES environment
-    // variable is defined, looks only in that directory for the image file. If
-    // the image was not found, searches for the specified image file first from
-    // the current directory, then in the images/ subdirectory, then the
-    // _parent's_ images/ subdirectory, and then _that_ parent, on so on, for
-    // six levels up. If the image was not loaded successfully, width() and
-    // height() will return 0.
-
-    auto filename = std::string(image_filename);
-    auto imagedir = getenv("RTW_IMAGES");
-
-    // Hunt for the image file in some likely locations.
-    if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-    if (load(filename)) return;
-    if (load("images/" + filename)) return;
-    if (load("../images/" + filename)) return;
-    if (load("../../images/" + filename)) return;
-    if (load("../../../images/" + filename)) return;
-    if (load("../../../../images/" + filename)) return;
-    if (load("../../../../../images/" + filename)) return;
-    if (load("../../../../../../images/" + filename)) return;
+  rtw_image(const char* image_filename) : data(nullptr) {
+    // Loads image data from the specified file, searching the directories
+    // listed by image_search_dirs(). If the image was not loaded successfully,
+    // width() and height() will return 0.
+    auto path = find_image_file(image_filename);
+    if (!path.empty() && load(path)) return;
 
     std::cerr << "ERROR: Could not load image file '" << image_filename
               << "'.\n";
   }
 
+  rtw_image(const rtw_image&) = delete;
+  rtw_image& operator=(const rtw_image&) = delete;
+
   ~rtw_image() { STBI_FREE(data); }
 
   bool load(const std::string filename) {
     // Loads image data from the given file name. Returns true if the load
     // succeeded.
+    trace_scope scope("rtw_image::load", "texture");
     auto n =
         bytes_per_pixel;  // Dummy out parameter: original components per pixel
     data = stbi_load(filename.c_str(), &image_width, &image_height, &n,
@@ -69,6 +96,10 @@ class rtw_image {
   }
 
   int width() const { return (data == nullptr) ? 0 : image_width; }
+  // 解码后的像素占用的内存(字节)
+  size_t memory_bytes() const {
+    return (data == nullptr) ? 0 : size_t(bytes_per_scanline) * image_height;
+  }
   int height() const { return (data == nullptr) ? 0 : image_height; }
 
   const unsigned char* pixel_data(int x, int y) const {
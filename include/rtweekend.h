@@ -22,6 +22,14 @@ using std::make_shared;
 using std::shared_ptr;
 using std::sqrt;
 
+// 几何计算(向量, 光线, 包围盒, 图元)使用的标量类型.
+// 定义 RTW_USE_FLOAT 时使用单精度, 向量和包围盒的内存占用减半
+#ifdef RTW_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 // 常数
 const double infinity = std::numeric_limits<double>::infinity();
@@ -33,10 +41,18 @@ inline double degrees_to_radians(double degrees) {
   return degrees * pi / 180.0;
 }
 
+// 每个线程独立的随机数生成器, 多线程渲染时互不干扰
+inline std::mt19937& random_generator() {
+  thread_local std::mt19937 generator;
+  return generator;
+}
+
+// 重新设置当前线程随机数生成器的种子
+inline void seed_random(unsigned int seed) { random_generator().seed(seed); }
+
 inline double random_double() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+  thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  return distribution(random_generator());
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,1033 @@
+/**
+ * @file scene_bench.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 场景级的可复现基准测试: 吞吐量, 内存以及与参考图像的误差
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef SCENE_BENCH_H
+#define SCENE_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "quad.h"
+#include "rtweekend.h"
+#include "simd_dispatch.h"
+#include "sphere.h"
+#include "texture.h"
+
+/**
+ * @brief 8 位 RGB 图像, 用于和参考图像比较
+ *
+ */
+struct ppm_image {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> rgb;  // 按行存储的 RGB 数据
+
+  /**
+   * @brief 读取 P3(文本) 或 P6(二进制) 格式的 PPM 图像, 失败返回 false
+   *
+   * @param in 输入流
+   * @return true
+   * @return false
+   */
+  bool read(std::istream& in) {
+    std::string magic;
+    int maxval;
+    in >> magic >> width >> height >> maxval;
+    if (!in || (magic != "P3" && magic != "P6") || maxval != 255) return false;
+    rgb.resize(static_cast<size_t>(width) * height * 3);
+    if (magic == "P6") {
+      in.get();  // 头部之后的单个空白字符
+      in.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+    } else {
+      for (auto& c : rgb) {
+        int value;
+        in >> value;
+        c = static_cast<unsigned char>(value);
+      }
+    }
+    return static_cast<bool>(in);
+  }
+
+  // 以 P6 格式写出, 参考图像使用二进制格式以减小体积
+  void write_p6(std::ostream& out) const {
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+  }
+};
+
+// 两幅图像的均方根误差(0-255 范围), 尺寸不同时返回 -1
+inline double image_rmse(const ppm_image& a, const ppm_image& b) {
+  if (a.width != b.width || a.height != b.height) return -1;
+  double sum = 0;
+  for (size_t k = 0; k < a.rgb.size(); k++) {
+    double d = double(a.rgb[k]) - double(b.rgb[k]);
+    sum += d * d;
+  }
+  return std::sqrt(sum / a.rgb.size());
+}
+
+// 由 RMSE 计算峰值信噪比(dB), 图像完全相同时为 infinity
+inline double image_psnr(double rmse) {
+  if (rmse <= 0) return infinity;
+  return 20 * std::log10(255.0 / rmse);
+}
+
+// 进程启动以来的峰值常驻内存(KB), 不支持的平台返回 0. ru_maxrss 是整个进程
+// 的累计最大值, 只增不减: 某个场景的值包含之前所有场景的峰值, 不能单独归属于它
+inline long process_peak_rss_kb() {
+#if defined(__APPLE__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;  // macOS 上单位为字节
+#elif defined(__unix__)
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief 在之前输出的 JSON 结果中查找某个场景的某个数值字段,
+ * 只支持 run_scene_bench 自身输出的格式, 找不到时返回 -1
+ *
+ * @param json JSON 文本
+ * @param scene_id 场景参数id
+ * @param key 字段名
+ * @return double
+ */
+inline double find_scene_value(const std::string& json, int scene_id,
+                               const std::string& key) {
+  auto pos = json.find("\"scene\": " + std::to_string(scene_id) + ",");
+  if (pos == std::string::npos) return -1;
+  auto end = json.find('}', pos);
+  auto k = json.find("\"" + key + "\": ", pos);
+  if (k == std::string::npos || k > end) return -1;
+  return std::atof(json.c_str() + k + key.size() + 4);
+}
+
+/**
+ * @brief 场景基准测试的参数
+ *
+ */
+struct scene_bench_options {
+  int image_width = 96;         // 固定的图像宽度
+  int samples_per_pixel = 16;   // 固定的每像素采样数
+  unsigned int seed = 2023;     // 构建场景前使用的随机数种子
+  int thread_count = 0;         // 渲染线程数
+  std::string reference_dir;    // 参考图像目录
+  bool update_references = false;  // 用本次结果覆盖参考图像
+  std::string baseline_path;    // 之前的 JSON 结果, 用于比较耗时
+  double time_tolerance = 0.2;  // 渲染耗时允许比基线慢的比例
+  double min_psnr = 40;         // 与参考图像的 PSNR 低于该值视为画质回退
+  std::string json_path;        // JSON 结果的输出路径, 为空时写到 std::cout
+};
+
+/**
+ * @brief 以固定的种子, 分辨率和采样数依次渲染 [0, scene_count) 场景,
+ * 记录构建时间, 渲染时间, Mrays/s 和峰值内存, 并与参考图像比较 RMSE/PSNR.
+ * 耗时或画质超出容差的场景会被标记. 图像完全相同时 JSON 中的 psnr 记为 999
+ *
+ * @param opt 参数
+ * @param scene_count 场景数
+ * @param build_scene 场景构造函数, bool build_scene(int, hittable_list&,
+ * camera&)
+ * @return int 被标记为回退的场景数
+ */
+template <typename BuildScene>
+int run_scene_bench(const scene_bench_options& opt, int scene_count,
+                    const BuildScene& build_scene) {
+  using clock = std::chrono::steady_clock;
+  std::string baseline;
+  if (!opt.baseline_path.empty()) {
+    std::ifstream in(opt.baseline_path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    baseline = ss.str();
+    if (baseline.empty()) {
+      std::clog << "WARNING: Could not read baseline '" << opt.baseline_path
+                << "'.\n";
+    }
+  }
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(3);
+  json << "{\n  \"config\": {\"width\": " << opt.image_width
+       << ", \"spp\": " << opt.samples_per_pixel << ", \"seed\": " << opt.seed
+       << ", \"threads\": " << resolve_thread_count(opt.thread_count)
+       << ", \"simd\": \"" << simd_level_name(simd().level)
+       << "\"},\n  \"scenes\": [\n";
+
+  int regressions = 0;
+  for (int id = 0; id < scene_count; id++) {
+    seed_random(opt.seed);
+    hittable_list world;
+    camera cam;
+    auto build_start = clock::now();
+    build_scene(id, world, cam);
+    double build_ms =
+        std::chrono::duration<double, std::milli>(clock::now() - build_start)
+            .count();
+
+    cam.image_width = opt.image_width;
+    cam.samples_per_pixel = opt.samples_per_pixel;
+    cam.thread_count = opt.thread_count;
+    cam.show_progress = false;
+
+    std::stringstream image_stream;
+    auto render_start = clock::now();
+    cam.render(world, image_stream);
+    double render_ms =
+        std::chrono::duration<double, std::milli>(clock::now() - render_start)
+            .count();
+    double mrays = cam.rays_traced() / (render_ms * 1e3);
+
+    ppm_image image;
+    image.read(image_stream);
+
+    // 与参考图像比较
+    std::string ref_path =
+        opt.reference_dir + "/scene" + std::to_string(id) + ".ppm";
+    double rmse = -1;
+    if (opt.update_references) {
+      std::ofstream out(ref_path, std::ios::binary);
+      image.write_p6(out);
+      rmse = 0;
+    } else {
+      std::ifstream in(ref_path, std::ios::binary);
+      ppm_image reference;
+      if (in && reference.read(in)) rmse = image_rmse(image, reference);
+    }
+    // 没有参考图像时不做画质检查, psnr 记为 -1
+    double psnr = rmse < 0 ? -1 : image_psnr(rmse);
+    bool quality_regression = rmse >= 0 && psnr < opt.min_psnr;
+
+    double baseline_ms = baseline.empty()
+                             ? -1
+                             : find_scene_value(baseline, id, "render_ms");
+    bool time_regression =
+        baseline_ms > 0 && render_ms > baseline_ms * (1 + opt.time_tolerance);
+    regressions += quality_regression || time_regression;
+
+    std::clog << "scene " << id << ": build " << build_ms << " ms, render "
+              << render_ms << " ms, " << mrays << " Mrays/s, psnr "
+              << (rmse < 0 ? std::string("n/a (no reference)")
+                           : std::to_string(psnr))
+              << (time_regression ? "  [TIME REGRESSION]" : "")
+              << (quality_regression ? "  [QUALITY REGRESSION]" : "") << '\n';
+
+    json << "    {\"scene\": " << id << ", \"build_ms\": " << build_ms
+         << ", \"render_ms\": " << render_ms << ", \"mrays_per_s\": " << mrays
+         << ", \"rays\": " << cam.rays_traced()
+         << ", \"process_peak_rss_kb\": " << process_peak_rss_kb()
+         << ", \"rmse\": " << rmse
+         << ", \"psnr\": " << (std::isinf(psnr) ? 999.0 : psnr)
+         << ", \"baseline_render_ms\": " << baseline_ms
+         << ", \"time_regression\": " << (time_regression ? "true" : "false")
+         << ", \"quality_regression\": "
+         << (quality_regression ? "true" : "false") << "}"
+         << (id + 1 < scene_count ? "," : "") << "\n";
+  }
+  json << "  ],\n  \"regressions\": " << regressions << "\n}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+  return regressions;
+}
+
+/**
+ * @brief 线程扩展性基准测试的参数
+ *
+ */
+struct scaling_bench_options {
+  int scene_id = 6;             // 测试的场景
+  int max_threads = 0;          // 最大线程数, <=0 时使用硬件支持的并发线程数
+  int image_width = 128;        // 1 个线程时的图像宽度
+  int samples_per_pixel = 16;   // 每像素采样数
+  unsigned int seed = 2023;     // 构建场景前使用的随机数种子
+  std::string json_path;        // JSON 结果的输出路径, 为空时写到 std::cout
+};
+
+/**
+ * @brief 线程扩展性基准测试: 以 1, 2, 4, ..., N 个线程渲染同一场景.
+ * 强扩展(strong scaling)固定图像大小, 报告加速比和并行效率;
+ * 弱扩展(weak scaling)固定每个线程的像素数(图像面积与线程数成正比),
+ * 理想情况下耗时不变. 同时报告调度器记录的每个线程的空闲时间
+ *
+ * @param opt 参数
+ * @param build_scene 场景构造函数
+ */
+template <typename BuildScene>
+void run_scaling_bench(const scaling_bench_options& opt,
+                       const BuildScene& build_scene) {
+  int max_threads = resolve_thread_count(opt.max_threads);
+  std::vector<int> thread_counts;
+  for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"scene\": " << opt.scene_id << ", \"spp\": "
+       << opt.samples_per_pixel << ",\n";
+
+  for (int weak = 0; weak < 2; weak++) {
+    const char* mode = weak ? "weak" : "strong";
+    json << "  \"" << mode << "\": [\n";
+    std::clog << mode << " scaling (scene " << opt.scene_id << "):\n"
+              << "  threads   width   seconds  speedup  efficiency  "
+                 "idle(mean/max)\n";
+    double base_seconds = 0;
+    for (size_t k = 0; k < thread_counts.size(); k++) {
+      int t = thread_counts[k];
+      seed_random(opt.seed);
+      hittable_list world;
+      camera cam;
+      build_scene(opt.scene_id, world, cam);
+      // 弱扩展时图像面积与线程数成正比, 保持长宽比不变
+      cam.image_width = weak ? static_cast<int>(opt.image_width * std::sqrt(t))
+                             : opt.image_width;
+      cam.samples_per_pixel = opt.samples_per_pixel;
+      cam.thread_count = t;
+      cam.show_progress = false;
+
+      std::ostringstream discard;
+      cam.render(world, discard);
+      const auto& sched = cam.schedule_stats();
+      double seconds = sched.wall_seconds;
+      if (k == 0) base_seconds = seconds;
+
+      // 弱扩展的理想耗时不变, 因此效率为 T1/Tn, 加速比为 n*T1/Tn
+      double efficiency = weak ? base_seconds / seconds
+                               : base_seconds / (seconds * t);
+      double speedup = efficiency * t;
+      double idle_mean = 0, idle_max = 0;
+      for (int i = 0; i < t; i++) {
+        idle_mean += sched.idle_seconds(i) / t;
+        idle_max = std::max(idle_max, sched.idle_seconds(i));
+      }
+
+      std::clog << std::fixed << std::setprecision(3) << std::setw(9) << t
+                << std::setw(8) << cam.image_width << std::setw(10) << seconds
+                << std::setw(9) << speedup << std::setw(12) << efficiency
+                << "  " << idle_mean << '/' << idle_max << '\n';
+      json << "    {\"threads\": " << t << ", \"width\": " << cam.image_width
+           << ", \"seconds\": " << seconds << ", \"speedup\": " << speedup
+           << ", \"efficiency\": " << efficiency << ", \"idle_seconds\": [";
+      for (int i = 0; i < t; i++) {
+        json << (i ? ", " : "") << sched.idle_seconds(i);
+      }
+      json << "]}" << (k + 1 < thread_counts.size() ? "," : "") << "\n";
+    }
+    json << "  ]" << (weak ? "" : ",") << "\n";
+  }
+  json << "}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+/**
+ * @brief 光线包基准测试的参数
+ *
+ */
+struct packet_bench_options {
+  std::vector<int> scene_ids = {0, 6, 8};  // 测试的场景
+  std::vector<int> packet_sizes = {0, 4, 8, 16};  // 0 表示逐条光线求交
+  int image_width = 128;                   // 图像宽度
+  int samples_per_pixel = 8;               // 每像素采样数
+  int threads = 1;                         // 渲染线程数
+  int repeat = 3;                          // 每种配置渲染的次数, 取最短耗时
+  unsigned int seed = 2023;                // 构建场景前使用的随机数种子
+  std::string json_path;                   // JSON 结果的输出路径
+};
+
+/**
+ * @brief 光线包基准测试: 对每个场景分别以逐条光线和 4/8/16 条光线的光线包
+ * 渲染, 报告耗时, 光线吞吐量以及相对逐条光线的加速比
+ *
+ * @param opt 参数
+ * @param build_scene 场景构造函数
+ */
+template <typename BuildScene>
+void run_packet_bench(const packet_bench_options& opt,
+                      const BuildScene& build_scene) {
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"spp\": " << opt.samples_per_pixel
+       << ", \"width\": " << opt.image_width << ", \"threads\": "
+       << opt.threads << ", \"simd\": \"" << simd_level_name(simd().level)
+       << "\",\n  \"scenes\": [\n";
+  std::clog << "  scene  packet   seconds   Mrays/s  speedup\n";
+
+  for (size_t s = 0; s < opt.scene_ids.size(); s++) {
+    int scene_id = opt.scene_ids[s];
+    json << "    {\"scene\": " << scene_id << ", \"results\": [\n";
+    double base_seconds = 0;
+    for (size_t k = 0; k < opt.packet_sizes.size(); k++) {
+      int size = opt.packet_sizes[k];
+      double seconds = 0;
+      std::uint64_t rays = 0;
+      for (int rep = 0; rep < std::max(opt.repeat, 1); rep++) {
+        seed_random(opt.seed);
+        hittable_list world;
+        camera cam;
+        build_scene(scene_id, world, cam);
+        cam.image_width = opt.image_width;
+        cam.samples_per_pixel = opt.samples_per_pixel;
+        cam.thread_count = opt.threads;
+        cam.packet_size = size;
+        cam.show_progress = false;
+
+        std::ostringstream discard;
+        auto start = std::chrono::steady_clock::now();
+        cam.render(world, discard);
+        double t = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        if (rep == 0 || t < seconds) seconds = t;
+        rays = cam.rays_traced();
+      }
+      if (k == 0) base_seconds = seconds;
+      double mrays = rays / seconds / 1e6;
+      double speedup = base_seconds / seconds;
+
+      std::clog << std::fixed << std::setprecision(3) << std::setw(7)
+                << scene_id << std::setw(8) << size << std::setw(10) << seconds
+                << std::setw(10) << mrays << std::setw(9) << speedup << '\n';
+      json << "      {\"packet\": " << size << ", \"seconds\": " << seconds
+           << ", \"rays\": " << rays << ", \"mrays_per_second\": " << mrays
+           << ", \"speedup\": " << speedup << "}"
+           << (k + 1 < opt.packet_sizes.size() ? "," : "") << "\n";
+    }
+    json << "    ]}" << (s + 1 < opt.scene_ids.size() ? "," : "") << "\n";
+  }
+  json << "  ]\n}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+/**
+ * @brief 光线排序基准测试的参数
+ *
+ */
+struct ray_sort_bench_options {
+  std::vector<int> scene_ids = {0, 8};  // 测试的场景
+  int image_width = 128;                // 图像宽度
+  int samples_per_pixel = 8;            // 每像素采样数
+  int threads = 0;                      // 渲染线程数
+  int repeat = 3;                       // 每种配置渲染的次数, 取最短耗时
+  unsigned int seed = 2023;             // 构建场景前使用的随机数种子
+  std::string json_path;                // JSON 结果的输出路径
+};
+
+/**
+ * @brief 光线排序基准测试: 以 wavefront 模式分别在排序与不排序反射光线时
+ * 渲染每个场景, 比较求交阶段的光线吞吐量与缓存未命中数
+ *
+ * @param opt 参数
+ * @param build_scene 场景构造函数
+ */
+template <typename BuildScene>
+void run_ray_sort_bench(const ray_sort_bench_options& opt,
+                        const BuildScene& build_scene) {
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"spp\": " << opt.samples_per_pixel
+       << ", \"width\": " << opt.image_width << ",\n  \"scenes\": [\n";
+  std::clog << "  scene  sort   seconds  extension  Mrays/s  cache misses\n";
+
+  for (size_t s = 0; s < opt.scene_ids.size(); s++) {
+    int scene_id = opt.scene_ids[s];
+    json << "    {\"scene\": " << scene_id << ", \"results\": [\n";
+    for (int sort = 0; sort < 2; sort++) {
+      double seconds = 0;
+      wavefront_profile best;
+      for (int rep = 0; rep < std::max(opt.repeat, 1); rep++) {
+        seed_random(opt.seed);
+        hittable_list world;
+        camera cam;
+        build_scene(scene_id, world, cam);
+        cam.image_width = opt.image_width;
+        cam.samples_per_pixel = opt.samples_per_pixel;
+        cam.thread_count = opt.threads;
+        cam.wavefront = true;
+        cam.wavefront_sort = sort;
+        cam.show_progress = false;
+
+        std::ostringstream discard;
+        auto start = std::chrono::steady_clock::now();
+        cam.render(world, discard);
+        double t = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        if (rep == 0 || t < seconds) {
+          seconds = t;
+          best = cam.wavefront_stats();
+        }
+      }
+      double mrays = best.extension_rays / best.extension_seconds / 1e6;
+
+      std::clog << std::fixed << std::setprecision(3) << std::setw(7)
+                << scene_id << std::setw(6) << (sort ? "on" : "off")
+                << std::setw(10) << seconds << std::setw(11)
+                << best.extension_seconds << std::setw(9) << mrays << "  ";
+      if (best.cache_misses_available) {
+        std::clog << best.cache_misses << '\n';
+      } else {
+        std::clog << "unavailable\n";
+      }
+      json << "      {\"sort\": " << (sort ? "true" : "false")
+           << ", \"seconds\": " << seconds
+           << ", \"extension_seconds\": " << best.extension_seconds
+           << ", \"sort_seconds\": " << best.sort_seconds
+           << ", \"extension_rays\": " << best.extension_rays
+           << ", \"extension_mrays_per_second\": " << mrays
+           << ", \"cache_misses\": ";
+      if (best.cache_misses_available) {
+        json << best.cache_misses;
+      } else {
+        json << "null";
+      }
+      json << "}" << (sort ? "" : ",") << "\n";
+    }
+    json << "    ]}" << (s + 1 < opt.scene_ids.size() ? "," : "") << "\n";
+  }
+  json << "  ]\n}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+/**
+ * @brief 纹理存储基准测试的参数
+ *
+ */
+struct texture_bench_options {
+  int scene_id = 2;            // 测试的场景, 默认为地球贴图场景
+  int image_width = 256;       // 图像宽度
+  int samples_per_pixel = 16;  // 每像素采样数
+  int threads = 1;             // 渲染线程数
+  int repeat = 3;              // 每种配置渲染的次数, 取最短耗时
+  unsigned int seed = 2023;    // 构建场景前使用的随机数种子
+  std::string image_path = "earthmap.jpg";  // 用于统计内存的纹理图片
+  std::string json_path;                    // JSON 结果的输出路径
+};
+
+/**
+ * @brief 纹理存储基准测试: 以每种像素排列方式与存储格式渲染同一场景,
+ * 报告耗时, 光线吞吐量, 纹理(含 mip 金字塔)占用的内存, 以及与
+ * 按行存储 8 位像素(原来的存储方式)渲染结果的误差
+ *
+ * @param opt 参数
+ * @param build_scene 场景构造函数
+ */
+template <typename BuildScene>
+void run_texture_bench(const texture_bench_options& opt,
+                       const BuildScene& build_scene) {
+  auto saved = default_texel_storage();
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"scene\": " << opt.scene_id
+       << ", \"spp\": " << opt.samples_per_pixel
+       << ", \"width\": " << opt.image_width << ", \"threads\": "
+       << opt.threads << ",\n  \"results\": [\n";
+  std::clog << "  layout  format   seconds   Mrays/s  speedup  texture KB"
+               "    psnr\n";
+
+  double base_seconds = 0;
+  ppm_image base_image;
+  bool first = true;
+  for (auto layout : {texel_layout::linear, texel_layout::tiled}) {
+    for (auto format :
+         {texel_format::rgb8, texel_format::half, texel_format::float32}) {
+      default_texel_storage() = {format, layout};
+      auto mips = asset_cache::instance().pyramid(opt.image_path);
+
+      double seconds = 0;
+      std::uint64_t rays = 0;
+      std::string output;
+      for (int rep = 0; rep < std::max(opt.repeat, 1); rep++) {
+        seed_random(opt.seed);
+        hittable_list world;
+        camera cam;
+        build_scene(opt.scene_id, world, cam);
+        cam.image_width = opt.image_width;
+        cam.samples_per_pixel = opt.samples_per_pixel;
+        cam.thread_count = opt.threads;
+        cam.show_progress = false;
+
+        std::ostringstream out;
+        auto start = std::chrono::steady_clock::now();
+        cam.render(world, out);
+        double t = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        if (rep == 0 || t < seconds) seconds = t;
+        rays = cam.rays_traced();
+        output = out.str();
+      }
+
+      ppm_image result;
+      std::istringstream in(output);
+      result.read(in);
+      if (first) {
+        base_seconds = seconds;
+        base_image = result;
+      }
+      double mrays = rays / seconds / 1e6;
+      double speedup = base_seconds / seconds;
+      double psnr = std::min(image_psnr(image_rmse(result, base_image)), 999.0);
+
+      std::clog << std::fixed << std::setprecision(3) << std::setw(8)
+                << texel_layout_name(layout) << std::setw(8)
+                << texel_format_name(format) << std::setw(10) << seconds
+                << std::setw(10) << mrays << std::setw(9) << speedup
+                << std::setw(12) << mips->memory_bytes() / 1024
+                << std::setw(8) << std::setprecision(2) << psnr << '\n';
+      json << (first ? "" : ",\n") << "    {\"layout\": \""
+           << texel_layout_name(layout) << "\", \"format\": \""
+           << texel_format_name(format) << "\", \"seconds\": " << seconds
+           << ", \"rays\": " << rays << ", \"mrays_per_second\": " << mrays
+           << ", \"speedup\": " << speedup
+           << ", \"texture_bytes\": " << mips->memory_bytes()
+           << ", \"psnr\": " << psnr << "}";
+      first = false;
+    }
+  }
+  json << "\n  ]\n}\n";
+  default_texel_storage() = saved;
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+/**
+ * @brief 紊流测试的参数
+ *
+ */
+struct noise_bench_options {
+  int samples = 1000000;       // 每种方法计算的采样点数
+  double extent = 64;          // 采样点在 [0,extent)^3 内均匀分布
+  turbulence_options turbulence;  // 烘焙的分辨率, 周期与八度数
+  int scene_id = 3;               // 渲染的场景, 默认为 perlin noise 场景
+  int image_width = 256;       // 图像宽度
+  int samples_per_pixel = 16;  // 每像素采样数
+  int threads = 1;             // 渲染线程数
+  unsigned int seed = 2023;    // 构建 perlin noise 与场景前使用的随机数种子
+  std::string json_path;       // JSON 结果的输出路径
+};
+
+/**
+ * @brief 紊流基准测试:
+ * 1. 逐个八度调用 perlin::noise(原来的 turb)与各指令集下并行计算八度的
+ *    perlin::turb 的速度, 以及两者的最大差异(应当为 0);
+ * 2. 烘焙的体纹理的烘焙耗时, 查找速度, 内存, 以及与同一周期下精确计算的
+ *    紊流之间的均方根误差与最大误差;
+ * 3. 以三种 turbulence_mode 渲染场景, 报告耗时与 PSNR. periodic 与 exact
+ *    比较(平铺改变了图案, PSNR 只说明差别有多大), baked 与 periodic 比较
+ *    (烘焙的插值误差)
+ *
+ * @param opt 参数
+ * @param build_scene 场景构造函数
+ */
+template <typename BuildScene>
+void run_noise_bench(const noise_bench_options& opt,
+                     const BuildScene& build_scene) {
+  using clock = std::chrono::steady_clock;
+  auto seconds_since = [](clock::time_point start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+  int depth = opt.turbulence.depth;
+  int count = std::max(opt.samples, 1);
+
+  seed_random(opt.seed);
+  perlin noise(opt.seed);
+  std::vector<point3> points(count);
+  for (auto& p : points) {
+    p = point3(random_double(0, opt.extent), random_double(0, opt.extent),
+               random_double(0, opt.extent));
+  }
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"samples\": " << count << ", \"depth\": " << depth
+       << ",\n  \"turb\": [\n";
+  std::clog << "  method        ns/sample  speedup  max error\n";
+  auto report = [&](const std::string& name, double seconds, double base,
+                    double max_error, bool first) {
+    double ns = seconds / count * 1e9;
+    std::clog << std::fixed << "  " << std::left << std::setw(12) << name
+              << std::right << std::setprecision(2) << std::setw(11) << ns
+              << std::setw(9) << base / seconds << std::setw(11)
+              << std::setprecision(6) << max_error << '\n';
+    json << (first ? "" : ",\n") << "    {\"method\": \"" << name
+         << "\", \"ns_per_sample\": " << ns
+         << ", \"speedup\": " << base / seconds
+         << ", \"max_error\": " << max_error << "}";
+  };
+
+  // 原来的 turb: 逐个八度调用 noise
+  std::vector<double> exact(count), values(count);
+  auto start = clock::now();
+  for (int i = 0; i < count; i++) {
+    auto accum = 0.0;
+    auto temp_p = points[i];
+    auto weight = 1.0;
+    for (int o = 0; o < depth; o++) {
+      accum += weight * noise.noise(temp_p);
+      weight *= 0.5;
+      temp_p *= 2;
+    }
+    exact[i] = fabs(accum);
+  }
+  double base_seconds = seconds_since(start);
+  report("per-octave", base_seconds, base_seconds, 0, true);
+
+  auto max_error = [&](const std::vector<double>& a,
+                       const std::vector<double>& b) {
+    double e = 0;
+    for (int i = 0; i < count; i++) e = std::max(e, std::fabs(a[i] - b[i]));
+    return e;
+  };
+
+  auto saved_level = simd().level;
+  for (auto level : {simd_level::scalar, simd_level::sse42, simd_level::avx2,
+                     simd_level::avx512}) {
+    if (level > detect_simd_level()) continue;
+    set_simd_level(level);
+    start = clock::now();
+    for (int i = 0; i < count; i++) values[i] = noise.turb(points[i], depth);
+    report(simd_level_name(level), seconds_since(start), base_seconds,
+           max_error(values, exact), false);
+  }
+  set_simd_level(saved_level);
+
+  // 烘焙的体纹理与同一周期下精确计算的紊流比较
+  int period = opt.turbulence.period;
+  start = clock::now();
+  for (int i = 0; i < count; i++) {
+    exact[i] = noise.periodic_turb(points[i], depth, period);
+  }
+  double periodic_seconds = seconds_since(start);
+  report("periodic", periodic_seconds, base_seconds, 0, false);
+
+  turbulence_volume volume;
+  start = clock::now();
+  volume.bake(noise, opt.turbulence);
+  double bake_seconds = seconds_since(start);
+  start = clock::now();
+  for (int i = 0; i < count; i++) values[i] = volume.lookup(points[i]);
+  report("baked", seconds_since(start), base_seconds,
+         max_error(values, exact), false);
+
+  double sum2 = 0;
+  for (int i = 0; i < count; i++) {
+    sum2 += (values[i] - exact[i]) * (values[i] - exact[i]);
+  }
+  double rms = std::sqrt(sum2 / count);
+  std::clog << std::fixed << std::setprecision(3) << "  baked "
+            << volume.resolution() << "^3, period " << period << ": bake "
+            << bake_seconds << " s, " << volume.memory_bytes() / 1024
+            << " KB, rms error " << std::setprecision(6) << rms << '\n';
+  json << "\n  ],\n  \"baked\": {\"resolution\": " << volume.resolution()
+       << ", \"period\": " << period
+       << ", \"bake_seconds\": " << bake_seconds
+       << ", \"bytes\": " << volume.memory_bytes()
+       << ", \"rms_error\": " << std::setprecision(6) << rms
+       << "},\n  \"render\": [\n" << std::setprecision(4);
+
+  // 以三种方式计算紊流渲染场景, 每种方式与前一种比较
+  auto saved = default_turbulence();
+  ppm_image previous;
+  double base_render = 0;
+  bool first = true;
+  std::clog << "  render        build s  render s  speedup    psnr\n";
+  for (auto mode : {turbulence_mode::exact, turbulence_mode::periodic,
+                    turbulence_mode::baked}) {
+    default_turbulence() = opt.turbulence;
+    default_turbulence().mode = mode;
+    seed_random(opt.seed);
+    hittable_list world;
+    camera cam;
+    start = clock::now();
+    build_scene(opt.scene_id, world, cam);
+    double build_seconds = seconds_since(start);
+    cam.image_width = opt.image_width;
+    cam.samples_per_pixel = opt.samples_per_pixel;
+    cam.thread_count = opt.threads;
+    cam.show_progress = false;
+
+    std::ostringstream out;
+    start = clock::now();
+    cam.render(world, out);
+    double render_seconds = seconds_since(start);
+
+    ppm_image result;
+    std::istringstream in(out.str());
+    result.read(in);
+    if (first) {
+      previous = result;
+      base_render = render_seconds;
+    }
+    double psnr = std::min(image_psnr(image_rmse(result, previous)), 999.0);
+    previous = result;
+    std::clog << std::fixed << std::setprecision(3) << "  " << std::left
+              << std::setw(12) << turbulence_mode_name(mode) << std::right
+              << std::setw(9) << build_seconds << std::setw(10)
+              << render_seconds << std::setw(9) << base_render / render_seconds
+              << std::setw(8) << std::setprecision(2) << psnr << '\n';
+    json << (first ? "" : ",\n") << "    {\"turbulence\": \""
+         << turbulence_mode_name(mode)
+         << "\", \"build_seconds\": " << build_seconds
+         << ", \"render_seconds\": " << render_seconds
+         << ", \"speedup\": " << base_render / render_seconds
+         << ", \"psnr\": " << psnr << "}";
+    first = false;
+  }
+  default_turbulence() = saved;
+  json << "\n  ]\n}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+/**
+ * @brief 实例化测试的参数
+ *
+ */
+struct instance_bench_options {
+  int count = 1000000;         // 树的实例数
+  int spheres = 64;            // 一棵树(底层结构)的球数
+  // 是否与 translate(rotate_y(...)) 比较. bvh_node 每层都对区间排序,
+  // 构建较慢, 适合较小的 count
+  bool legacy = false;
+  int image_width = 256;       // 图像宽度
+  int samples_per_pixel = 4;   // 每像素采样数
+  int threads = 1;             // 渲染线程数
+  unsigned int seed = 2023;    // 构建场景前使用的随机数种子
+  std::string json_path;       // JSON 结果的输出路径
+};
+
+/**
+ * @brief 实例化基准测试: 在网格上种 count 棵共享同一底层 BVH 的树.
+ * 1. rigid: 每棵树绕 y 轴随机旋转后平移, 用 instance_bvh 与(legacy 时)原来的
+ *    bvh_node(translate(rotate_y(tree))) 构建, 比较构建耗时, 内存, 渲染耗时
+ *    与两者渲染结果的 PSNR. 原来的方式的内存按对象大小估计
+ *    (包括 shared_ptr 的控制块);
+ * 2. affine: 再加上随机倾斜与缩放, 只有 instance_bvh 能表示
+ *
+ * @param opt 参数
+ */
+inline void run_instance_bench(const instance_bench_options& opt) {
+  using clock = std::chrono::steady_clock;
+  auto seconds_since = [](clock::time_point start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+  int count = std::max(opt.count, 1);
+  int side = static_cast<int>(std::ceil(std::sqrt(double(count))));
+  const double spacing = 4;
+  double extent = side * spacing / 2;
+
+  // 底层结构: 树干与树冠由若干个球组成
+  seed_random(opt.seed);
+  hittable_list tree_parts;
+  auto bark = make_shared<lambertian>(color(0.35, 0.22, 0.12));
+  auto leaves = make_shared<lambertian>(color(0.15, 0.45, 0.12));
+  for (int k = 0; k < 4; k++) {
+    tree_parts.add(make_shared<sphere>(point3(0, 0.25 + 0.5 * k, 0), 0.25, bark));
+  }
+  for (int k = 4; k < std::max(opt.spheres, 5); k++) {
+    auto offset = random_in_unit_sphere();
+    tree_parts.add(make_shared<sphere>(point3(0, 2.6, 0) + 0.9 * offset,
+                                       random_double(0.3, 0.6), leaves));
+  }
+  auto tree = make_shared<bvh_node>(tree_parts);
+
+  // 每棵树的位置, 朝向, 倾斜与缩放
+  struct placement {
+    vec3 position;
+    double yaw, tilt;
+    vec3 tilt_axis;
+    double scale;
+  };
+  std::vector<placement> places(count);
+  for (int k = 0; k < count; k++) {
+    auto& p = places[k];
+    p.position = vec3(-extent + (k % side + random_double(0.1, 0.9)) * spacing,
+                      0, -extent + (k / side + random_double(0.1, 0.9)) * spacing);
+    p.yaw = random_double(0, 360);
+    p.tilt = random_double(-12, 12);
+    p.tilt_axis = vec3(random_double(-1, 1), 0, random_double(-1, 1));
+    if (p.tilt_axis.length_squared() < 1e-6) p.tilt_axis = vec3(1, 0, 0);
+    p.scale = random_double(0.7, 1.3);
+  }
+
+  auto ground = make_shared<quad>(point3(-extent - 10, 0, extent + 10),
+                                  vec3(2 * extent + 20, 0, 0),
+                                  vec3(0, 0, -2 * extent - 20),
+                                  make_shared<lambertian>(color(0.4, 0.35, 0.25)));
+  camera cam;
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = opt.image_width;
+  cam.samples_per_pixel = opt.samples_per_pixel;
+  cam.max_depth = 8;
+  cam.thread_count = opt.threads;
+  cam.show_progress = false;
+  cam.vfov = 30;
+  cam.lookfrom = point3(0, 25, -extent - 20);
+  cam.lookat = point3(0, 0, -extent + 40);
+  cam.vup = vec3(0, 1, 0);
+  cam.defocus_angle = 0;
+
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(4);
+  json << "{\n  \"instances\": " << count
+       << ", \"spheres_per_tree\": " << tree_parts.objects.size()
+       << ",\n  \"runs\": [\n";
+  std::clog << "  " << count << " instances of a " << tree_parts.objects.size()
+            << "-sphere tree\n"
+            << "  method       build s     MB  render s  mrays/s    psnr\n";
+  ppm_image reference;
+  bool first = true;
+  auto run = [&](const char* name, shared_ptr<hittable> forest,
+                 double build_seconds, double bytes) {
+    hittable_list world;
+    world.add(ground);
+    world.add(forest);
+    seed_random(opt.seed);
+    std::ostringstream out;
+    auto start = clock::now();
+    cam.render(world, out);
+    double render_seconds = seconds_since(start);
+    ppm_image image;
+    std::istringstream in(out.str());
+    image.read(in);
+    // rigid 的两种方式渲染同一场景, affine 不与之比较
+    double psnr = 0;
+    if (first) {
+      reference = image;
+      psnr = 999;
+    } else if (std::string(name) == "legacy") {
+      psnr = std::min(image_psnr(image_rmse(image, reference)), 999.0);
+    }
+    double mrays = cam.rays_traced() / (render_seconds * 1e6);
+    std::clog << std::fixed << "  " << std::left << std::setw(10) << name
+              << std::right << std::setprecision(3) << std::setw(9)
+              << build_seconds << std::setw(9) << std::setprecision(1)
+              << bytes / (1024 * 1024) << std::setw(10) << std::setprecision(3)
+              << render_seconds << std::setw(9) << mrays << std::setw(8)
+              << std::setprecision(2) << psnr << '\n';
+    json << (first ? "" : ",\n") << "    {\"method\": \"" << name
+         << "\", \"build_seconds\": " << build_seconds
+         << ", \"bytes\": " << std::setprecision(0) << bytes
+         << std::setprecision(4) << ", \"render_seconds\": " << render_seconds
+         << ", \"mrays_per_s\": " << mrays << ", \"psnr\": " << psnr << "}";
+    first = false;
+  };
+
+  // 两层结构: 每个实例两个 3x4 变换
+  auto build_instances = [&](bool affine, double& seconds) {
+    auto start = clock::now();
+    auto forest = make_shared<instance_bvh>();
+    int blas = forest->add_blas(tree);
+    for (const auto& p : places) {
+      auto to_world = affine_transform::translation(p.position) *
+                      affine_transform::rotation_y(p.yaw);
+      if (affine) {
+        to_world = to_world * affine_transform::rotation(p.tilt_axis, p.tilt) *
+                   affine_transform::scaling(p.scale);
+      }
+      forest->add_instance(blas, to_world);
+    }
+    forest->build();
+    seconds = seconds_since(start);
+    return forest;
+  };
+  double build_seconds;
+  {
+    auto forest = build_instances(false, build_seconds);
+    run("instanced", forest, build_seconds, double(forest->memory_bytes()));
+  }
+
+  // 原来的方式: 每棵树两个包装对象, 再对全部包装对象建 bvh_node
+  if (opt.legacy) {
+    auto start = clock::now();
+    hittable_list wrapped;
+    for (const auto& p : places) {
+      wrapped.add(make_shared<translate>(make_shared<rotate_y>(tree, p.yaw),
+                                         p.position));
+    }
+    auto forest = make_shared<bvh_node>(wrapped);
+    build_seconds = seconds_since(start);
+    // make_shared 把对象与控制块(约 16 字节)分配在一起
+    double bytes =
+        double(count) * (sizeof(translate) + sizeof(rotate_y) + 32 +
+                         sizeof(shared_ptr<hittable>)) +
+        double(count - 1) * (sizeof(bvh_node) + 16);
+    run("legacy", forest, build_seconds, bytes);
+  }
+
+  {
+    auto forest = build_instances(true, build_seconds);
+    run("affine", forest, build_seconds, double(forest->memory_bytes()));
+  }
+  json << "\n  ]\n}\n";
+
+  if (opt.json_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(opt.json_path);
+    out << json.str();
+  }
+}
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * @file simd_dispatch.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 热点函数的运行时指令集分发: 启动时通过 cpuid 选择机器支持的最宽指令集,
+ * 也可以用环境变量 RTW_SIMD 或命令行参数 --simd 强制指定
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef SIMD_DISPATCH_H
+#define SIMD_DISPATCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "rtweekend.h"
+#include "simd_kernels_scalar.h"
+
+// Clang 也定义 __GNUC__, 但不支持 #pragma GCC target/optimize, 只用标量版本
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define RTW_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// 批量求交的数组需要补齐到的长度, 等于最宽的向量(AVX-512 float)的分量数
+static constexpr int simd_batch_align = 16;
+
+enum class simd_level { scalar = 0, sse42, avx2, avx512 };
+
+inline const char* simd_level_name(simd_level level) {
+  switch (level) {
+    case simd_level::sse42:
+      return "sse42";
+    case simd_level::avx2:
+      return "avx2";
+    case simd_level::avx512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+inline bool parse_simd_level(const std::string& name, simd_level& level) {
+  for (auto l : {simd_level::scalar, simd_level::sse42, simd_level::avx2,
+                 simd_level::avx512}) {
+    if (name == simd_level_name(l)) {
+      level = l;
+      return true;
+    }
+  }
+  return false;
+}
+
+// 当前 CPU 支持的最宽指令集
+inline simd_level detect_simd_level() {
+#ifdef RTW_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+  if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+  if (__builtin_cpu_supports("sse4.2")) return simd_level::sse42;
+#endif
+  return simd_level::scalar;
+}
+
+// 向量版本使用 GCC 的向量扩展与 #pragma GCC target, 只在 GCC 的 x86 编译器上
+// 生成; 标量版本(simd_kernels_scalar.h)是普通的循环, 任何编译器都可用
+#ifdef RTW_SIMD_X86
+// 热点函数中禁止把 a*b+c 合并为 fma (AVX-512 隐含 FMA), 保证各版本结果逐位相同
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+namespace simd_sse42 {
+#define RTW_SIMD_BYTES 16
+#include "simd_kernels_impl.h"
+#undef RTW_SIMD_BYTES
+}  // namespace simd_sse42
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace simd_avx2 {
+#define RTW_SIMD_BYTES 32
+#define RTW_SIMD_GATHER
+#include "simd_kernels_impl.h"
+#undef RTW_SIMD_GATHER
+#undef RTW_SIMD_BYTES
+}  // namespace simd_avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace simd_avx512 {
+#define RTW_SIMD_BYTES 64
+#define RTW_SIMD_GATHER
+#include "simd_kernels_impl.h"
+#undef RTW_SIMD_GATHER
+#undef RTW_SIMD_BYTES
+}  // namespace simd_avx512
+#pragma GCC pop_options
+
+#pragma GCC pop_options
+#endif
+
+/**
+ * @brief 某一指令集下的热点函数表
+ *
+ */
+struct simd_kernels {
+  simd_level level = simd_level::scalar;
+  decltype(&simd_scalar::box_hit2) box_hit2 = simd_scalar::box_hit2;
+  decltype(&simd_scalar::sphere_hit_n) sphere_hit_n = simd_scalar::sphere_hit_n;
+  decltype(&simd_scalar::quad_hit_n) quad_hit_n = simd_scalar::quad_hit_n;
+  decltype(&simd_scalar::perlin_blend) perlin_blend = simd_scalar::perlin_blend;
+  decltype(&simd_scalar::perlin_turb) perlin_turb = simd_scalar::perlin_turb;
+};
+
+inline simd_kernels make_simd_kernels(simd_level level) {
+  simd_kernels k;
+#ifdef RTW_SIMD_X86
+#define RTW_SIMD_TABLE(ns)            \
+  k.box_hit2 = ns::box_hit2;         \
+  k.sphere_hit_n = ns::sphere_hit_n; \
+  k.quad_hit_n = ns::quad_hit_n;     \
+  k.perlin_blend = ns::perlin_blend; \
+  k.perlin_turb = ns::perlin_turb;
+  switch (level) {
+    case simd_level::avx512:
+      RTW_SIMD_TABLE(simd_avx512) break;
+    case simd_level::avx2:
+      RTW_SIMD_TABLE(simd_avx2) break;
+    case simd_level::sse42:
+      RTW_SIMD_TABLE(simd_sse42) break;
+    default:
+      level = simd_level::scalar;
+  }
+#undef RTW_SIMD_TABLE
+#else
+  level = simd_level::scalar;
+#endif
+  k.level = level;
+  return k;
+}
+
+// 进程内当前使用的函数表, 第一次访问时根据 CPU 与环境变量 RTW_SIMD 初始化
+inline simd_kernels& active_simd_kernels() {
+  static simd_kernels kernels = [] {
+    auto level = detect_simd_level();
+    const char* env = std::getenv("RTW_SIMD");
+    simd_level forced;
+    if (env && parse_simd_level(env, forced)) {
+      if (forced > level) {
+        std::clog << "RTW_SIMD=" << env << " 不被当前 CPU 支持, 使用 "
+                  << simd_level_name(level) << "\n";
+      } else {
+        level = forced;
+      }
+    }
+    return make_simd_kernels(level);
+  }();
+  return kernels;
+}
+
+inline const simd_kernels& simd() { return active_simd_kernels(); }
+
+/**
+ * @brief 强制使用某一指令集, 只能在渲染开始之前调用.
+ * 超出 CPU 支持范围时退回到支持的最宽指令集
+ *
+ * @param level 指令集
+ * @return simd_level 实际使用的指令集
+ */
+inline simd_level set_simd_level(simd_level level) {
+  auto supported = detect_simd_level();
+  if (level > supported) {
+    std::clog << simd_level_name(level) << " 不被当前 CPU 支持, 使用 "
+              << simd_level_name(supported) << "\n";
+    level = supported;
+  }
+  active_simd_kernels() = make_simd_kernels(level);
+  return level;
+}
+
+#endif
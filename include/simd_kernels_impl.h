@@ -0,0 +1,377 @@
+/**
+ * @file simd_kernels_impl.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 可按不同指令集编译的热点函数, 由 simd_dispatch.h 在不同的
+ * namespace 与 #pragma GCC target 下多次包含, 因此没有 include guard.
+ * 包含前需要定义 RTW_SIMD_BYTES (一个向量寄存器的字节数), 支持 AVX2 gather
+ * 指令的版本还需要定义 RTW_SIMD_GATHER. 只用于 GCC/Clang, 标量版本见
+ * simd_kernels_scalar.h
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+// 使用 GCC 的向量扩展, 同一份代码在不同的 target 下生成 SSE/AVX2/AVX-512 指令.
+// 所有运算的顺序与标量版本(sphere::hit, quad::hit, aabb::hit)
+// 一致, 且不使用 fma, 因此结果逐位相同.
+
+static constexpr int lanes = RTW_SIMD_BYTES / sizeof(real);
+
+typedef real vreal __attribute__((vector_size(RTW_SIMD_BYTES)));
+typedef float vfloat __attribute__((vector_size(lanes * sizeof(float))));
+typedef real v8real __attribute__((vector_size(8 * sizeof(real))));
+
+inline vreal load(const real* p) {
+  vreal x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+// v8real 可能比当前 target 的寄存器宽, 不按值返回以免改变调用约定
+inline void load8(v8real& x, const real* p) { std::memcpy(&x, p, sizeof(x)); }
+
+inline vreal splat(real x) { return vreal{} + x; }
+
+inline vreal vsqrt(vreal x) {
+#if RTW_SIMD_BYTES == 64 && defined(RTW_USE_FLOAT)
+  // 带掩码的形式以 0 作为初值, 避免未初始化的目标寄存器
+  return (vreal)_mm512_mask_sqrt_ps(_mm512_setzero_ps(), 0xFFFF, (__m512)x);
+#elif RTW_SIMD_BYTES == 64
+  return (vreal)_mm512_mask_sqrt_pd(_mm512_setzero_pd(), 0xFF, (__m512d)x);
+#elif RTW_SIMD_BYTES == 32 && defined(RTW_USE_FLOAT)
+  return (vreal)_mm256_sqrt_ps((__m256)x);
+#elif RTW_SIMD_BYTES == 32
+  return (vreal)_mm256_sqrt_pd((__m256d)x);
+#elif RTW_SIMD_BYTES == 16 && defined(RTW_USE_FLOAT)
+  return (vreal)_mm_sqrt_ps((__m128)x);
+#else
+  return (vreal)_mm_sqrt_pd((__m128d)x);
+#endif
+}
+
+/**
+ * @brief 光线同时与两个包围盒求交, 与 aabb::hit 的结果相同
+ *
+ * @param box_min 两个包围盒的下界, 布局为 [x0,y0,z0,-inf,x1,y1,z1,-inf]
+ * @param box_max 两个包围盒的上界, 布局同上, 补齐的分量为 +inf
+ * @param orig 光线起点, 布局为 [x,y,z,0,x,y,z,0]
+ * @param inv_dir 光线方向的倒数, 布局为 [1/x,1/y,1/z,1,1/x,1/y,1/z,1]
+ * @param tmin 光线的合法范围
+ * @param tmax
+ * @return int 第 0 位表示是否击中第一个包围盒, 第 1 位表示第二个
+ */
+inline int box_hit2(const real* box_min, const real* box_max, const real* orig,
+                    const real* inv_dir, real tmin, real tmax) {
+  v8real o, inv, bmin, bmax;
+  load8(o, orig);
+  load8(inv, inv_dir);
+  load8(bmin, box_min);
+  load8(bmax, box_max);
+  v8real lo = (bmin - o) * inv;
+  v8real hi = (bmax - o) * inv;
+  auto neg = inv < 0;
+  v8real t0 = neg ? hi : lo;
+  v8real t1 = neg ? lo : hi;
+
+  int mask = 0;
+  for (int b = 0; b < 2; b++) {
+    real near = tmin, far = tmax;
+    for (int a = 0; a < 3; a++) {
+      if (t0[b * 4 + a] > near) near = t0[b * 4 + a];
+      if (t1[b * 4 + a] < far) far = t1[b * 4 + a];
+    }
+    if (near < far) mask |= 1 << b;
+  }
+  return mask;
+}
+
+/**
+ * @brief 光线与 count 个球求交, 返回最近交点所在的下标, 没有则返回 -1.
+ * 输入数组在 count 之后至少还要有一个向量宽度的可读空间
+ *
+ * @param center 0 时刻球心的 x,y,z 三个数组
+ * @param motion 球心运动方向的 x,y,z 三个数组, 静止的球为 0
+ * @param radius 半径
+ * @param count 球的个数
+ * @param orig 光线起点 [x,y,z]
+ * @param dir 光线方向 [x,y,z]
+ * @param time 光线的时刻
+ * @param tmin 光线的合法范围 (tmin, tmax)
+ * @param tmax
+ * @param t_hit 最近交点的距离
+ * @return int
+ */
+inline int sphere_hit_n(const real* const center[3],
+                        const real* const motion[3], const real* radius,
+                        int count, const real* orig, const real* dir, real time,
+                        real tmin, real tmax, real* t_hit) {
+  vreal ox = splat(orig[0]), oy = splat(orig[1]), oz = splat(orig[2]);
+  vreal dx = splat(dir[0]), dy = splat(dir[1]), dz = splat(dir[2]);
+  vreal a = splat((dir[0] * dir[0] + dir[1] * dir[1]) + dir[2] * dir[2]);
+  vreal vmin = splat(tmin), vmax = splat(tmax), vtime = splat(time);
+
+  int best = -1;
+  real best_t = tmax;
+  for (int base = 0; base < count; base += lanes) {
+    // 与 sphere::sphere_center() 相同: center1 + time * center_vec
+    vreal ocx = ox - (load(center[0] + base) + vtime * load(motion[0] + base));
+    vreal ocy = oy - (load(center[1] + base) + vtime * load(motion[1] + base));
+    vreal ocz = oz - (load(center[2] + base) + vtime * load(motion[2] + base));
+    vreal r = load(radius + base);
+    vreal half_b = (ocx * dx + ocy * dy) + ocz * dz;
+    vreal c = ((ocx * ocx + ocy * ocy) + ocz * ocz) - r * r;
+    vreal discriminant = half_b * half_b - a * c;
+    auto has_root = discriminant >= 0;
+    vreal sqrtd = vsqrt(has_root ? discriminant : vreal{});
+
+    vreal root1 = (-half_b - sqrtd) / a;
+    vreal root2 = (-half_b + sqrtd) / a;
+    vreal root = ((vmin < root1) & (root1 < vmax)) ? root1 : root2;
+    auto ok = has_root & (vmin < root) & (root < vmax);
+
+    for (int l = 0; l < lanes && base + l < count; l++) {
+      // 与逐个调用 sphere::hit 一致: 距离相同时保留先出现的球
+      if (ok[l] && root[l] < best_t) {
+        best_t = root[l];
+        best = base + l;
+      }
+    }
+  }
+  *t_hit = best_t;
+  return best;
+}
+
+/**
+ * @brief 光线与 count 个平行四边形求交, 返回最近交点所在的下标, 没有则返回 -1.
+ * 与 quad::hit 相同, 中间结果使用 float; 输入数组在 count 之后至少还要有
+ * 一个向量宽度的可读空间
+ *
+ * @param q 左下角 Q 的 x,y,z 三个数组
+ * @param u 边 u 的 x,y,z 三个数组
+ * @param v 边 v 的 x,y,z 三个数组
+ * @param count 平行四边形的个数
+ * @param orig 光线起点 [x,y,z]
+ * @param dir 光线方向 [x,y,z]
+ * @param tmin 光线的合法范围 [tmin, tmax]
+ * @param tmax
+ * @param t_hit 最近交点的距离
+ * @return int
+ */
+inline int quad_hit_n(const real* const q[3], const real* const u[3],
+                      const real* const v[3], int count, const real* orig,
+                      const real* dir, real tmin, real tmax, real* t_hit) {
+  vreal dx = splat(dir[0]), dy = splat(dir[1]), dz = splat(dir[2]);
+  vreal vmin = splat(tmin);
+
+  int best = -1;
+  real best_t = tmax;
+  for (int base = 0; base < count; base += lanes) {
+    vreal ux = load(u[0] + base), uy = load(u[1] + base), uz = load(u[2] + base);
+    vreal vx = load(v[0] + base), vy = load(v[1] + base), vz = load(v[2] + base);
+    // P = cross(dir, v), T = orig - Q, QQ = cross(T, u)
+    vreal px = dy * vz - dz * vy;
+    vreal py = dz * vx - dx * vz;
+    vreal pz = dx * vy - dy * vx;
+    vreal tx = splat(orig[0]) - load(q[0] + base);
+    vreal ty = splat(orig[1]) - load(q[1] + base);
+    vreal tz = splat(orig[2]) - load(q[2] + base);
+    vreal qqx = ty * uz - tz * uy;
+    vreal qqy = tz * ux - tx * uz;
+    vreal qqz = tx * uy - ty * ux;
+
+    vfloat det = __builtin_convertvector((px * ux + py * uy) + pz * uz, vfloat);
+    vfloat uu = __builtin_convertvector((tx * px + ty * py) + tz * pz, vfloat);
+    vfloat vv = __builtin_convertvector((dx * qqx + dy * qqy) + dz * qqz, vfloat);
+    vfloat t = __builtin_convertvector((vx * qqx + vy * qqy) + vz * qqz, vfloat);
+    vfloat f_inv_det = 1.0f / det;
+    t *= f_inv_det;
+    uu *= f_inv_det;
+    vv *= f_inv_det;
+    vreal t_real = __builtin_convertvector(t, vreal);
+    auto inside = __builtin_convertvector(
+        (uu >= 0) & (vv >= 0) & (uu <= 1.0f) & (vv <= 1.0f), decltype(vmin < vmin));
+    auto ok = inside & (vmin <= t_real);
+
+    for (int l = 0; l < lanes && base + l < count; l++) {
+      // 与逐个调用 quad::hit 一致: 使用闭区间, 距离相同时保留后出现的四边形
+      if (ok[l] && t_real[l] <= best_t) {
+        best_t = t_real[l];
+        best = base + l;
+      }
+    }
+  }
+  *t_hit = best_t;
+  return best;
+}
+
+/**
+ * @brief perlin noise 中 8 个角点梯度的 Hermite 插值
+ *
+ * @param gx 8 个角点的梯度向量, 下标为 i*4+j*2+k
+ * @param gy
+ * @param gz
+ * @param u 角点内的局部坐标
+ * @param v
+ * @param w
+ * @return real
+ */
+inline real perlin_blend(const real* gx, const real* gy, const real* gz, real u,
+                         real v, real w) {
+  const v8real di = {0, 0, 0, 0, 1, 1, 1, 1};
+  const v8real dj = {0, 0, 1, 1, 0, 0, 1, 1};
+  const v8real dk = {0, 1, 0, 1, 0, 1, 0, 1};
+  auto uu = u * u * (3 - 2 * u);
+  auto vv = v * v * (3 - 2 * v);
+  auto ww = w * w * (3 - 2 * w);
+
+  v8real x, y, z;
+  load8(x, gx);
+  load8(y, gy);
+  load8(z, gz);
+  v8real d = ((u - di) * x + (v - dj) * y) + (w - dk) * z;
+  v8real weight = (di * uu + (1 - di) * (1 - uu)) *
+                  (dj * vv + (1 - dj) * (1 - vv)) *
+                  (dk * ww + (1 - dk) * (1 - ww)) * d;
+
+  real accum = 0;
+  for (int l = 0; l < 8; l++) accum += weight[l];
+  return accum;
+}
+
+typedef int vint __attribute__((vector_size(lanes * sizeof(int))));
+
+/**
+ * @brief lanes 个八度在同一个角点 (di,dj,dk) 处的梯度下标
+ * perm[(ix+di)&mask] ^ perm[256+((iy+dj)&mask)] ^ perm[512+((iz+dk)&mask)],
+ * 支持 AVX2 时使用 gather 指令
+ *
+ */
+inline vint perlin_corner_index(const int* perm, vint ix, vint iy, vint iz,
+                                vint mask, int di, int dj, int dk) {
+  vint hx = (ix + di) & mask, hy = (iy + dj) & mask, hz = (iz + dk) & mask;
+#if !defined(RTW_SIMD_GATHER)
+  for (int o = 0; o < lanes; o++) {
+    hx[o] = perm[hx[o]];
+    hy[o] = perm[256 + hy[o]];
+    hz[o] = perm[512 + hz[o]];
+  }
+#elif RTW_SIMD_BYTES == 64 && defined(RTW_USE_FLOAT)
+  // 使用带掩码的 gather 并以 0 作为初值, 避免未初始化的目标寄存器
+  auto zero = _mm512_setzero_si512();
+  hx = (vint)_mm512_mask_i32gather_epi32(zero, 0xFFFF, (__m512i)hx, perm, 4);
+  hy = (vint)_mm512_mask_i32gather_epi32(zero, 0xFFFF, (__m512i)hy, perm + 256,
+                                         4);
+  hz = (vint)_mm512_mask_i32gather_epi32(zero, 0xFFFF, (__m512i)hz, perm + 512,
+                                         4);
+#elif RTW_SIMD_BYTES == 32 && !defined(RTW_USE_FLOAT)
+  auto zero = _mm_setzero_si128();
+  auto all = _mm_set1_epi32(-1);
+  hx = (vint)_mm_mask_i32gather_epi32(zero, perm, (__m128i)hx, all, 4);
+  hy = (vint)_mm_mask_i32gather_epi32(zero, perm + 256, (__m128i)hy, all, 4);
+  hz = (vint)_mm_mask_i32gather_epi32(zero, perm + 512, (__m128i)hz, all, 4);
+#else
+  auto zero = _mm256_setzero_si256();
+  auto all = _mm256_set1_epi32(-1);
+  hx = (vint)_mm256_mask_i32gather_epi32(zero, perm, (__m256i)hx, all, 4);
+  hy = (vint)_mm256_mask_i32gather_epi32(zero, perm + 256, (__m256i)hy, all, 4);
+  hz = (vint)_mm256_mask_i32gather_epi32(zero, perm + 512, (__m256i)hz, all, 4);
+#endif
+  return hx ^ hy ^ hz;
+}
+
+// 按下标读取 lanes 个梯度分量
+inline vreal perlin_gather(const real* table, vint index) {
+#if !defined(RTW_SIMD_GATHER)
+  vreal out;
+  for (int o = 0; o < lanes; o++) out[o] = table[index[o]];
+  return out;
+#elif RTW_SIMD_BYTES == 64 && defined(RTW_USE_FLOAT)
+  return (vreal)_mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF,
+                                         (__m512i)index, table, 4);
+#elif RTW_SIMD_BYTES == 64
+  return (vreal)_mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF,
+                                         (__m256i)index, table, 8);
+#elif defined(RTW_USE_FLOAT)
+  return (vreal)_mm256_mask_i32gather_ps(
+      _mm256_setzero_ps(), table, (__m256i)index,
+      _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+#else
+  return (vreal)_mm256_mask_i32gather_pd(
+      _mm256_setzero_pd(), table, (__m128i)index,
+      _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+#endif
+}
+
+// 向下取整, 同时返回整数部分. 与 std::floor 相同, 要求 |x| < 2^31
+inline vreal perlin_floor(vreal x, vint& ix) {
+  ix = __builtin_convertvector(x, vint);  // 向 0 取整
+  ix += __builtin_convertvector(__builtin_convertvector(ix, vreal) > x, vint);
+  return __builtin_convertvector(ix, vreal);
+}
+
+/**
+ * @brief 紊流 turb(p) = |sum_o 0.5^o * noise(2^o p)|, 向量的每个分量计算一个
+ * 八度, 每次并行计算 lanes 个八度. 各八度内 8 个角点的累加顺序以及八度之间的
+ * 累加顺序与逐个八度调用 perlin_blend 相同, 因此结果逐位相同
+ *
+ * @param perm 三个置换表, 依次存放, 共 3*256 个
+ * @param gradient 梯度向量的 x,y,z 分量表, 依次存放, 共 3*256 个
+ * @param p 采样点
+ * @param depth 八度数
+ * @param period 第 0 个八度的格点周期(2 的幂, 不超过 256), 第 o 个八度为
+ * period*2^o. 为 256 时就是普通的 perlin noise, 更小的周期用于烘焙可平铺的体纹理
+ * @return double
+ */
+inline double perlin_turb(const int* perm, const real* gradient,
+                          const real* p, int depth, int period) {
+  double accum = 0.0;
+  double weight = 1.0;
+  // 乘以 2 的幂是精确的, 与逐次 temp_p *= 2 的结果相同
+  real scale = 1;
+  int wrap = period;
+  for (int first = 0; first < depth; first += lanes) {
+    vreal octave_scale;
+    vint mask;
+    for (int o = 0; o < lanes; o++) {
+      octave_scale[o] = scale;
+      mask[o] = wrap - 1;
+      scale *= 2;
+      wrap = std::min(wrap * 2, 256);
+    }
+    vreal x = octave_scale * p[0], y = octave_scale * p[1],
+          z = octave_scale * p[2];
+    vint ix, iy, iz;
+    vreal u = x - perlin_floor(x, ix);
+    vreal v = y - perlin_floor(y, iy);
+    vreal w = z - perlin_floor(z, iz);
+    // 与 perlin::noise 相同, 先做一次 Hermite 插值
+    u = u * u * (3 - 2 * u);
+    v = v * v * (3 - 2 * v);
+    w = w * w * (3 - 2 * w);
+    // perlin_blend 中的第二次 Hermite 插值
+    vreal uu = u * u * (3 - 2 * u);
+    vreal vv = v * v * (3 - 2 * v);
+    vreal ww = w * w * (3 - 2 * w);
+
+    vreal noise = {};
+    for (int l = 0; l < 8; l++) {
+      int di = l >> 2, dj = (l >> 1) & 1, dk = l & 1;
+      vint index = perlin_corner_index(perm, ix, iy, iz, mask, di, dj, dk);
+      vreal gx = perlin_gather(gradient, index);
+      vreal gy = perlin_gather(gradient + 256, index);
+      vreal gz = perlin_gather(gradient + 512, index);
+      real rdi = real(di), rdj = real(dj), rdk = real(dk);
+      vreal d = ((u - rdi) * gx + (v - rdj) * gy) + (w - rdk) * gz;
+      noise += (rdi * uu + (1 - rdi) * (1 - uu)) *
+               (rdj * vv + (1 - rdj) * (1 - vv)) *
+               (rdk * ww + (1 - rdk) * (1 - ww)) * d;
+    }
+    for (int o = 0; o < lanes && first + o < depth; o++) {
+      accum += weight * noise[o];
+      weight *= 0.5;
+    }
+  }
+  return std::fabs(accum);
+}
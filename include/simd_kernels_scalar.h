@@ -0,0 +1,187 @@
+/**
+ * @file simd_kernels_scalar.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 热点函数的标量版本: 只使用普通的循环, 任何编译器与 CPU 都可以使用.
+ * 运算顺序与 simd_kernels_impl.h 中的向量版本相同, 因此结果逐位相同
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef SIMD_KERNELS_SCALAR_H
+#define SIMD_KERNELS_SCALAR_H
+
+#include <algorithm>
+#include <cmath>
+
+#include "rtweekend.h"
+
+// 与向量版本相同, 禁止把 a*b+c 合并为 fma
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace simd_scalar {
+
+// 参数与返回值见 simd_kernels_impl.h 中的同名函数
+inline int box_hit2(const real* box_min, const real* box_max, const real* orig,
+                    const real* inv_dir, real tmin, real tmax) {
+  int mask = 0;
+  for (int b = 0; b < 2; b++) {
+    real near = tmin, far = tmax;
+    for (int a = b * 4; a < b * 4 + 3; a++) {
+      real lo = (box_min[a] - orig[a]) * inv_dir[a];
+      real hi = (box_max[a] - orig[a]) * inv_dir[a];
+      bool neg = inv_dir[a] < 0;
+      real t0 = neg ? hi : lo;
+      real t1 = neg ? lo : hi;
+      if (t0 > near) near = t0;
+      if (t1 < far) far = t1;
+    }
+    if (near < far) mask |= 1 << b;
+  }
+  return mask;
+}
+
+inline int sphere_hit_n(const real* const center[3],
+                        const real* const motion[3], const real* radius,
+                        int count, const real* orig, const real* dir, real time,
+                        real tmin, real tmax, real* t_hit) {
+  real a = (dir[0] * dir[0] + dir[1] * dir[1]) + dir[2] * dir[2];
+  int best = -1;
+  real best_t = tmax;
+  for (int k = 0; k < count; k++) {
+    real ocx = orig[0] - (center[0][k] + time * motion[0][k]);
+    real ocy = orig[1] - (center[1][k] + time * motion[1][k]);
+    real ocz = orig[2] - (center[2][k] + time * motion[2][k]);
+    real r = radius[k];
+    real half_b = (ocx * dir[0] + ocy * dir[1]) + ocz * dir[2];
+    real c = ((ocx * ocx + ocy * ocy) + ocz * ocz) - r * r;
+    real discriminant = half_b * half_b - a * c;
+    bool has_root = discriminant >= 0;
+    real sqrtd = std::sqrt(has_root ? discriminant : real(0));
+
+    real root1 = (-half_b - sqrtd) / a;
+    real root2 = (-half_b + sqrtd) / a;
+    real root = (tmin < root1 && root1 < tmax) ? root1 : root2;
+    bool ok = has_root && tmin < root && root < tmax;
+    if (ok && root < best_t) {
+      best_t = root;
+      best = k;
+    }
+  }
+  *t_hit = best_t;
+  return best;
+}
+
+inline int quad_hit_n(const real* const q[3], const real* const u[3],
+                      const real* const v[3], int count, const real* orig,
+                      const real* dir, real tmin, real tmax, real* t_hit) {
+  real dx = dir[0], dy = dir[1], dz = dir[2];
+  int best = -1;
+  real best_t = tmax;
+  for (int k = 0; k < count; k++) {
+    real ux = u[0][k], uy = u[1][k], uz = u[2][k];
+    real vx = v[0][k], vy = v[1][k], vz = v[2][k];
+    real px = dy * vz - dz * vy;
+    real py = dz * vx - dx * vz;
+    real pz = dx * vy - dy * vx;
+    real tx = orig[0] - q[0][k];
+    real ty = orig[1] - q[1][k];
+    real tz = orig[2] - q[2][k];
+    real qqx = ty * uz - tz * uy;
+    real qqy = tz * ux - tx * uz;
+    real qqz = tx * uy - ty * ux;
+
+    float det = static_cast<float>((px * ux + py * uy) + pz * uz);
+    float uu = static_cast<float>((tx * px + ty * py) + tz * pz);
+    float vv = static_cast<float>((dx * qqx + dy * qqy) + dz * qqz);
+    float t = static_cast<float>((vx * qqx + vy * qqy) + vz * qqz);
+    float f_inv_det = 1.0f / det;
+    t *= f_inv_det;
+    uu *= f_inv_det;
+    vv *= f_inv_det;
+    real t_real = t;
+    bool inside = uu >= 0 && vv >= 0 && uu <= 1.0f && vv <= 1.0f;
+    if (inside && tmin <= t_real && t_real <= best_t) {
+      best_t = t_real;
+      best = k;
+    }
+  }
+  *t_hit = best_t;
+  return best;
+}
+
+inline real perlin_blend(const real* gx, const real* gy, const real* gz, real u,
+                         real v, real w) {
+  auto uu = u * u * (3 - 2 * u);
+  auto vv = v * v * (3 - 2 * v);
+  auto ww = w * w * (3 - 2 * w);
+  real accum = 0;
+  for (int l = 0; l < 8; l++) {
+    real di = real(l >> 2), dj = real((l >> 1) & 1), dk = real(l & 1);
+    real d = ((u - di) * gx[l] + (v - dj) * gy[l]) + (w - dk) * gz[l];
+    accum += (di * uu + (1 - di) * (1 - uu)) * (dj * vv + (1 - dj) * (1 - vv)) *
+             (dk * ww + (1 - dk) * (1 - ww)) * d;
+  }
+  return accum;
+}
+
+// 向下取整, 同时返回整数部分. 与 std::floor 相同, 要求 |x| < 2^31
+inline real perlin_floor(real x, int& ix) {
+  ix = static_cast<int>(x);  // 向 0 取整
+  if (real(ix) > x) ix--;
+  return real(ix);
+}
+
+inline double perlin_turb(const int* perm, const real* gradient,
+                          const real* p, int depth, int period) {
+  double accum = 0.0;
+  double weight = 1.0;
+  real scale = 1;
+  int wrap = period;
+  for (int o = 0; o < depth; o++) {
+    int mask = wrap - 1;
+    real x = scale * p[0], y = scale * p[1], z = scale * p[2];
+    scale *= 2;
+    wrap = std::min(wrap * 2, 256);
+    int ix, iy, iz;
+    real u = x - perlin_floor(x, ix);
+    real v = y - perlin_floor(y, iy);
+    real w = z - perlin_floor(z, iz);
+    u = u * u * (3 - 2 * u);
+    v = v * v * (3 - 2 * v);
+    w = w * w * (3 - 2 * w);
+    real uu = u * u * (3 - 2 * u);
+    real vv = v * v * (3 - 2 * v);
+    real ww = w * w * (3 - 2 * w);
+
+    real noise = 0;
+    for (int l = 0; l < 8; l++) {
+      int di = l >> 2, dj = (l >> 1) & 1, dk = l & 1;
+      int index = perm[(ix + di) & mask] ^ perm[256 + ((iy + dj) & mask)] ^
+                  perm[512 + ((iz + dk) & mask)];
+      real gx = gradient[index];
+      real gy = gradient[256 + index];
+      real gz = gradient[512 + index];
+      real rdi = real(di), rdj = real(dj), rdk = real(dk);
+      real d = ((u - rdi) * gx + (v - rdj) * gy) + (w - rdk) * gz;
+      noise += (rdi * uu + (1 - rdi) * (1 - uu)) *
+               (rdj * vv + (1 - rdj) * (1 - vv)) *
+               (rdk * ww + (1 - rdk) * (1 - ww)) * d;
+    }
+    accum += weight * noise;
+    weight *= 0.5;
+  }
+  return std::fabs(accum);
+}
+
+}  // namespace simd_scalar
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+#endif
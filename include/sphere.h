@@ -13,6 +13,7 @@
 
 #include "hittable.h"
 #include "material.h"
+#include "render_stats.h"
 #include "vec3.h"
 /**
  * @brief 球类
@@ -53,6 +54,7 @@ class sphere : public hittable {
    * @return false
    */
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    RTW_STAT_INC(sphere_tests);
     point3 center = is_moving ? (sphere_center(r.time())) : (center1);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
@@ -83,6 +85,8 @@ class sphere : public hittable {
     rec.set_face_normal(r, outward_normal);
 
     get_sphere_uv(outward_normal, rec.u, rec.v);
+    // u 绕一周, v 从南极到北极
+    rec.set_footprint(r, 2 * pi * std::fabs(radius), pi * std::fabs(radius));
 
     rec.mat = mat;
 
@@ -91,9 +95,18 @@ class sphere : public hittable {
 
   aabb bounding_box() const override { return bbox; }
 
+  batch_data get_batch_data() const override {
+    batch_data data;
+    data.kind = batch_data::sphere;
+    data.center = center1;
+    if (is_moving) data.motion = center_vec;
+    data.radius = radius;
+    return data;
+  }
+
  private:
   point3 center1;            // 球的0时刻中心点
-  double radius;             // 球的半径
+  real radius;               // 球的半径
   shared_ptr<material> mat;  // 球的表面材料
   bool is_moving;            // 球是否可以运行
   vec3 center_vec;           // 球的运动方向
@@ -103,7 +116,7 @@ class sphere : public hittable {
     return center1 + time * center_vec;
   }
   // 计算球上一点p的纹理坐标(u,v)
-  static void get_sphere_uv(const point3& p, double& u, double& v) {
+  static void get_sphere_uv(const point3& p, real& u, real& v) {
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
     // v: returned value [0,1] of angle from Y=-1 to Y=+1.
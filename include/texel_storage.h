@@ -0,0 +1,316 @@
+/**
+ * @file texel_storage.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 图片纹理的像素存储: 按 Morton 序排列的分块布局与预先转换的浮点像素
+ * @version 0.1
+ * @date 2023-09-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TEXEL_STORAGE_H
+#define TEXEL_STORAGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "color.h"
+#include "rtweekend.h"
+
+// 像素的存储格式, 每个像素都补齐为 4 个通道
+enum class texel_format {
+  rgb8,     // 8 位整数, 采样时再乘以 1/255
+  half,     // 预先除以 255 的半精度浮点数
+  float32,  // 预先除以 255 的单精度浮点数
+};
+
+// 像素的排列方式
+enum class texel_layout {
+  linear,  // 按行排列, 与 stb_image 的输出相同
+  tiled,   // 8x8 的块按行排列, 块内按 Morton 序排列
+};
+
+inline const char* texel_format_name(texel_format format) {
+  switch (format) {
+    case texel_format::rgb8:
+      return "rgb8";
+    case texel_format::half:
+      return "half";
+    default:
+      return "float";
+  }
+}
+
+inline const char* texel_layout_name(texel_layout layout) {
+  return layout == texel_layout::tiled ? "tiled" : "linear";
+}
+
+inline bool parse_texel_format(const std::string& name, texel_format& format) {
+  for (auto f :
+       {texel_format::rgb8, texel_format::half, texel_format::float32}) {
+    if (name == texel_format_name(f)) {
+      format = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool parse_texel_layout(const std::string& name, texel_layout& layout) {
+  for (auto l : {texel_layout::linear, texel_layout::tiled}) {
+    if (name == texel_layout_name(l)) {
+      layout = l;
+      return true;
+    }
+  }
+  return false;
+}
+
+// 默认与 stb_image 的输出相同. 纹理能放进缓存时按行存储 8 位像素最快,
+// 纹理远大于缓存时可以改用分块布局与预先转换的浮点像素
+struct texel_storage_options {
+  texel_format format = texel_format::rgb8;
+  texel_layout layout = texel_layout::linear;
+};
+
+// 之后加载的图片纹理默认使用的存储方式, 只能在构建场景之前修改
+inline texel_storage_options& default_texel_storage() {
+  static texel_storage_options options;
+  return options;
+}
+
+// 单精度浮点数转换为半精度, 就近舍入到偶数
+inline std::uint16_t float_to_half(float f) {
+  std::uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  std::uint32_t sign = (x >> 16) & 0x8000u;
+  std::uint32_t mantissa = x & 0x7fffffu;
+  int exponent = static_cast<int>((x >> 23) & 0xff);
+  if (exponent == 0xff) return sign | 0x7c00u | (mantissa ? 0x200u : 0);
+  exponent += 15 - 127;
+  if (exponent >= 31) return sign | 0x7c00u;  // 溢出为无穷大
+  int shift = 13;
+  std::uint32_t h;
+  if (exponent <= 0) {
+    // 非规格化数
+    if (exponent < -10) return static_cast<std::uint16_t>(sign);
+    mantissa |= 0x800000u;
+    shift = 14 - exponent;
+    h = mantissa >> shift;
+  } else {
+    h = (std::uint32_t(exponent) << 10) | (mantissa >> shift);
+  }
+  std::uint32_t rest = mantissa & ((1u << shift) - 1);
+  std::uint32_t halfway = 1u << (shift - 1);
+  // 进位可能进到指数位, 结果仍然正确
+  if (rest > halfway || (rest == halfway && (h & 1))) h++;
+  return static_cast<std::uint16_t>(sign | h);
+}
+
+// 半精度浮点数转换为单精度
+inline float half_to_float(std::uint16_t h) {
+  std::uint32_t sign = std::uint32_t(h & 0x8000u) << 16;
+  std::uint32_t exponent = (h >> 10) & 0x1f;
+  std::uint32_t mantissa = h & 0x3ffu;
+  std::uint32_t x;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      x = sign;
+    } else {
+      // 非规格化数: 规格化后存为单精度
+      exponent = 127 - 15 + 1;
+      while (!(mantissa & 0x400u)) {
+        mantissa <<= 1;
+        exponent--;
+      }
+      x = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+  } else if (exponent == 31) {
+    x = sign | 0x7f800000u | (mantissa << 13);
+  } else {
+    x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/**
+ * @brief 一张图片(mip 金字塔的一层)的像素. 分块布局下 8x8 的块占连续内存,
+ * 块内 Morton 序使 2x2 的相邻像素落在同一条(单精度时)或同一个(其他格式时)
+ * 缓存行中, 双线性插值与相邻光线的采样访问的缓存行与页更少
+ *
+ */
+class texel_grid {
+ public:
+  static constexpr int tile_bits = 3;  // 块的边长为 2^3
+  static constexpr int tile_size = 1 << tile_bits;
+
+  texel_grid() {}
+
+  /**
+   * @brief 由 8 位 RGB 图像构建
+   *
+   * @param rgb 按行存放的像素, 每个像素 3 个字节
+   * @param w 图像的宽
+   * @param h 图像的高
+   * @param options 存储格式与排列方式
+   */
+  void assign(const unsigned char* rgb, int w, int h,
+              texel_storage_options options) {
+    width = w;
+    height = h;
+    format = options.format;
+    layout = options.layout;
+    tiles_x = (w + tile_size - 1) >> tile_bits;
+    size_t count = layout == texel_layout::tiled
+                       ? size_t(tiles_x) * ((h + tile_size - 1) >> tile_bits) *
+                             tile_size * tile_size
+                       : size_t(w) * h;
+    size_t bytes = count * texel_bytes();
+    blocks.assign((bytes + sizeof(block) - 1) / sizeof(block), block());
+
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        const unsigned char* pixel = rgb + (size_t(y) * w + x) * 3;
+        size_t k = index(x, y);
+        for (int c = 0; c < 3; c++) {
+          float value = static_cast<float>(pixel[c] / 255.0);
+          switch (format) {
+            case texel_format::rgb8:
+              data<unsigned char>()[k * 4 + c] = pixel[c];
+              break;
+            case texel_format::half:
+              data<std::uint16_t>()[k * 4 + c] = float_to_half(value);
+              break;
+            default:
+              data<float>()[k * 4 + c] = value;
+          }
+        }
+      }
+    }
+  }
+
+  int grid_width() const { return width; }
+  int grid_height() const { return height; }
+  size_t memory_bytes() const { return blocks.size() * sizeof(block); }
+
+  // 像素 (x,y) 的颜色, 边界外的像素取边界值
+  color fetch(int x, int y) const {
+    switch (format) {
+      case texel_format::rgb8:
+        return fetch_as<unsigned char>(x, y);
+      case texel_format::half:
+        return fetch_as<std::uint16_t>(x, y);
+      default:
+        return fetch_as<float>(x, y);
+    }
+  }
+
+  // 最近邻采样, s,t 为 [0,1] 内的图像坐标(t 向下)
+  color nearest(double s, double t) const {
+    return fetch(static_cast<int>(s * width), static_cast<int>(t * height));
+  }
+
+  // 双线性插值, 对存储格式只分派一次
+  color bilinear(double s, double t) const {
+    switch (format) {
+      case texel_format::rgb8:
+        return bilinear_as<unsigned char>(s, t);
+      case texel_format::half:
+        return bilinear_as<std::uint16_t>(s, t);
+      default:
+        return bilinear_as<float>(s, t);
+    }
+  }
+
+ private:
+  struct alignas(64) block {
+    unsigned char bytes[64] = {};
+  };
+
+  std::vector<block> blocks;  // 按缓存行对齐的存储
+  int width = 0, height = 0;
+  int tiles_x = 0;  // 每行的块数
+  texel_format format = texel_format::rgb8;
+  texel_layout layout = texel_layout::linear;
+
+  size_t texel_bytes() const {
+    switch (format) {
+      case texel_format::rgb8:
+        return 4;
+      case texel_format::half:
+        return 8;
+      default:
+        return 16;
+    }
+  }
+
+  template <typename T>
+  T* data() {
+    return reinterpret_cast<T*>(blocks.data());
+  }
+  template <typename T>
+  const T* data() const {
+    return reinterpret_cast<const T*>(blocks.data());
+  }
+
+  // 块内坐标 (x,y) 的 Morton 码: 位交错为 y2 x2 y1 x1 y0 x0
+  static size_t tile_morton(int x, int y) {
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) |
+           ((x & 4) << 2) | ((y & 4) << 3);
+  }
+
+  size_t index(int x, int y) const {
+    if (layout == texel_layout::linear) return size_t(y) * width + x;
+    size_t tile = size_t(y >> tile_bits) * tiles_x + (x >> tile_bits);
+    return (tile << (2 * tile_bits)) |
+           tile_morton(x & (tile_size - 1), y & (tile_size - 1));
+  }
+
+  // 把一个像素转换为 [0,1] 内的颜色
+  template <typename T>
+  static color to_color(const T* texel) {
+    if constexpr (std::is_same<T, unsigned char>::value) {
+      auto color_scale = 1.0 / 255.0;
+      return color(color_scale * texel[0], color_scale * texel[1],
+                   color_scale * texel[2]);
+    } else if constexpr (std::is_same<T, std::uint16_t>::value) {
+      return color(half_to_float(texel[0]), half_to_float(texel[1]),
+                   half_to_float(texel[2]));
+    } else {
+      return color(texel[0], texel[1], texel[2]);
+    }
+  }
+
+  int clamp_x(int x) const { return std::min(std::max(x, 0), width - 1); }
+  int clamp_y(int y) const { return std::min(std::max(y, 0), height - 1); }
+
+  template <typename T>
+  color fetch_as(int x, int y) const {
+    return to_color(data<T>() + index(clamp_x(x), clamp_y(y)) * 4);
+  }
+
+  template <typename T>
+  color bilinear_as(double s, double t) const {
+    double x = s * width - 0.5;
+    double y = t * height - 0.5;
+    int xi = static_cast<int>(std::floor(x));
+    int yi = static_cast<int>(std::floor(y));
+    double fx = x - xi, fy = y - yi;
+    int x0 = clamp_x(xi), x1 = clamp_x(xi + 1);
+    int y0 = clamp_y(yi), y1 = clamp_y(yi + 1);
+    const T* d = data<T>();
+    return (1 - fy) * ((1 - fx) * to_color(d + index(x0, y0) * 4) +
+                       fx * to_color(d + index(x1, y0) * 4)) +
+           fy * ((1 - fx) * to_color(d + index(x0, y1) * 4) +
+                 fx * to_color(d + index(x1, y1) * 4));
+  }
+};
+
+#endif
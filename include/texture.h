@@ -10,16 +10,43 @@
  */
 #ifndef TEXTURE_H
 #define TEXTURE_H
+#include "asset_cache.h"
+#include "mipmap.h"
 #include "perlin.h"
 #include "rtw_stb_image.h"
 #include "rtweekend.h"
+#include "turbulence_volume.h"
+
+class texture;
+
+/**
+ * @brief 纹理的描述, 用于把纹理树编译为 texture_program.
+ * 内置纹理填写各自的参数, 其他纹理为 other, 编译后仍通过虚函数求值
+ *
+ */
+struct texture_node {
+  enum kind_t { other, solid, checker, noise, image };
+  kind_t kind = other;
+  color value;                    // solid: 颜色
+  double inv_scale = 0;           // checker: 格子大小的倒数
+  const texture* even = nullptr;  // checker: 偶数格子与奇数格子的纹理
+  const texture* odd = nullptr;
+};
 
 // 纹理类
 class texture {
  public:
   virtual ~texture() = default;
+  // 纹理的描述, 默认为 other
+  virtual texture_node describe() const { return texture_node(); }
   // 得到空间坐标位置为p, 纹理坐标为(u,v)处的颜色值
   virtual color value(double u, double v, const point3& p) const = 0;
+  // 带有覆盖范围的采样: du, dv 为光线在交点处覆盖的纹理坐标范围,
+  // 可以据此做预滤波. 默认忽略覆盖范围
+  virtual color filtered_value(double u, double v, const point3& p, double du,
+                               double dv) const {
+    return value(u, v, p);
+  }
 };
 
 // 一个简单的纹理类
@@ -35,6 +62,13 @@ class solid_color : public texture {
     return color_value;
   }
 
+  texture_node describe() const override {
+    texture_node node;
+    node.kind = texture_node::solid;
+    node.value = color_value;
+    return node;
+  }
+
  private:
   color color_value;
 };
@@ -52,15 +86,27 @@ class checker_texture : public texture {
         odd(make_shared<solid_color>(c2)) {}
 
   color value(double u, double v, const point3& p) const override {
+    // 尝试使用参数 u,v
+    // isEven = static_cast<int>(u * 100 + v * 100) % 2;
+    return is_even(inv_scale, p) ? even->value(u, v, p) : odd->value(u, v, p);
+  }
+
+  texture_node describe() const override {
+    texture_node node;
+    node.kind = texture_node::checker;
+    node.inv_scale = inv_scale;
+    node.even = even.get();
+    node.odd = odd.get();
+    return node;
+  }
+
+  // p 是否落在偶数格子中
+  static bool is_even(double inv_scale, const point3& p) {
     auto xInteger = static_cast<int>(std::floor(inv_scale * p.x()));
     auto yInteger = static_cast<int>(std::floor(inv_scale * p.y()));
     auto zInteger = static_cast<int>(std::floor(inv_scale * p.z()));
     // 得到一个网格类型的纹理
-    bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
-    // 尝试使用参数 u,v
-    // isEven = static_cast<int>(u * 100 + v * 100) % 2;
-
-    return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+    return (xInteger + yInteger + zInteger) % 2 == 0;
   }
 
  private:
@@ -72,12 +118,21 @@ class checker_texture : public texture {
 // 图片纹理类
 class image_texture : public texture {
  public:
-  image_texture(const char* filename) : image(filename) {}
+  // 同一个文件的图片与 mip 金字塔由 asset_cache 共享, 只在第一次使用时加载
+  image_texture(const char* filename,
+                texture_filter _filter = texture_filter::trilinear)
+      : mips(asset_cache::instance().pyramid(filename)), filter(_filter) {}
 
-  // 获取图片 image 在二维局部坐标(u,v)下的颜色值
+  // 获取图片在二维局部坐标(u,v)下的颜色值, 不做预滤波
   color value(double u, double v, const point3& p) const override {
+    return filtered_value(u, v, p, 0, 0);
+  }
+
+  // 按覆盖范围 du, dv 在 mip 金字塔上做三线性滤波
+  color filtered_value(double u, double v, const point3& p, double du,
+                       double dv) const override {
     // If we have no texture data, then return solid cyan as a debugging aid.
-    if (image.height() <= 0) return color(0, 1, 1);
+    if (mips->level_count() == 0) return color(0, 1, 1);
 
     // Clamp input texture coordinates to [0,1] x [1,0]
 
@@ -85,32 +140,76 @@ class image_texture : public texture {
     u = interval(0, 1).clamp(u);
     v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
 
-    auto i = static_cast<int>(u * image.width());
-    auto j = static_cast<int>(v * image.height());
-    auto pixel = image.pixel_data(i, j);
+    switch (filter) {
+      case texture_filter::nearest:
+        return mips->nearest(u, v);
+      case texture_filter::bilinear:
+        return mips->bilinear(0, u, v);
+      default:
+        // 覆盖范围换算为第 0 层的像素数, 取两个方向中较大的一个
+        return mips->trilinear(
+            u, v, std::fmax(du * mips->width(), dv * mips->height()));
+    }
+  }
 
-    auto color_scale = 1.0 / 255.0;
-    return color(color_scale * pixel[0], color_scale * pixel[1],
-                 color_scale * pixel[2]);
+  texture_node describe() const override {
+    texture_node node;
+    node.kind = texture_node::image;
+    return node;
   }
 
  private:
-  rtw_image image;
+  std::shared_ptr<const mip_pyramid> mips;
+  texture_filter filter;
 };
 
 // perlin noise 纹理类
 class noise_texture : public texture {
  public:
-  noise_texture() {}
-  noise_texture(double sc) : scale(sc) {}
+  noise_texture() { set_turbulence(default_turbulence()); }
+  noise_texture(double sc) : scale(sc) { set_turbulence(default_turbulence()); }
+  // 使用种子为 seed 的 perlin 表, 种子相同的噪声纹理共享同一份表
+  noise_texture(double sc, std::uint32_t seed) : noise(seed), scale(sc) {
+    set_turbulence(default_turbulence());
+  }
 
   color value(double u, double v, const point3& p) const override {
     return color(1, 1, 1) * 0.5 *
-           (1 + sin(scale * p.z() + 10 * noise.turb(scale * p)));
+           (1 + sin(scale * p.z() + 10 * turb(scale * p)));
+  }
+
+  texture_node describe() const override {
+    texture_node node;
+    node.kind = texture_node::noise;
+    return node;
   }
 
  private:
   perlin noise;  // perlin noise 对象
   double scale;  // 用于调整 noise 块大小的参数
+  turbulence_mode mode = turbulence_mode::exact;
+  int period = 256, depth = 7;
+  shared_ptr<const turbulence_volume> baked;  // baked 模式下烘焙的紊流
+
+  void set_turbulence(const turbulence_options& options) {
+    mode = options.mode;
+    if (mode == turbulence_mode::exact) return;
+    period = options.period;
+    depth = options.depth;
+    if (mode == turbulence_mode::baked) {
+      baked = turbulence_volume::shared(noise, options);
+    }
+  }
+
+  double turb(const point3& p) const {
+    switch (mode) {
+      case turbulence_mode::periodic:
+        return noise.periodic_turb(p, depth, period);
+      case turbulence_mode::baked:
+        return baked->lookup(p);
+      default:
+        return noise.turb(p);
+    }
+  }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,241 @@
+/**
+ * @file texture_program.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 纹理树的编译: 把嵌套的纹理展开为一个扁平的指令数组, 由一个不使用栈的
+ * 循环求值
+ * @version 0.1
+ * @date 2023-09-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TEXTURE_PROGRAM_H
+#define TEXTURE_PROGRAM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "color.h"
+#include "rtweekend.h"
+#include "texture.h"
+
+// 纹理指令的操作码
+enum class texture_op : std::uint8_t {
+  constant,          // 返回常量颜色
+  checker,           // 偶数格子继续执行下一条指令, 奇数格子跳转到 odd
+  checker_constant,  // 两种格子都是常量颜色的网格纹理, 直接返回其中一个
+  noise,             // noise_texture, 不经过虚函数
+  image,             // image_texture, 不经过虚函数
+  other,             // 其他纹理, 通过虚函数求值
+};
+
+/**
+ * @brief 一条纹理指令. 纹理树按先序展开, 网格纹理的偶数子树紧跟在网格指令
+ * 之后, 奇数子树从 odd 开始. 每条路径都以一条返回颜色的指令结束,
+ * 因此求值时只需要一个指令下标, 不需要栈
+ *
+ */
+struct texture_instruction {
+  texture_op op = texture_op::constant;
+  bool filtered = false;  // image/other: 是否按覆盖范围滤波
+  int odd = 0;            // checker: 奇数格子的子程序的下标
+  double inv_scale = 0;   // checker/checker_constant: 格子大小的倒数
+  color even_color;       // constant 的颜色, checker_constant 偶数格子的颜色
+  color odd_color;        // checker_constant 奇数格子的颜色
+  const texture* tex = nullptr;  // noise/image/other: 求值的纹理
+};
+
+/**
+ * @brief 编译后的纹理. 编译时折叠常量:
+ * 1. solid_color 内联为 constant 指令;
+ * 2. 两种格子都折叠为常量的网格纹理变为 checker_constant, 颜色相同时变为
+ *    constant;
+ * 3. 两种格子是同一个纹理的网格纹理只保留这个纹理;
+ * 4. 嵌套的网格纹理与外层的格子大小相同时, 内层的奇偶已知, 只保留对应的一支.
+ * 指令只保存纹理的裸指针, 纹理树需要比 texture_program 活得更久.
+ * 求值结果与直接调用纹理树的 filtered_value/value 逐位相同
+ *
+ */
+class texture_program {
+ public:
+  texture_program() {}
+
+  /**
+   * @brief 编译纹理树
+   *
+   * @param root 纹理树的根
+   * @param filtered 为 true 时与 root->filtered_value 相同, 否则与
+   * root->value 相同(忽略覆盖范围)
+   */
+  explicit texture_program(const texture* root, bool filtered = true) {
+    compile(root, filtered);
+  }
+
+  void compile(const texture* root, bool filtered = true) {
+    code.clear();
+    std::vector<parity> known;
+    emit(root, filtered, known);
+  }
+
+  int size() const { return static_cast<int>(code.size()); }
+  const std::vector<texture_instruction>& instructions() const { return code; }
+
+  // 与 filtered_value 相同的求值, 编译时 filtered 为 false 的纹理忽略 du, dv
+  color evaluate(double u, double v, const point3& p, double du,
+                 double dv) const {
+    const texture_instruction* in = code.data();
+    for (;;) {
+      switch (in->op) {
+        case texture_op::constant:
+          return in->even_color;
+        case texture_op::checker:
+          in = checker_texture::is_even(in->inv_scale, p) ? in + 1
+                                                          : &code[in->odd];
+          break;
+        case texture_op::checker_constant:
+          return checker_texture::is_even(in->inv_scale, p) ? in->even_color
+                                                            : in->odd_color;
+        default:
+          return evaluate_leaf(*in, u, v, p, du, dv);
+      }
+    }
+  }
+
+  // 与 value 相同的求值
+  color evaluate(double u, double v, const point3& p) const {
+    return evaluate(u, v, p, 0, 0);
+  }
+
+ private:
+  // 外层网格纹理已经确定的奇偶
+  struct parity {
+    double inv_scale;
+    bool even;
+  };
+
+  std::vector<texture_instruction> code;
+
+  // noise/image/other 指令的求值. 不内联进 evaluate, 使网格纹理的循环保持
+  // 短小, 不为叶子的寄存器与栈帧付出代价
+#ifdef __GNUC__
+  __attribute__((noinline))
+#endif
+  static color
+  evaluate_leaf(const texture_instruction& in, double u, double v,
+                const point3& p, double du, double dv) {
+    switch (in.op) {
+      case texture_op::noise:
+        return static_cast<const noise_texture*>(in.tex)
+            ->noise_texture::value(u, v, p);
+      case texture_op::image:
+        return static_cast<const image_texture*>(in.tex)
+            ->image_texture::filtered_value(u, v, p, in.filtered ? du : 0,
+                                            in.filtered ? dv : 0);
+      default:
+        return in.filtered ? in.tex->filtered_value(u, v, p, du, dv)
+                           : in.tex->value(u, v, p);
+    }
+  }
+
+  // 外层已经确定了格子大小为 inv_scale 的奇偶时返回 true
+  static bool known_parity(const std::vector<parity>& known, double inv_scale,
+                           bool& even) {
+    for (const auto& k : known) {
+      if (k.inv_scale == inv_scale) {
+        even = k.even;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 纹理在已知的奇偶下是否为常量, 是则把颜色写入 c
+  static bool fold(const texture* t, std::vector<parity>& known, color& c) {
+    auto node = t->describe();
+    if (node.kind == texture_node::solid) {
+      c = node.value;
+      return true;
+    }
+    if (node.kind != texture_node::checker) return false;
+    bool even;
+    if (known_parity(known, node.inv_scale, even)) {
+      return fold(even ? node.even : node.odd, known, c);
+    }
+    color even_color, odd_color;
+    known.push_back({node.inv_scale, true});
+    bool even_constant = fold(node.even, known, even_color);
+    known.back().even = false;
+    bool odd_constant = even_constant && fold(node.odd, known, odd_color);
+    known.pop_back();
+    if (!odd_constant || !same_color(even_color, odd_color)) return false;
+    c = even_color;
+    return true;
+  }
+
+  static bool same_color(const color& a, const color& b) {
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+  }
+
+  // 按先序展开 t, 子树的每条路径都以返回颜色的指令结束
+  void emit(const texture* t, bool filtered, std::vector<parity>& known) {
+    texture_instruction in;
+    color c;
+    if (fold(t, known, c)) {
+      in.even_color = c;
+      code.push_back(in);
+      return;
+    }
+    auto node = t->describe();
+    switch (node.kind) {
+      case texture_node::checker: {
+        bool even;
+        if (known_parity(known, node.inv_scale, even)) {
+          // checker_texture::value 以 value 求子纹理, 不滤波
+          emit(even ? node.even : node.odd, false, known);
+          return;
+        }
+        if (node.even == node.odd) {
+          emit(node.even, false, known);
+          return;
+        }
+        color even_color, odd_color;
+        known.push_back({node.inv_scale, true});
+        bool even_constant = fold(node.even, known, even_color);
+        known.back().even = false;
+        bool odd_constant = fold(node.odd, known, odd_color);
+        known.pop_back();
+        in.inv_scale = node.inv_scale;
+        if (even_constant && odd_constant) {
+          in.op = texture_op::checker_constant;
+          in.even_color = even_color;
+          in.odd_color = odd_color;
+          code.push_back(in);
+          return;
+        }
+        in.op = texture_op::checker;
+        size_t index = code.size();
+        code.push_back(in);
+        known.push_back({node.inv_scale, true});
+        emit(node.even, false, known);
+        known.back().even = false;
+        code[index].odd = static_cast<int>(code.size());
+        emit(node.odd, false, known);
+        known.pop_back();
+        return;
+      }
+      case texture_node::noise:
+        in.op = texture_op::noise;
+        break;
+      case texture_node::image:
+        in.op = texture_op::image;
+        break;
+      default:
+        in.op = texture_op::other;
+    }
+    in.filtered = filtered;
+    in.tex = t;
+    code.push_back(in);
+  }
+};
+
+#endif
@@ -0,0 +1,791 @@
+/**
+ * @file tiled_texture.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 核外(out-of-core)纹理: 分块的磁盘纹理格式, 按需读入的共享块缓存
+ * @version 0.1
+ * @date 2023-09-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TILED_TEXTURE_H
+#define TILED_TEXTURE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "asset_cache.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "rtw_stb_image.h"
+#include "rtweekend.h"
+#include "texture.h"
+#include "trace.h"
+
+/*
+ * 磁盘格式(小端):
+ *   tiled_texture_header
+ *   tiled_level_header * level_count
+ *   按 4096 字节对齐的块数据: 逐层, 每层的块按行排列, 每块 32x32 个像素,
+ *   每个像素 4 字节(RGB + 1 字节填充), 块内按行排列. 每块恰好 4096 字节,
+ *   不足一块的边缘部分以边界像素填充
+ */
+struct tiled_texture_header {
+  char magic[8];                // "RTWTILE1"
+  std::uint32_t tile_size;      // 块的边长(像素)
+  std::uint32_t level_count;    // mip 层数
+  std::uint64_t source_size;    // 源图片文件的大小, 用于判断是否需要重新转换
+  std::int64_t source_mtime;    // 源图片文件的修改时间
+};
+
+struct tiled_level_header {
+  std::uint32_t width, height;    // 该层的宽高
+  std::uint32_t tiles_x, tiles_y;  // 每行/每列的块数
+  std::uint64_t offset;            // 该层第一个块在文件中的位置
+};
+
+static constexpr char tiled_texture_magic[8] = {'R', 'T', 'W', 'T',
+                                                'I', 'L', 'E', '1'};
+
+/**
+ * @brief 块缓存的统计信息
+ *
+ */
+struct tile_cache_stats {
+  std::uint64_t hits = 0;       // 块已在缓存中
+  std::uint64_t misses = 0;     // 从磁盘读入块
+  std::uint64_t evictions = 0;  // 为读入新块而替换的块
+  std::uint64_t bypasses = 0;   // 组内所有块都在使用, 读入临时缓冲区而不缓存
+  size_t budget_bytes = 0;      // 内存预算
+  size_t resident_tiles = 0;    // 当前缓存的块数
+};
+
+/**
+ * @brief 固定大小, 多线程共享的块缓存. 采用组相联结构: 块的键哈希到一个组,
+ * 每组 ways 个槽位. 查找只读取槽位的原子变量, 不加锁; 未命中时只在选择槽位时
+ * 锁住该组, 替换组内最久未使用且没有被任何线程使用的槽位(近似 LRU),
+ * 读盘在锁外进行
+ *
+ * 每个槽位的 pins 记录正在读取该块的线程数, 最高位表示正在替换.
+ * 替换者只有在 pins 为 0 时才能置位, 读者置位之后的读取会失败并重试
+ *
+ */
+class tile_cache {
+ public:
+  static constexpr int ways = 8;
+  static constexpr std::uint64_t empty_key = ~std::uint64_t(0);
+
+  /**
+   * @brief 构造块缓存
+   *
+   * @param budget 内存预算(字节), 至少为一组的大小
+   * @param tile_bytes 每块的字节数
+   */
+  tile_cache(size_t budget, size_t _tile_bytes)
+      : tile_bytes(_tile_bytes), budget_bytes(budget) {
+    size_t slot_count = std::max<size_t>(budget / tile_bytes, ways);
+    set_count = slot_count / ways;
+    slots = std::unique_ptr<slot[]>(new slot[set_count * ways]);
+    sets = std::unique_ptr<tile_set[]>(new tile_set[set_count]);
+    storage.resize(set_count * ways * tile_bytes);
+  }
+
+  tile_cache(const tile_cache&) = delete;
+  tile_cache& operator=(const tile_cache&) = delete;
+
+  /**
+   * @brief 使用键为 key 的块: 块不在缓存中时先调用 load(dst) 读入,
+   * 再调用 use(data). use 返回之前块不会被替换
+   *
+   * @param key 块的键, 不能为 empty_key
+   * @param load void load(unsigned char* dst), 读入 tile_bytes 字节
+   * @param use R use(const unsigned char* data)
+   */
+  template <typename Load, typename Use>
+  auto with_tile(std::uint64_t key, const Load& load, const Use& use) const {
+    size_t set_index = hash(key) % set_count;
+    tile_set& set = sets[set_index];
+    slot* first = &slots[set_index * ways];
+
+    while (true) {
+      // 无锁查找
+      for (int w = 0; w < ways; w++) {
+        if (first[w].key.load(std::memory_order_acquire) == key &&
+            pin(first[w], key)) {
+          set.hits.fetch_add(1, std::memory_order_relaxed);
+          return use_pinned(first[w], set_index * ways + w, use);
+        }
+      }
+
+      std::unique_lock<std::mutex> lock(set.mutex);
+      // 加锁期间其他线程可能已经读入了该块, 或者正在读入该块
+      bool loading = false;
+      for (int w = 0; w < ways; w++) {
+        if (first[w].key.load(std::memory_order_acquire) != key) continue;
+        if (pin(first[w], key)) {
+          lock.unlock();
+          set.hits.fetch_add(1, std::memory_order_relaxed);
+          return use_pinned(first[w], set_index * ways + w, use);
+        }
+        loading = true;
+      }
+      if (loading) {
+        // 等待读入完成后重新查找, 避免同一块被读入两次
+        lock.unlock();
+        std::this_thread::yield();
+        continue;
+      }
+
+      // 按最近使用时间从早到晚尝试替换, 空槽位的时间为 0
+      int order[ways];
+      for (int w = 0; w < ways; w++) order[w] = w;
+      std::sort(order, order + ways, [&](int a, int b) {
+        return first[a].last_use.load(std::memory_order_relaxed) <
+               first[b].last_use.load(std::memory_order_relaxed);
+      });
+      for (int w : order) {
+        slot& s = first[w];
+        std::uint32_t expected = 0;
+        if (!s.pins.compare_exchange_strong(expected, evicting,
+                                            std::memory_order_acquire)) {
+          continue;
+        }
+        if (s.key.load(std::memory_order_relaxed) != empty_key) {
+          set.evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        // 替换标记保持到读入完成, 期间其他线程无法使用该槽位,
+        // 因此可以在锁外读盘
+        s.key.store(key, std::memory_order_release);
+        s.last_use.store(tick.fetch_add(1, std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+        lock.unlock();
+        unsigned char* data = &storage[(set_index * ways + w) * tile_bytes];
+        load(data);
+        // 先为自己加一个引用再清除替换标记
+        s.pins.fetch_add(1, std::memory_order_relaxed);
+        s.pins.fetch_and(~evicting, std::memory_order_release);
+        set.misses.fetch_add(1, std::memory_order_relaxed);
+        auto result = use(static_cast<const unsigned char*>(data));
+        s.pins.fetch_sub(1, std::memory_order_release);
+        return result;
+      }
+      lock.unlock();
+
+      // 组内所有槽位都在使用, 读入线程自己的缓冲区
+      set.bypasses.fetch_add(1, std::memory_order_relaxed);
+      thread_local std::vector<unsigned char> scratch;
+      scratch.resize(tile_bytes);
+      load(scratch.data());
+      return use(static_cast<const unsigned char*>(scratch.data()));
+    }
+  }
+
+  tile_cache_stats stats() const {
+    tile_cache_stats st;
+    st.budget_bytes = budget_bytes;
+    for (size_t k = 0; k < set_count; k++) {
+      st.hits += sets[k].hits.load(std::memory_order_relaxed);
+      st.misses += sets[k].misses.load(std::memory_order_relaxed);
+      st.evictions += sets[k].evictions.load(std::memory_order_relaxed);
+      st.bypasses += sets[k].bypasses.load(std::memory_order_relaxed);
+    }
+    for (size_t k = 0; k < set_count * ways; k++) {
+      if (slots[k].key.load(std::memory_order_relaxed) != empty_key) {
+        st.resident_tiles++;
+      }
+    }
+    return st;
+  }
+
+  size_t capacity_bytes() const { return storage.size(); }
+
+ private:
+  static constexpr std::uint32_t evicting = 0x80000000u;
+
+  struct slot {
+    std::atomic<std::uint64_t> key{empty_key};
+    std::atomic<std::uint32_t> pins{0};
+    std::atomic<std::uint64_t> last_use{0};
+  };
+
+  // 每组的锁与统计, 按缓存行对齐以免不同组之间的伪共享
+  struct alignas(64) tile_set {
+    std::mutex mutex;
+    std::atomic<std::uint64_t> hits{0}, misses{0}, evictions{0}, bypasses{0};
+  };
+
+  size_t tile_bytes;
+  size_t budget_bytes;
+  size_t set_count;
+  std::unique_ptr<slot[]> slots;
+  std::unique_ptr<tile_set[]> sets;
+  mutable std::vector<unsigned char> storage;
+  // 槽位的最近使用时间只在读入新块时增加, 命中时只读取, 避免所有线程写同一个变量
+  mutable std::atomic<std::uint64_t> tick{0};
+
+  static std::uint64_t hash(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // 为读取加一个引用, 块正在被替换或已不是 key 时失败
+  static bool pin(slot& s, std::uint64_t key) {
+    auto p = s.pins.fetch_add(1, std::memory_order_acquire);
+    if (!(p & evicting) && s.key.load(std::memory_order_acquire) == key) {
+      return true;
+    }
+    s.pins.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+
+  template <typename Use>
+  auto use_pinned(slot& s, size_t index, const Use& use) const {
+    s.last_use.store(tick.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+    auto result =
+        use(static_cast<const unsigned char*>(&storage[index * tile_bytes]));
+    s.pins.fetch_sub(1, std::memory_order_release);
+    return result;
+  }
+};
+
+/**
+ * @brief 核外纹理的设置, 只能在构建场景之前修改
+ *
+ */
+struct out_of_core_options {
+  size_t budget_bytes = 0;  // 块缓存的内存预算, 为 0 时不使用核外纹理
+  std::string tile_dir = "tiled_textures";  // 转换后的分块纹理文件的目录
+};
+
+inline out_of_core_options& out_of_core_textures() {
+  static out_of_core_options options;
+  return options;
+}
+
+/**
+ * @brief 分块纹理文件. 打开时只读入文件头, 像素通过共享的块缓存按需读入
+ *
+ */
+class tiled_texture_file {
+ public:
+  static constexpr int tile_size = 32;
+  static constexpr size_t tile_bytes = size_t(tile_size) * tile_size * 4;
+
+  /**
+   * @brief 把 stb_image 能读取的图片转换为分块纹理文件(包括所有 mip 层)
+   *
+   * @param source_path 源图片路径
+   * @param out_path 输出路径
+   * @return true 转换成功
+   */
+  static bool convert(const std::string& source_path,
+                      const std::string& out_path) {
+    trace_scope scope("tiled_texture_file::convert", "texture");
+    rtw_image image;
+    if (!image.load(source_path)) return false;
+
+    tiled_texture_header header;
+    std::memcpy(header.magic, tiled_texture_magic, sizeof(header.magic));
+    header.tile_size = tile_size;
+    file_stamp(source_path, header.source_size, header.source_mtime);
+
+    // 先以 8 位整数逐层求平均, 与 mip_pyramid 相同
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<tiled_level_header> level_headers;
+    int w = image.width(), h = image.height();
+    const unsigned char* rgb = image.pixel_data(0, 0);
+    levels.emplace_back(rgb, rgb + size_t(w) * h * 3);
+    while (true) {
+      tiled_level_header l;
+      l.width = w;
+      l.height = h;
+      l.tiles_x = (w + tile_size - 1) / tile_size;
+      l.tiles_y = (h + tile_size - 1) / tile_size;
+      l.offset = 0;
+      level_headers.push_back(l);
+      if (w <= 1 && h <= 1) break;
+      levels.emplace_back();
+      downsample_rgb8(levels[levels.size() - 2], w, h, levels.back());
+      w = std::max(1, w / 2);
+      h = std::max(1, h / 2);
+    }
+    header.level_count = static_cast<std::uint32_t>(levels.size());
+
+    std::uint64_t offset = sizeof(header) +
+                           level_headers.size() * sizeof(tiled_level_header);
+    offset = (offset + 4095) / 4096 * 4096;
+    for (auto& l : level_headers) {
+      l.offset = offset;
+      offset += std::uint64_t(l.tiles_x) * l.tiles_y * tile_bytes;
+    }
+
+    // 先写到临时文件, 完整写出后再 rename, 中断的转换不会留下头部完整但
+    // 缺少块数据的文件
+    auto tmp_path = out_path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(level_headers.data()),
+              level_headers.size() * sizeof(tiled_level_header));
+    std::vector<char> padding(level_headers[0].offset -
+                              static_cast<std::uint64_t>(out.tellp()));
+    out.write(padding.data(), padding.size());
+
+    std::vector<unsigned char> tile(tile_bytes);
+    for (size_t k = 0; k < levels.size(); k++) {
+      const auto& l = level_headers[k];
+      for (std::uint32_t ty = 0; ty < l.tiles_y; ty++) {
+        for (std::uint32_t tx = 0; tx < l.tiles_x; tx++) {
+          for (int y = 0; y < tile_size; y++) {
+            for (int x = 0; x < tile_size; x++) {
+              int sx = std::min<int>(tx * tile_size + x, l.width - 1);
+              int sy = std::min<int>(ty * tile_size + y, l.height - 1);
+              const unsigned char* p =
+                  &levels[k][(size_t(sy) * l.width + sx) * 3];
+              unsigned char* q = &tile[(size_t(y) * tile_size + x) * 4];
+              q[0] = p[0];
+              q[1] = p[1];
+              q[2] = p[2];
+              q[3] = 0;
+            }
+          }
+          out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+        }
+      }
+    }
+    out.close();
+    if (!out) {
+      std::cerr << "ERROR: Could not write tiled texture '" << tmp_path
+                << "'.\n";
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+    if (std::rename(tmp_path.c_str(), out_path.c_str()) != 0) {
+      // 有的平台上 rename 不能覆盖已存在的文件
+      std::remove(out_path.c_str());
+      if (std::rename(tmp_path.c_str(), out_path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not rename '" << tmp_path << "' to '"
+                  << out_path << "'.\n";
+        std::remove(tmp_path.c_str());
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief 转换后的文件名: 源图片的文件名加上(绝对路径, 大小, 修改时间)的
+   * FNV-1a 哈希, 不同目录下的同名图片或修改后的图片不会共用同一个文件
+   *
+   * @param source_path 源图片路径
+   */
+  static std::string converted_name(const std::string& source_path) {
+    std::string path = source_path;
+#if defined(__unix__) || defined(__APPLE__)
+    if (char* full = ::realpath(source_path.c_str(), nullptr)) {
+      path = full;
+      std::free(full);
+    }
+#endif
+    std::uint64_t size;
+    std::int64_t mtime;
+    file_stamp(source_path, size, mtime);
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    auto mix = [&](const void* data, size_t bytes) {
+      auto* p = static_cast<const unsigned char*>(data);
+      for (size_t k = 0; k < bytes; k++) {
+        h ^= p[k];
+        h *= 0x100000001b3ull;
+      }
+    };
+    mix(path.data(), path.size());
+    mix(&size, sizeof(size));
+    mix(&mtime, sizeof(mtime));
+
+    std::ostringstream name;
+    name << source_path.substr(source_path.find_last_of("/\\") + 1) << '-'
+         << std::hex << std::setw(16) << std::setfill('0') << h << ".rtwt";
+    return name.str();
+  }
+
+  // 源图片文件是否与 path 处已转换的文件一致
+  static bool up_to_date(const std::string& source_path,
+                         const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    tiled_texture_header header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        !valid_header(header)) {
+      return false;
+    }
+    std::vector<tiled_level_header> level_headers(header.level_count);
+    if (!in.read(reinterpret_cast<char*>(level_headers.data()),
+                 level_headers.size() * sizeof(tiled_level_header)) ||
+        file_size(path) < data_end(level_headers)) {
+      return false;
+    }
+    std::uint64_t size;
+    std::int64_t mtime;
+    file_stamp(source_path, size, mtime);
+    return header.source_size == size && header.source_mtime == mtime;
+  }
+
+  tiled_texture_file(const tiled_texture_file&) = delete;
+  tiled_texture_file& operator=(const tiled_texture_file&) = delete;
+
+  /**
+   * @brief 打开分块纹理文件, 失败时没有任何层
+   *
+   * @param path 文件路径
+   * @param _cache 共享的块缓存
+   */
+  tiled_texture_file(const std::string& path, const tile_cache& _cache)
+      : cache(_cache) {
+    static std::atomic<std::uint32_t> next_id{0};
+    file_id = next_id.fetch_add(1);
+#if defined(__unix__) || defined(__APPLE__)
+    fd = ::open(path.c_str(), O_RDONLY);
+    bool ok = fd >= 0;
+#else
+    stream.open(path, std::ios::binary);
+    bool ok = static_cast<bool>(stream);
+#endif
+    tiled_texture_header header;
+    if (!ok || !read_at(0, &header, sizeof(header)) ||
+        !valid_header(header)) {
+      std::cerr << "ERROR: Could not open tiled texture '" << path << "'.\n";
+      return;
+    }
+    levels.resize(header.level_count);
+    if (!read_at(sizeof(header), levels.data(),
+                 levels.size() * sizeof(tiled_level_header)) ||
+        file_size(path) < data_end(levels)) {
+      std::cerr << "ERROR: Tiled texture '" << path << "' is truncated.\n";
+      levels.clear();
+    }
+  }
+
+  ~tiled_texture_file() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (fd >= 0) ::close(fd);
+#endif
+  }
+
+  int level_count() const { return static_cast<int>(levels.size()); }
+  int width() const { return levels.empty() ? 0 : levels[0].width; }
+  int height() const { return levels.empty() ? 0 : levels[0].height; }
+
+  // 第 0 层上的最近邻采样, s,t 为 [0,1] 内的图像坐标(t 向下)
+  color nearest(double s, double t) const {
+    const auto& l = levels[0];
+    int x = std::min(static_cast<int>(s * l.width), int(l.width) - 1);
+    int y = std::min(static_cast<int>(t * l.height), int(l.height) - 1);
+    color c;
+    with_texel_tile(0, x, y, [&](const unsigned char* tile) {
+      c = to_color(texel(tile, x, y));
+      return 0;
+    });
+    return c;
+  }
+
+  // 第 level 层上的双线性插值, 与 mip_pyramid 的结果逐位相同
+  color bilinear(int level_index, double s, double t) const {
+    const auto& l = levels[level_index];
+    double x = s * l.width - 0.5;
+    double y = t * l.height - 0.5;
+    int xi = static_cast<int>(std::floor(x));
+    int yi = static_cast<int>(std::floor(y));
+    double fx = x - xi, fy = y - yi;
+    int x0 = std::min(std::max(xi, 0), int(l.width) - 1);
+    int x1 = std::min(std::max(xi + 1, 0), int(l.width) - 1);
+    int y0 = std::min(std::max(yi, 0), int(l.height) - 1);
+    int y1 = std::min(std::max(yi + 1, 0), int(l.height) - 1);
+
+    color c00, c10, c01, c11;
+    if (x0 / tile_size == x1 / tile_size && y0 / tile_size == y1 / tile_size) {
+      // 四个像素在同一块中(大多数情况), 只访问一次缓存
+      with_texel_tile(level_index, x0, y0, [&](const unsigned char* tile) {
+        c00 = to_color(texel(tile, x0, y0));
+        c10 = to_color(texel(tile, x1, y0));
+        c01 = to_color(texel(tile, x0, y1));
+        c11 = to_color(texel(tile, x1, y1));
+        return 0;
+      });
+    } else {
+      c00 = fetch(level_index, x0, y0);
+      c10 = fetch(level_index, x1, y0);
+      c01 = fetch(level_index, x0, y1);
+      c11 = fetch(level_index, x1, y1);
+    }
+    return (1 - fy) * ((1 - fx) * c00 + fx * c10) +
+           fy * ((1 - fx) * c01 + fx * c11);
+  }
+
+  color trilinear(double s, double t, double footprint) const {
+    return trilinear_filter(level_count(), footprint, [&](int level) {
+      return bilinear(level, s, t);
+    });
+  }
+
+ private:
+  const tile_cache& cache;
+  std::uint32_t file_id = 0;  // 在块的键中区分不同的文件
+  std::vector<tiled_level_header> levels;
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = -1;
+#else
+  mutable std::ifstream stream;
+  mutable std::mutex stream_mutex;
+#endif
+
+  // 魔数与块大小正确, 层数在合理范围内(边长不超过 2^32)
+  static bool valid_header(const tiled_texture_header& header) {
+    return std::memcmp(header.magic, tiled_texture_magic, 8) == 0 &&
+           header.tile_size == tile_size && header.level_count > 0 &&
+           header.level_count <= 33;
+  }
+
+  // 最后一层最后一块的结束位置, 完整的文件至少有这么长
+  static std::uint64_t data_end(const std::vector<tiled_level_header>& l) {
+    if (l.empty()) return 0;
+    const auto& last = l.back();
+    return last.offset + std::uint64_t(last.tiles_x) * last.tiles_y * tile_bytes;
+  }
+
+  static std::uint64_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_size)
+                                        : 0;
+  }
+
+  static void file_stamp(const std::string& path, std::uint64_t& size,
+                         std::int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      size = static_cast<std::uint64_t>(st.st_size);
+      mtime = static_cast<std::int64_t>(st.st_mtime);
+    } else {
+      size = 0;
+      mtime = 0;
+    }
+  }
+
+  bool read_at(std::uint64_t offset, void* dst, size_t bytes) const {
+#if defined(__unix__) || defined(__APPLE__)
+    auto* out = static_cast<char*>(dst);
+    while (bytes > 0) {
+      auto n = ::pread(fd, out, bytes, static_cast<off_t>(offset));
+      if (n <= 0) return false;
+      out += n;
+      offset += n;
+      bytes -= n;
+    }
+    return true;
+#else
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    stream.seekg(offset);
+    return static_cast<bool>(
+        stream.read(static_cast<char*>(dst), static_cast<std::streamsize>(bytes)));
+#endif
+  }
+
+  // 块的键: 文件(16 位) | 层(8 位) | 块的行(20 位) | 块的列(20 位)
+  std::uint64_t tile_key(int level, int tx, int ty) const {
+    return (std::uint64_t(file_id & 0xffff) << 48) |
+           (std::uint64_t(level) << 40) | (std::uint64_t(ty) << 20) |
+           std::uint64_t(tx);
+  }
+
+  // 对像素 (x,y) 所在的块调用 use(tile)
+  template <typename Use>
+  void with_texel_tile(int level, int x, int y, const Use& use) const {
+    int tx = x / tile_size, ty = y / tile_size;
+    const auto& l = levels[level];
+    cache.with_tile(
+        tile_key(level, tx, ty),
+        [&](unsigned char* dst) {
+          std::uint64_t offset =
+              l.offset + (std::uint64_t(ty) * l.tiles_x + tx) * tile_bytes;
+          if (!read_at(offset, dst, tile_bytes)) {
+            std::memset(dst, 0, tile_bytes);
+          }
+        },
+        use);
+  }
+
+  static const unsigned char* texel(const unsigned char* tile, int x, int y) {
+    return tile + ((y % tile_size) * tile_size + (x % tile_size)) * 4;
+  }
+
+  static color to_color(const unsigned char* pixel) {
+    auto color_scale = 1.0 / 255.0;
+    return color(color_scale * pixel[0], color_scale * pixel[1],
+                 color_scale * pixel[2]);
+  }
+
+  color fetch(int level, int x, int y) const {
+    color c;
+    with_texel_tile(level, x, y, [&](const unsigned char* tile) {
+      c = to_color(texel(tile, x, y));
+      return 0;
+    });
+    return c;
+  }
+};
+
+// 所有核外纹理共享的块缓存, 第一次使用时按 out_of_core_textures() 的预算创建
+inline const tile_cache& shared_tile_cache() {
+  static tile_cache cache(out_of_core_textures().budget_bytes,
+                          tiled_texture_file::tile_bytes);
+  return cache;
+}
+
+/**
+ * @brief 核外图片纹理: 像素保存在分块纹理文件中, 采样时通过块缓存按需读入
+ *
+ */
+class tiled_image_texture : public texture {
+ public:
+  tiled_image_texture(std::shared_ptr<const tiled_texture_file> _file,
+                      texture_filter _filter = texture_filter::trilinear)
+      : file(std::move(_file)), filter(_filter) {}
+
+  color value(double u, double v, const point3& p) const override {
+    return filtered_value(u, v, p, 0, 0);
+  }
+
+  color filtered_value(double u, double v, const point3& p, double du,
+                       double dv) const override {
+    if (file->level_count() == 0) return color(0, 1, 1);
+
+    u = interval(0, 1).clamp(u);
+    v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
+
+    switch (filter) {
+      case texture_filter::nearest:
+        return file->nearest(u, v);
+      case texture_filter::bilinear:
+        return file->bilinear(0, u, v);
+      default:
+        return file->trilinear(
+            u, v, std::fmax(du * file->width(), dv * file->height()));
+    }
+  }
+
+ private:
+  std::shared_ptr<const tiled_texture_file> file;
+  texture_filter filter;
+};
+
+/**
+ * @brief 打开图片对应的分块纹理文件. 文件不存在或源图片已修改时先转换,
+ * 每个图片在进程内只转换并打开一次
+ *
+ * @param filename 图片文件名, 按 asset_cache 的规则查找
+ * @return 打开失败时为空
+ */
+inline std::shared_ptr<const tiled_texture_file> open_tiled_texture(
+    const std::string& filename) {
+  using file_ptr = std::shared_ptr<const tiled_texture_file>;
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_future<file_ptr>> files;
+  auto source = asset_cache::instance().resolve(filename);
+  // 与 asset_cache 相同: 同一个文件只由一个线程转换, 转换时不持有锁
+  std::promise<file_ptr> promise;
+  std::shared_future<file_ptr> existing;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find(source);
+    if (it != files.end()) {
+      existing = it->second;
+    } else {
+      files.emplace(source, promise.get_future().share());
+    }
+  }
+  if (existing.valid()) return existing.get();
+
+  const auto& dir = out_of_core_textures().tile_dir;
+#if defined(__unix__) || defined(__APPLE__)
+  ::mkdir(dir.c_str(), 0755);
+#endif
+  auto path = dir + "/" + tiled_texture_file::converted_name(source);
+  file_ptr file;
+  if (tiled_texture_file::up_to_date(source, path) ||
+      tiled_texture_file::convert(source, path)) {
+    file = std::make_shared<tiled_texture_file>(path, shared_tile_cache());
+  } else {
+    std::cerr << "ERROR: Could not convert image file '" << filename
+              << "' to a tiled texture.\n";
+  }
+  promise.set_value(file);
+  return file;
+}
+
+/**
+ * @brief 场景中创建图片纹理的入口: 设置了核外纹理的内存预算时使用分块纹理,
+ * 否则使用整张读入内存的 image_texture
+ *
+ */
+inline shared_ptr<texture> load_image_texture(const char* filename) {
+  if (out_of_core_textures().budget_bytes > 0) {
+    auto file = open_tiled_texture(filename);
+    if (file) return make_shared<tiled_image_texture>(file);
+  }
+  return make_shared<image_texture>(filename);
+}
+
+/**
+ * @brief 在构建场景之前并行准备场景中的图片: 使用核外纹理时转换并打开分块纹理
+ * 文件, 否则解码图片并构建 mip 金字塔
+ *
+ */
+inline void preload_image_textures(const std::vector<std::string>& filenames) {
+  if (out_of_core_textures().budget_bytes == 0) {
+    asset_cache::instance().preload(filenames);
+    return;
+  }
+  trace_scope scope("preload_image_textures", "texture");
+  parallel_for(static_cast<int>(filenames.size()), resolve_thread_count(0),
+               [&](int k, int) { open_tiled_texture(filenames[k]); });
+}
+
+// 输出块缓存的统计信息, 没有使用核外纹理时不输出
+inline void report_tile_cache(std::ostream& out) {
+  if (out_of_core_textures().budget_bytes == 0) return;
+  auto st = shared_tile_cache().stats();
+  auto lookups = st.hits + st.misses + st.bypasses;
+  out << "tile cache: budget " << st.budget_bytes / 1024 << " KB, "
+      << st.resident_tiles << " tiles resident, " << st.hits << " hits, "
+      << st.misses << " misses, " << st.evictions << " evictions, "
+      << st.bypasses << " bypasses, hit rate " << std::fixed
+      << std::setprecision(4)
+      << (lookups ? double(st.hits) / lookups : 0.0) << '\n';
+}
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file trace.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 轻量级的渲染阶段计时器, 输出 Chrome trace / Perfetto 可读的 JSON
+ * @version 0.1
+ * @date 2023-09-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 一个已结束的计时事件
+ *
+ */
+struct trace_event {
+  const char* name;     // 事件名, 必须是静态字符串
+  const char* category; // 事件类别
+  std::int64_t begin;   // 开始时刻(纳秒, 相对于 tracer 启用时刻)
+  std::int64_t end;     // 结束时刻(纳秒)
+  std::int64_t arg;     // 附加参数(如扫描行号), <0 表示没有
+};
+
+/**
+ * @brief 每个线程独占的环形缓冲区, 只有所属线程写入, 写满后覆盖最旧的事件
+ *
+ */
+class trace_buffer {
+ public:
+  trace_buffer(int _thread_id, size_t capacity)
+      : thread_id(_thread_id), events(capacity) {}
+
+  void push(const trace_event& e) {
+    events[count % events.size()] = e;
+    count++;
+  }
+
+  int thread_id;
+  std::vector<trace_event> events;
+  std::uint64_t count = 0;  // 写入过的事件总数
+};
+
+/**
+ * @brief 全局的 tracer. 线程第一次记录事件时注册自己的缓冲区(加锁),
+ * 之后记录事件不需要任何锁
+ *
+ */
+class tracer {
+ public:
+  static tracer& instance() {
+    static tracer t;
+    return t;
+  }
+
+  // 启用记录, capacity 为每个线程缓冲区可保存的事件数
+  void enable(size_t capacity = 1 << 16) {
+    buffer_capacity = capacity;
+    epoch = std::chrono::steady_clock::now();
+    active.store(true, std::memory_order_release);
+  }
+
+  bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+  // 距离启用时刻的纳秒数
+  std::int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+  // 当前线程的缓冲区. 线程结束时缓冲区(连同已记录的事件)放回空闲列表,
+  // 由之后新建的线程继续使用, 因此缓冲区数不超过同时记录事件的线程数
+  trace_buffer& thread_buffer() {
+    struct lease {
+      trace_buffer* buffer = nullptr;
+      ~lease() {
+        if (buffer) tracer::instance().release(buffer);
+      }
+    };
+    thread_local lease current;
+    if (!current.buffer) current.buffer = acquire();
+    return *current.buffer;
+  }
+
+  /**
+   * @brief 以 Chrome trace 格式写出所有线程记录的事件,
+   * 应在所有渲染线程结束后调用
+   *
+   * @param path 输出文件路径
+   */
+  void write_json(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+      std::clog << "ERROR: Could not write trace '" << path << "'.\n";
+      return;
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    // 时间以微秒为单位, 固定保留 3 位小数(纳秒)
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& buffer : buffers) {
+      out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": "
+          << "\"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+          << ", \"args\": {\"name\": \""
+          << (buffer->thread_id == 0 ? "main" : "worker") << ' '
+          << buffer->thread_id << "\"}}";
+      first = false;
+
+      size_t capacity = buffer->events.size();
+      std::uint64_t begin =
+          buffer->count > capacity ? buffer->count - capacity : 0;
+      for (std::uint64_t k = begin; k < buffer->count; k++) {
+        const auto& e = buffer->events[k % capacity];
+        out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_id
+            << ", \"ts\": " << e.begin / 1000.0
+            << ", \"dur\": " << (e.end - e.begin) / 1000.0;
+        if (e.arg >= 0) out << ", \"args\": {\"index\": " << e.arg << "}";
+        out << "}";
+      }
+    }
+    out << "\n]}\n";
+  }
+
+ private:
+  tracer() : epoch(std::chrono::steady_clock::now()) {}
+
+  std::atomic<bool> active{false};
+  size_t buffer_capacity = 1 << 16;
+  std::chrono::steady_clock::time_point epoch;
+  std::mutex registry_mutex;
+  std::vector<std::unique_ptr<trace_buffer>> buffers;
+  std::vector<trace_buffer*> free_buffers;  // 所属线程已结束的缓冲区
+
+  trace_buffer* acquire() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (!free_buffers.empty()) {
+      auto buffer = free_buffers.back();
+      free_buffers.pop_back();
+      return buffer;
+    }
+    buffers.push_back(std::make_unique<trace_buffer>(
+        static_cast<int>(buffers.size()), buffer_capacity));
+    return buffers.back().get();
+  }
+
+  void release(trace_buffer* buffer) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    free_buffers.push_back(buffer);
+  }
+};
+
+/**
+ * @brief 作用域计时: 构造时记录开始时刻, 析构时把事件写入当前线程的缓冲区.
+ * tracer 未启用时只有一次原子读
+ *
+ */
+class trace_scope {
+ public:
+  trace_scope(const char* name, const char* category, std::int64_t arg = -1,
+              bool condition = true)
+      : recording(condition && tracer::instance().enabled()) {
+    if (recording) event = {name, category, tracer::instance().now(), 0, arg};
+  }
+
+  ~trace_scope() {
+    if (!recording) return;
+    event.end = tracer::instance().now();
+    tracer::instance().thread_buffer().push(event);
+  }
+
+  trace_scope(const trace_scope&) = delete;
+  trace_scope& operator=(const trace_scope&) = delete;
+
+ private:
+  bool recording;
+  trace_event event;
+};
+
+#endif
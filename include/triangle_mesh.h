@@ -0,0 +1,322 @@
+/**
+ * @file triangle_mesh.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 带索引的三角形网格: SoA 存放的顶点属性, 每个网格自己的扁平 BVH,
+ * 以及水密的光线-三角形求交
+ * @version 0.1
+ * @date 2023-09-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+/**
+ * @brief 网格数据. 顶点属性按分量分别存放(SoA), 三角形只保存顶点下标.
+ * 法向与纹理坐标可以有自己的下标(OBJ 的 v/vt/vn), 没有时与顶点共用下标
+ *
+ */
+struct mesh_data {
+  std::vector<real> px, py, pz;  // 顶点坐标
+  std::vector<real> nx, ny, nz;  // 顶点法向, 可以为空
+  std::vector<real> tu, tv;      // 纹理坐标, 可以为空
+  std::vector<std::uint32_t> indices;         // 每个三角形 3 个顶点下标
+  std::vector<std::uint32_t> normal_indices;  // 法向下标, 为空时与 indices 相同
+  std::vector<std::uint32_t> uv_indices;  // 纹理坐标下标, 为空时与 indices 相同
+
+  size_t vertex_count() const { return px.size(); }
+  size_t triangle_count() const { return indices.size() / 3; }
+  bool has_normals() const { return !nx.empty(); }
+  bool has_uvs() const { return !tu.empty(); }
+
+  point3 position(std::uint32_t i) const { return point3(px[i], py[i], pz[i]); }
+  vec3 normal(std::uint32_t i) const { return vec3(nx[i], ny[i], nz[i]); }
+
+  // 第 t 个三角形第 c 个角的法向/纹理坐标下标
+  std::uint32_t normal_index(size_t t, int c) const {
+    return normal_indices.empty() ? indices[3 * t + c]
+                                  : normal_indices[3 * t + c];
+  }
+  std::uint32_t uv_index(size_t t, int c) const {
+    return uv_indices.empty() ? indices[3 * t + c] : uv_indices[3 * t + c];
+  }
+
+  size_t memory_bytes() const {
+    return (px.capacity() + py.capacity() + pz.capacity() + nx.capacity() +
+            ny.capacity() + nz.capacity() + tu.capacity() + tv.capacity()) *
+               sizeof(real) +
+           (indices.capacity() + normal_indices.capacity() +
+            uv_indices.capacity()) *
+               sizeof(std::uint32_t);
+  }
+
+  /**
+   * @brief 检查下标是否越界, 属性数组的长度是否一致
+   *
+   * @param error 不合法时写入原因
+   * @return true 合法
+   */
+  bool validate(std::string& error) const {
+    auto check = [&](const std::vector<std::uint32_t>& idx, size_t count,
+                     const char* name) {
+      if (!idx.empty() && idx.size() != indices.size()) {
+        error = std::string(name) + "下标的个数与三角形不一致";
+        return false;
+      }
+      for (auto i : idx) {
+        if (i >= count) {
+          error = std::string(name) + "下标越界";
+          return false;
+        }
+      }
+      return true;
+    };
+    if (py.size() != px.size() || pz.size() != px.size() ||
+        ny.size() != nx.size() || nz.size() != nx.size() ||
+        tv.size() != tu.size()) {
+      error = "属性数组的长度不一致";
+      return false;
+    }
+    if (indices.size() % 3 != 0) {
+      error = "顶点下标的个数不是 3 的倍数";
+      return false;
+    }
+    return check(indices, px.size(), "顶点") &&
+           (!has_normals() ||
+            check(normal_indices.empty() ? indices : normal_indices,
+                  nx.size(), "法向")) &&
+           (!has_uvs() ||
+            check(uv_indices.empty() ? indices : uv_indices, tu.size(),
+                  "纹理坐标"));
+  }
+};
+
+/**
+ * @brief 三角形网格. 整个网格只有一个 hittable 与一个材料, 三角形按自己的
+ * BVH(flat_bvh) 的叶子顺序重新排列, 不为每个三角形分配对象
+ *
+ */
+class triangle_mesh : public hittable {
+ public:
+  static constexpr int max_leaf_size = 8;  // 叶子节点最多包含的三角形数
+
+  triangle_mesh(mesh_data data, shared_ptr<material> m)
+      : mesh(std::move(data)), mat(m) {
+    build();
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    const ray_setup rs(r);
+    std::int64_t best = -1;
+    real best_b[3] = {0, 0, 0};
+    bvh.traverse(rs, ray_t, [&](std::uint32_t first, std::uint32_t count,
+                                interval& t_range) {
+      for (std::uint32_t k = first; k < first + count; k++) {
+        real t, b[3];
+        if (triangle_hit(rs, k, t_range, t, b)) {
+          t_range.max = t;
+          best = k;
+          std::copy(b, b + 3, best_b);
+        }
+      }
+    });
+    if (best < 0) return false;
+    fill_record(r, static_cast<size_t>(best), ray_t.max, best_b, rec);
+    return true;
+  }
+
+  aabb bounding_box() const override { return bbox; }
+
+  const mesh_data& data() const { return mesh; }
+  size_t triangle_count() const { return mesh.triangle_count(); }
+  size_t node_count() const { return bvh.node_count(); }
+  // 网格数据与 BVH 占用的内存(字节)
+  size_t memory_bytes() const {
+    return mesh.memory_bytes() + bvh.memory_bytes();
+  }
+
+ private:
+  // 每条光线只计算一次的数据: 包围盒测试用的方向倒数,
+  // 以及水密求交使用的坐标轴置换与剪切系数
+  struct ray_setup : flat_bvh::ray_data {
+    int kx, ky, kz;
+    real sx, sy, sz;
+
+    explicit ray_setup(const ray& r) : flat_bvh::ray_data(r) {
+      // 方向分量绝对值最大的轴作为 z 轴, 保持手性
+      kz = 0;
+      if (std::fabs(dir[1]) > std::fabs(dir[kz])) kz = 1;
+      if (std::fabs(dir[2]) > std::fabs(dir[kz])) kz = 2;
+      kx = (kz + 1) % 3;
+      ky = (kx + 1) % 3;
+      if (dir[kz] < 0) std::swap(kx, ky);
+      sx = dir[kx] / dir[kz];
+      sy = dir[ky] / dir[kz];
+      sz = 1 / dir[kz];
+    }
+  };
+
+  mesh_data mesh;
+  shared_ptr<material> mat;
+  flat_bvh bvh;
+  aabb bbox;
+
+  /**
+   * @brief 水密的光线-三角形求交 (Woop, Benthin, Wald 2013): 把顶点变换到
+   * 光线方向为 z 轴的坐标系后用二维边函数判断, 共享边上的点不会被两侧的
+   * 三角形同时漏掉. 单精度下边函数为 0 时用双精度重新计算
+   *
+   * @param b 重心坐标, 依次为三个顶点的权重
+   */
+  bool triangle_hit(const ray_setup& rs, size_t t_index, interval ray_t,
+                    real& t, real* b) const {
+    RTW_STAT_INC(triangle_tests);
+    const std::uint32_t* idx = &mesh.indices[3 * t_index];
+    real ax = 0, ay = 0, az = 0, bx = 0, by = 0, bz = 0, cx = 0, cy = 0,
+         cz = 0;
+    auto relative = [&](std::uint32_t i, real& x, real& y, real& z) {
+      real p[3] = {mesh.px[i] - rs.org[0], mesh.py[i] - rs.org[1],
+                   mesh.pz[i] - rs.org[2]};
+      x = p[rs.kx] - rs.sx * p[rs.kz];
+      y = p[rs.ky] - rs.sy * p[rs.kz];
+      z = rs.sz * p[rs.kz];
+    };
+    relative(idx[0], ax, ay, az);
+    relative(idx[1], bx, by, bz);
+    relative(idx[2], cx, cy, cz);
+
+    real u = cx * by - cy * bx;
+    real v = ax * cy - ay * cx;
+    real w = bx * ay - by * ax;
+    if constexpr (std::is_same<real, float>::value) {
+      if (u == 0 || v == 0 || w == 0) {
+        u = real(double(cx) * by - double(cy) * bx);
+        v = real(double(ax) * cy - double(ay) * cx);
+        w = real(double(bx) * ay - double(by) * ax);
+      }
+    }
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+    real det = u + v + w;
+    if (det == 0) return false;
+    real inv_det = 1 / det;
+    t = (u * az + v * bz + w * cz) * inv_det;
+    if (!ray_t.surrounds(t)) return false;
+    b[0] = u * inv_det;
+    b[1] = v * inv_det;
+    b[2] = w * inv_det;
+    return true;
+  }
+
+  // 由最近的交点填写 rec, 法向与纹理坐标只对最近的交点计算一次
+  void fill_record(const ray& r, size_t t_index, real t, const real* b,
+                   hit_record& rec) const {
+    const std::uint32_t* idx = &mesh.indices[3 * t_index];
+    point3 p0 = mesh.position(idx[0]);
+    vec3 e1 = mesh.position(idx[1]) - p0;
+    vec3 e2 = mesh.position(idx[2]) - p0;
+    vec3 n = cross(e1, e2);
+    real area = n.length();
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.mat = mat;
+    rec.set_face_normal(r, n / area);
+    if (mesh.has_normals()) {
+      // 插值的着色法向, 朝向与几何法向在同一侧
+      vec3 shading = b[0] * mesh.normal(mesh.normal_index(t_index, 0)) +
+                     b[1] * mesh.normal(mesh.normal_index(t_index, 1)) +
+                     b[2] * mesh.normal(mesh.normal_index(t_index, 2));
+      if (shading.length_squared() > 0) {
+        shading = unit_vector(shading);
+        if (dot(shading, n) < 0) shading = -shading;
+        rec.normal = rec.front_face ? shading : -shading;
+      }
+    }
+    if (mesh.has_uvs()) {
+      real uv[3][2];
+      for (int c = 0; c < 3; c++) {
+        auto k = mesh.uv_index(t_index, c);
+        uv[c][0] = mesh.tu[k];
+        uv[c][1] = mesh.tv[k];
+      }
+      rec.u = b[0] * uv[0][0] + b[1] * uv[1][0] + b[2] * uv[2][0];
+      rec.v = b[0] * uv[0][1] + b[1] * uv[1][1] + b[2] * uv[2][1];
+      // 纹理坐标 [0,1] 对应的世界长度由三角形在两个空间中的面积比估计
+      real uv_area = std::fabs((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) -
+                               (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+      if (uv_area > 0) {
+        real size = std::sqrt(area / uv_area);
+        rec.set_footprint(r, size, size);
+      } else {
+        rec.du = rec.dv = 0;
+      }
+    } else {
+      // 没有纹理坐标时使用重心坐标
+      rec.u = b[1];
+      rec.v = b[2];
+      rec.set_footprint(r, e1.length(), e2.length());
+    }
+  }
+
+  // 构建 BVH, 三角形按叶子顺序重新排列, 求交时连续访问
+  void build() {
+    trace_scope scope("triangle_mesh build", "scene", triangle_count());
+    size_t n = triangle_count();
+    std::vector<flat_bvh::build_prim> prims(n);
+    for (size_t t = 0; t < n; t++) {
+      auto& prim = prims[t];
+      prim.index = static_cast<std::uint32_t>(t);
+      for (int a = 0; a < 3; a++) {
+        prim.lo[a] = infinity;
+        prim.hi[a] = -infinity;
+        prim.c[a] = 0;
+      }
+      for (int c = 0; c < 3; c++) {
+        auto i = mesh.indices[3 * t + c];
+        const real p[3] = {mesh.px[i], mesh.py[i], mesh.pz[i]};
+        for (int a = 0; a < 3; a++) {
+          prim.lo[a] = std::min(prim.lo[a], p[a]);
+          prim.hi[a] = std::max(prim.hi[a], p[a]);
+          prim.c[a] += p[a];
+        }
+      }
+      for (int a = 0; a < 3; a++) prim.c[a] /= 3;
+    }
+    flat_bvh::build_bounds box;
+    bvh.build(prims, max_leaf_size, box);
+    if (n == 0) return;
+    bbox = aabb(point3(box.lo[0], box.lo[1], box.lo[2]),
+                point3(box.hi[0], box.hi[1], box.hi[2]))
+               .pad();
+
+    auto permute = [&](std::vector<std::uint32_t>& idx) {
+      if (idx.empty()) return;
+      std::vector<std::uint32_t> sorted(idx.size());
+      for (size_t k = 0; k < n; k++) {
+        std::copy_n(&idx[3 * size_t(prims[k].index)], 3, &sorted[3 * k]);
+      }
+      idx.swap(sorted);
+    };
+    permute(mesh.indices);
+    permute(mesh.normal_indices);
+    permute(mesh.uv_indices);
+  }
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file turbulence_volume.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief 预先烘焙的可平铺紊流体纹理: 渲染时用一次三线性插值代替多个八度的
+ * perlin noise
+ * @version 0.1
+ * @date 2023-09-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TURBULENCE_VOLUME_H
+#define TURBULENCE_VOLUME_H
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "parallel.h"
+#include "perlin.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+// noise_texture 计算紊流的方式
+enum class turbulence_mode {
+  exact,     // 逐点计算 perlin::turb
+  periodic,  // 逐点计算以 period 为周期平铺的 perlin::periodic_turb
+  baked,     // 在预先烘焙的 periodic 体纹理中三线性插值
+};
+
+inline const char* turbulence_mode_name(turbulence_mode mode) {
+  switch (mode) {
+    case turbulence_mode::periodic:
+      return "periodic";
+    case turbulence_mode::baked:
+      return "baked";
+    default:
+      return "exact";
+  }
+}
+
+inline bool parse_turbulence_mode(const std::string& name,
+                                  turbulence_mode& mode) {
+  for (auto m : {turbulence_mode::exact, turbulence_mode::periodic,
+                 turbulence_mode::baked}) {
+    if (name == turbulence_mode_name(m)) {
+      mode = m;
+      return true;
+    }
+  }
+  return false;
+}
+
+// 紊流的计算方式与烘焙参数
+struct turbulence_options {
+  turbulence_mode mode = turbulence_mode::exact;
+  int resolution = 128;  // 烘焙时每个坐标轴上的采样数, 向上取整为 2 的幂
+  int period = 4;        // 平铺的周期(以格点为单位), 2 的幂, 不超过 256
+  int depth = 7;         // 八度数
+  int threads = 0;       // 烘焙的线程数, <=0 时使用全部硬件线程
+};
+
+// 之后构建的 noise_texture 使用的紊流参数, 只能在构建场景之前修改
+inline turbulence_options& default_turbulence() {
+  static turbulence_options options;
+  return options;
+}
+
+/**
+ * @brief 一个周期内 perlin::periodic_turb 的采样. 体纹理在每个坐标轴上以
+ * period 为周期平铺, 采样之间三线性插值. 采样间距为 period/resolution,
+ * 比采样间距更细的八度会被平滑掉, 误差可以用 noise 基准测试查看
+ *
+ */
+class turbulence_volume {
+ public:
+  turbulence_volume() {}
+
+  /**
+   * @brief 并行烘焙, 每个任务计算一层(固定 z)的采样
+   *
+   * @param noise 采样的 perlin noise
+   * @param options 分辨率, 周期与八度数
+   */
+  void bake(const perlin& noise, turbulence_options options) {
+    trace_scope scope("turbulence_volume::bake", "texture");
+    n = padded_resolution(options.resolution);
+    period = options.period;
+    depth = options.depth;
+    // 采样间距 period/n 为 2 的幂, 采样点的坐标是精确的
+    step = double(period) / n;
+    inv_step = n / double(period);
+    samples.assign(size_t(n) * n * n, 0.0f);
+    parallel_for(n, resolve_thread_count(options.threads), [&](int z, int) {
+      float* slice = samples.data() + size_t(z) * n * n;
+      for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+          slice[size_t(y) * n + x] = static_cast<float>(noise.periodic_turb(
+              point3(x * step, y * step, z * step), depth, period));
+        }
+      }
+    });
+  }
+
+  /**
+   * @brief noise 以 options 烘焙的体纹理. 与 perlin_tables::shared 相同,
+   * 种子, 分辨率, 周期与八度数都相同的体纹理只烘焙一次, 之后返回同一份
+   *
+   */
+  static shared_ptr<const turbulence_volume> shared(
+      const perlin& noise, const turbulence_options& options) {
+    static std::mutex mutex;
+    static std::map<std::tuple<std::uint32_t, int, int, int>,
+                    shared_ptr<const turbulence_volume>>
+        volumes;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = volumes[std::make_tuple(noise.seed(),
+                                          padded_resolution(options.resolution),
+                                          options.period, options.depth)];
+    if (!entry) {
+      auto volume = make_shared<turbulence_volume>();
+      volume->bake(noise, options);
+      entry = volume;
+    }
+    return entry;
+  }
+
+  // 向上取整为 2 的幂的分辨率
+  static int padded_resolution(int resolution) {
+    int r = 1;
+    while (r < resolution) r <<= 1;
+    return r;
+  }
+
+  int resolution() const { return n; }
+  int tile_period() const { return period; }
+  int octaves() const { return depth; }
+  size_t memory_bytes() const { return samples.size() * sizeof(float); }
+
+  // p 处的紊流, 采样之间三线性插值, 超出一个周期的坐标回绕
+  double lookup(const point3& p) const {
+    double x = p.x() * inv_step, y = p.y() * inv_step, z = p.z() * inv_step;
+    double fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    double u = x - fx, v = y - fy, w = z - fz;
+    int mask = n - 1;
+    // 先转换为 long 再取模, 负坐标也能正确回绕
+    int x0 = static_cast<int>(static_cast<long>(fx) & mask);
+    int y0 = static_cast<int>(static_cast<long>(fy) & mask);
+    int z0 = static_cast<int>(static_cast<long>(fz) & mask);
+    int x1 = (x0 + 1) & mask, y1 = (y0 + 1) & mask, z1 = (z0 + 1) & mask;
+    auto at = [&](int i, int j, int k) {
+      return double(samples[(size_t(k) * n + j) * n + i]);
+    };
+    auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+    return lerp(lerp(lerp(at(x0, y0, z0), at(x1, y0, z0), u),
+                     lerp(at(x0, y1, z0), at(x1, y1, z0), u), v),
+                lerp(lerp(at(x0, y0, z1), at(x1, y0, z1), u),
+                     lerp(at(x0, y1, z1), at(x1, y1, z1), u), v),
+                w);
+  }
+
+ private:
+  std::vector<float> samples;  // n^3 个采样, 按 x,y,z 的顺序存放
+  int n = 0;                   // 每个坐标轴上的采样数
+  int period = 0;
+  int depth = 0;
+  double step = 0, inv_step = 0;  // 采样间距及其倒数
+};
+
+#endif
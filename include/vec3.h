@@ -15,55 +15,55 @@
 
 using std::sqrt;
 /**
- * @brief 三维向量类
+ * @brief 三维向量类, 标量类型 T 为 float 或 double
  *
  */
-class vec3 {
+template <typename T>
+class basic_vec3 {
  public:
-  double e[3];
-
-  vec3() : e{0, 0, 0} {}
-  vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
-
-  double x() const { return e[0]; }
-  double y() const { return e[1]; }
-  double z() const { return e[2]; }
-
-  vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+  using value_type = T;
+#ifdef RTW_SIMD_VEC3
+  // 补齐到 4 个分量并对齐, 便于 SSE/AVX 整体读写. 第 4 个分量只是补齐,
+  // 构造时为 0, 运算后不保证为 0(见 vec3_simd.h), 任何地方都不读取它
+  alignas(4 * sizeof(T)) T e[4];
+#else
+  T e[3];
+#endif
+
+  basic_vec3() : e{0, 0, 0} {}
+  basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
+  // 不同精度之间的显式转换
+  template <typename U>
+  explicit basic_vec3(const basic_vec3<U> &v)
+      : e{static_cast<T>(v[0]), static_cast<T>(v[1]), static_cast<T>(v[2])} {}
+
+  T x() const { return e[0]; }
+  T y() const { return e[1]; }
+  T z() const { return e[2]; }
+
+  basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
   // 常量成员重载函数，假如对象为 vec3 const temp_vec3，则temp_vec3[0]调用该函数
-  double operator[](int i) const { return e[i]; }
+  T operator[](int i) const { return e[i]; }
   // 假如对象为 vec3 temp_vec3，则temp_vec3[0]调用该函数
-  double &operator[](int i) { return e[i]; }
+  T &operator[](int i) { return e[i]; }
 
-  vec3 &operator+=(const vec3 &v) {
-    e[0] += v.e[0];
-    e[1] += v.e[1];
-    e[2] += v.e[2];
-    return *this;
-  }
+  basic_vec3 &operator+=(const basic_vec3 &v) { return *this = *this + v; }
 
-  vec3 &operator*=(double t) {
-    e[0] *= t;
-    e[1] *= t;
-    e[2] *= t;
-    return *this;
-  }
+  basic_vec3 &operator*=(T t) { return *this = t * *this; }
 
-  vec3 &operator/=(double t) { return *this *= 1 / t; }
+  basic_vec3 &operator/=(T t) { return *this *= 1 / t; }
 
-  double length() const { return sqrt(length_squared()); }
+  T length() const { return sqrt(length_squared()); }
 
-  double length_squared() const {
-    return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
-  }
+  T length_squared() const { return dot(*this, *this); }
   // 随机采样 vec3
-  static vec3 random() {
-    return vec3(random_double(), random_double(), random_double());
+  static basic_vec3 random() {
+    return basic_vec3(random_double(), random_double(), random_double());
   }
   // 随机采样 vec3(min, max)
-  static vec3 random(double min, double max) {
-    return vec3(random_double(min, max), random_double(min, max),
-                random_double(min, max));
+  static basic_vec3 random(double min, double max) {
+    return basic_vec3(random_double(min, max), random_double(min, max),
+                      random_double(min, max));
   }
   // 判断向量是否接近0, 用于误差判断
   bool near_zero() const {
@@ -71,48 +71,100 @@ class vec3 {
     return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
   }
 };
+
+// 渲染器使用的向量类型, 精度由 real 决定(见 rtweekend.h)
+using vec3 = basic_vec3<real>;
 // point3 is just an alias for vec3, but useful for geometric clarity in the
 // code.
 using point3 = vec3;
 
 // Vector Utility Functions
+// 标量参数使用 basic_vec3<T>::value_type, 使 T 只从向量参数推导,
+// 这样 double/int 常量可以直接与 float 向量运算
 
-inline std::ostream &operator<<(std::ostream &out, const vec3 &v) {
+template <typename T>
+inline std::ostream &operator<<(std::ostream &out, const basic_vec3<T> &v) {
   return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator+(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator-(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-  return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(typename basic_vec3<T>::value_type t,
+                               const basic_vec3<T> &v) {
+  return basic_vec3<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t) { return t * v; }
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T> &v,
+                               typename basic_vec3<T>::value_type t) {
+  return t * v;
+}
 
-inline vec3 operator/(vec3 v, double t) { return (1 / t) * v; }
+template <typename T>
+inline basic_vec3<T> operator/(basic_vec3<T> v,
+                               typename basic_vec3<T>::value_type t) {
+  return (1 / t) * v;
+}
 
-inline double dot(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline T dot(const basic_vec3<T> &u, const basic_vec3<T> &v) {
   return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-              u.e[2] * v.e[0] - u.e[0] * v.e[2],
-              u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline basic_vec3<T> cross(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                       u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                       u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
 // 正则化一个向量
-inline vec3 unit_vector(vec3 v) { return v / v.length(); }
+template <typename T>
+inline basic_vec3<T> unit_vector(basic_vec3<T> v) {
+  return v / v.length();
+}
+
+// 逐分量取最小值
+template <typename T>
+inline basic_vec3<T> min(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(fmin(u.e[0], v.e[0]), fmin(u.e[1], v.e[1]),
+                       fmin(u.e[2], v.e[2]));
+}
+
+// 逐分量取最大值
+template <typename T>
+inline basic_vec3<T> max(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(fmax(u.e[0], v.e[0]), fmax(u.e[1], v.e[1]),
+                       fmax(u.e[2], v.e[2]));
+}
+
+// 逐分量计算 a*b+c, 只做一次舍入
+template <typename T>
+inline basic_vec3<T> fma(const basic_vec3<T> &a, const basic_vec3<T> &b,
+                         const basic_vec3<T> &c) {
+  return basic_vec3<T>(std::fma(a.e[0], b.e[0], c.e[0]),
+                       std::fma(a.e[1], b.e[1], c.e[1]),
+                       std::fma(a.e[2], b.e[2], c.e[2]));
+}
+
+#ifdef RTW_SIMD_VEC3
+// 用 SSE/AVX 实现的 float/double 版本, 普通函数在重载决议中优先于上面的模板
+#include "vec3_simd.h"
+#endif
 
 // 在一个单位球内采样一个点
 inline vec3 random_in_unit_sphere() {
@@ -151,7 +203,8 @@ inline vec3 random_in_unit_disk() {
  * @param n 法向
  * @return vec3
  */
-inline vec3 reflect(const vec3 &v, const vec3 &n) {
+template <typename T>
+inline basic_vec3<T> reflect(const basic_vec3<T> &v, const basic_vec3<T> &n) {
   return v - 2 * dot(v, n) * n;
 }
 /**
@@ -162,10 +215,13 @@ inline vec3 reflect(const vec3 &v, const vec3 &n) {
  * @param etai_over_etat 入射介质折射率/出射介质折射率
  * @return vec3
  */
-inline vec3 refract(const vec3 &v, const vec3 &n, double etai_over_etat) {
-  double cos_theta = fmin(1.0, dot(-v, n));
-  vec3 r_out_perp = etai_over_etat * (v + cos_theta * n);
-  vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+template <typename T>
+inline basic_vec3<T> refract(const basic_vec3<T> &v, const basic_vec3<T> &n,
+                             double etai_over_etat) {
+  T cos_theta = fmin(1.0, dot(-v, n));
+  basic_vec3<T> r_out_perp = etai_over_etat * (v + cos_theta * n);
+  basic_vec3<T> r_out_parallel =
+      -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
   return r_out_perp + r_out_parallel;
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,247 @@
+/**
+ * @file vec3_simd.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief vec3 的 SSE/AVX 实现, 由 vec3.h 在定义 RTW_SIMD_VEC3 时包含
+ * @version 0.1
+ * @date 2023-09-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef VEC3_SIMD_H
+#define VEC3_SIMD_H
+
+#include <immintrin.h>
+
+// 所有运算都按 4 个分量整体进行, 第 4 个分量只是补齐.
+// 补齐分量不会被重新置 0: 操作数都有限时它保持为 0, 但乘以(或除以)
+// inf, NaN 等标量后可能变为 NaN. dot 等归约只读取前 3 个分量, 因此
+// 补齐分量的值不影响任何结果, 下文的 (x,y,z,0) 中的 0 指的就是这个分量.
+// 加减乘与标量乘法逐分量计算, dot 按 (x+y)+z 的顺序求和,
+// 因此结果与标量版本逐位相同(不使用 fma 的前提下).
+//
+// double: 有 AVX 时使用一个 __m256d, 否则使用两个 __m128d (SSE2)
+// float:  使用一个 __m128 (SSE)
+
+#if defined(__AVX__)
+using vec3_pd = __m256d;
+
+inline vec3_pd vec3_pd_load(const double *p) { return _mm256_load_pd(p); }
+inline void vec3_pd_store(double *p, vec3_pd a) { _mm256_store_pd(p, a); }
+inline vec3_pd vec3_pd_set1(double t) { return _mm256_set1_pd(t); }
+inline vec3_pd vec3_pd_add(vec3_pd a, vec3_pd b) { return _mm256_add_pd(a, b); }
+inline vec3_pd vec3_pd_sub(vec3_pd a, vec3_pd b) { return _mm256_sub_pd(a, b); }
+inline vec3_pd vec3_pd_mul(vec3_pd a, vec3_pd b) { return _mm256_mul_pd(a, b); }
+inline vec3_pd vec3_pd_min(vec3_pd a, vec3_pd b) { return _mm256_min_pd(a, b); }
+inline vec3_pd vec3_pd_max(vec3_pd a, vec3_pd b) { return _mm256_max_pd(a, b); }
+// (x,y,z,0) 的低/高 128 位
+inline __m128d vec3_pd_lo(vec3_pd a) { return _mm256_castpd256_pd128(a); }
+inline __m128d vec3_pd_hi(vec3_pd a) { return _mm256_extractf128_pd(a, 1); }
+inline vec3_pd vec3_pd_join(__m128d lo, __m128d hi) {
+  return _mm256_insertf128_pd(_mm256_castpd128_pd256(lo), hi, 1);
+}
+#else
+struct vec3_pd {
+  __m128d lo, hi;  // (x,y) 与 (z,0)
+};
+
+inline vec3_pd vec3_pd_load(const double *p) {
+  return {_mm_load_pd(p), _mm_load_pd(p + 2)};
+}
+inline void vec3_pd_store(double *p, vec3_pd a) {
+  _mm_store_pd(p, a.lo);
+  _mm_store_pd(p + 2, a.hi);
+}
+inline vec3_pd vec3_pd_set1(double t) {
+  return {_mm_set1_pd(t), _mm_set1_pd(t)};
+}
+inline vec3_pd vec3_pd_add(vec3_pd a, vec3_pd b) {
+  return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+}
+inline vec3_pd vec3_pd_sub(vec3_pd a, vec3_pd b) {
+  return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+}
+inline vec3_pd vec3_pd_mul(vec3_pd a, vec3_pd b) {
+  return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+}
+inline vec3_pd vec3_pd_min(vec3_pd a, vec3_pd b) {
+  return {_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)};
+}
+inline vec3_pd vec3_pd_max(vec3_pd a, vec3_pd b) {
+  return {_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)};
+}
+inline __m128d vec3_pd_lo(vec3_pd a) { return a.lo; }
+inline __m128d vec3_pd_hi(vec3_pd a) { return a.hi; }
+inline vec3_pd vec3_pd_join(__m128d lo, __m128d hi) { return {lo, hi}; }
+#endif
+
+// (x,y,z,0) -> (y,z,x,0)
+inline vec3_pd vec3_pd_yzx(vec3_pd a) {
+#if defined(__AVX2__)
+  return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1));
+#else
+  __m128d lo = vec3_pd_lo(a), hi = vec3_pd_hi(a);
+  return vec3_pd_join(_mm_shuffle_pd(lo, hi, 0b01), _mm_shuffle_pd(lo, hi, 0b10));
+#endif
+}
+// (x,y,z,0) -> (z,x,y,0)
+inline vec3_pd vec3_pd_zxy(vec3_pd a) {
+#if defined(__AVX2__)
+  return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 1, 0, 2));
+#else
+  __m128d lo = vec3_pd_lo(a), hi = vec3_pd_hi(a);
+  return vec3_pd_join(_mm_shuffle_pd(hi, lo, 0b00), _mm_shuffle_pd(lo, hi, 0b11));
+#endif
+}
+// 返回 (a.x+a.y)+a.z
+inline double vec3_pd_sum3(vec3_pd a) {
+  __m128d lo = vec3_pd_lo(a);
+  __m128d s = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+  return _mm_cvtsd_f64(_mm_add_sd(s, vec3_pd_hi(a)));
+}
+
+inline basic_vec3<double> vec3_pd_result(vec3_pd a) {
+  basic_vec3<double> r;
+  vec3_pd_store(r.e, a);
+  return r;
+}
+
+inline basic_vec3<double> operator+(const basic_vec3<double> &u,
+                                    const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_add(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> operator-(const basic_vec3<double> &u,
+                                    const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_sub(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> operator*(const basic_vec3<double> &u,
+                                    const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_mul(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> operator*(double t, const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_mul(vec3_pd_set1(t), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> operator*(const basic_vec3<double> &v, double t) {
+  return t * v;
+}
+
+inline basic_vec3<double> operator/(basic_vec3<double> v, double t) {
+  return (1 / t) * v;
+}
+
+inline double dot(const basic_vec3<double> &u, const basic_vec3<double> &v) {
+  return vec3_pd_sum3(vec3_pd_mul(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> cross(const basic_vec3<double> &u,
+                                const basic_vec3<double> &v) {
+  auto a = vec3_pd_load(u.e), b = vec3_pd_load(v.e);
+  return vec3_pd_result(
+      vec3_pd_sub(vec3_pd_mul(vec3_pd_yzx(a), vec3_pd_zxy(b)),
+                  vec3_pd_mul(vec3_pd_zxy(a), vec3_pd_yzx(b))));
+}
+
+inline basic_vec3<double> unit_vector(basic_vec3<double> v) {
+  return v / sqrt(dot(v, v));
+}
+
+// 注意: 与 fmin/fmax 不同, 有 NaN 时返回第二个参数
+inline basic_vec3<double> min(const basic_vec3<double> &u,
+                              const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_min(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+inline basic_vec3<double> max(const basic_vec3<double> &u,
+                              const basic_vec3<double> &v) {
+  return vec3_pd_result(vec3_pd_max(vec3_pd_load(u.e), vec3_pd_load(v.e)));
+}
+
+#if defined(__FMA__) && defined(__AVX__)
+inline basic_vec3<double> fma(const basic_vec3<double> &a,
+                              const basic_vec3<double> &b,
+                              const basic_vec3<double> &c) {
+  return vec3_pd_result(_mm256_fmadd_pd(vec3_pd_load(a.e), vec3_pd_load(b.e),
+                                        vec3_pd_load(c.e)));
+}
+#endif
+
+// float 版本, 一个 __m128 正好放下 (x,y,z,0)
+
+inline basic_vec3<float> vec3_ps_result(__m128 a) {
+  basic_vec3<float> r;
+  _mm_store_ps(r.e, a);
+  return r;
+}
+
+inline basic_vec3<float> operator+(const basic_vec3<float> &u,
+                                   const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_add_ps(_mm_load_ps(u.e), _mm_load_ps(v.e)));
+}
+
+inline basic_vec3<float> operator-(const basic_vec3<float> &u,
+                                   const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_sub_ps(_mm_load_ps(u.e), _mm_load_ps(v.e)));
+}
+
+inline basic_vec3<float> operator*(const basic_vec3<float> &u,
+                                   const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_mul_ps(_mm_load_ps(u.e), _mm_load_ps(v.e)));
+}
+
+inline basic_vec3<float> operator*(float t, const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_mul_ps(_mm_set1_ps(t), _mm_load_ps(v.e)));
+}
+
+inline basic_vec3<float> operator*(const basic_vec3<float> &v, float t) {
+  return t * v;
+}
+
+inline basic_vec3<float> operator/(basic_vec3<float> v, float t) {
+  return (1 / t) * v;
+}
+
+inline float dot(const basic_vec3<float> &u, const basic_vec3<float> &v) {
+  __m128 p = _mm_mul_ps(_mm_load_ps(u.e), _mm_load_ps(v.e));
+  __m128 s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(p, p)));
+}
+
+inline basic_vec3<float> cross(const basic_vec3<float> &u,
+                               const basic_vec3<float> &v) {
+  __m128 a = _mm_load_ps(u.e), b = _mm_load_ps(v.e);
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+  return vec3_ps_result(
+      _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+
+inline basic_vec3<float> unit_vector(basic_vec3<float> v) {
+  return v / sqrt(dot(v, v));
+}
+
+inline basic_vec3<float> min(const basic_vec3<float> &u,
+                             const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_min_ps(_mm_load_ps(u.e), _mm_load_ps(v.e)));
+}
+
+inline basic_vec3<float> max(const basic_vec3<float> &u,
+                             const basic_vec3<float> &v) {
+  return vec3_ps_result(_mm_max_ps(_mm_load_ps(u.e), _mm_load_ps(v.e)));
+}
+
+#if defined(__FMA__)
+inline basic_vec3<float> fma(const basic_vec3<float> &a,
+                             const basic_vec3<float> &b,
+                             const basic_vec3<float> &c) {
+  return vec3_ps_result(
+      _mm_fmadd_ps(_mm_load_ps(a.e), _mm_load_ps(b.e), _mm_load_ps(c.e)));
+}
+#endif
+
+#endif
@@ -0,0 +1,308 @@
+/**
+ * @file wavefront.h
+ * @author Liuzengqiang (12021032@zju.edu.cn)
+ * @brief wavefront 渲染使用的 SoA 光线/交点队列与并行的排序, 压缩工具
+ * @version 0.1
+ * @date 2023-09-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hittable.h"
+#include "material.h"
+#include "parallel.h"
+#include "rtweekend.h"
+
+// 每个并行任务处理的队列元素数. 块的划分与线程数无关, 因此结果也与线程数无关
+static constexpr int wavefront_chunk = 1024;
+
+inline int wavefront_chunk_count(size_t n) {
+  return static_cast<int>((n + wavefront_chunk - 1) / wavefront_chunk);
+}
+
+/**
+ * @brief 一批正在追踪的光线, 每个字段一个数组(SoA)
+ *
+ */
+struct ray_queue {
+  std::vector<point3> origin;
+  std::vector<vec3> direction;
+  std::vector<real> time;
+  std::vector<real> cone_width, cone_spread;  // 光线锥, 见 ray::set_cone()
+  std::vector<color> throughput;  // 路径到目前为止累乘的衰减系数
+  std::vector<int> path;          // 光线所属路径的下标
+
+  size_t size() const { return path.size(); }
+
+  void resize(size_t n) {
+    origin.resize(n);
+    direction.resize(n);
+    time.resize(n);
+    cone_width.resize(n);
+    cone_spread.resize(n);
+    throughput.resize(n);
+    path.resize(n);
+  }
+
+  ray get_ray(size_t k) const {
+    ray r(origin[k], direction[k], time[k]);
+    r.set_cone(cone_width[k], cone_spread[k]);
+    return r;
+  }
+
+  void set_ray(size_t k, const ray& r) {
+    origin[k] = r.origin();
+    direction[k] = r.direction();
+    time[k] = r.time();
+    cone_width[k] = r.cone_width();
+    cone_spread[k] = r.cone_spread();
+  }
+
+  // 把 src 的第 from 个元素复制到第 to 个
+  void copy_from(const ray_queue& src, size_t from, size_t to) {
+    origin[to] = src.origin[from];
+    direction[to] = src.direction[from];
+    time[to] = src.time[from];
+    cone_width[to] = src.cone_width[from];
+    cone_spread[to] = src.cone_spread[from];
+    throughput[to] = src.throughput[from];
+    path[to] = src.path[from];
+  }
+};
+
+/**
+ * @brief ray_queue 中每条光线的求交结果(SoA)
+ *
+ */
+struct hit_queue {
+  std::vector<point3> p;
+  std::vector<vec3> normal;
+  std::vector<real> t, u, v;
+  std::vector<real> du, dv;  // 纹理坐标范围
+  std::vector<unsigned char> front_face;
+  std::vector<const material*> mat;  // 没有击中任何物体时为 nullptr
+  std::vector<unsigned char> type;   // 材料种类, 未击中时为 material_type::count
+
+  void resize(size_t n) {
+    p.resize(n);
+    normal.resize(n);
+    t.resize(n);
+    u.resize(n);
+    v.resize(n);
+    du.resize(n);
+    dv.resize(n);
+    front_face.resize(n);
+    mat.resize(n);
+    type.resize(n);
+  }
+
+  void set(size_t k, const hit_record& rec) {
+    p[k] = rec.p;
+    normal[k] = rec.normal;
+    t[k] = rec.t;
+    u[k] = rec.u;
+    v[k] = rec.v;
+    du[k] = rec.du;
+    dv[k] = rec.dv;
+    front_face[k] = rec.front_face;
+    mat[k] = rec.mat.get();
+    type[k] = static_cast<unsigned char>(rec.mat->type());
+  }
+
+  void set_miss(size_t k) {
+    mat[k] = nullptr;
+    type[k] = static_cast<unsigned char>(material_type::count);
+  }
+
+  // 还原交点信息. material::scatter()/emitted() 不使用 rec.mat, 因此不还原
+  hit_record get(size_t k) const {
+    hit_record rec;
+    rec.p = p[k];
+    rec.normal = normal[k];
+    rec.t = t[k];
+    rec.u = u[k];
+    rec.v = v[k];
+    rec.du = du[k];
+    rec.dv = dv[k];
+    rec.front_face = front_face[k];
+    return rec;
+  }
+};
+
+/**
+ * @brief wavefront 渲染中求交阶段的性能统计
+ *
+ */
+struct wavefront_profile {
+  double extension_seconds = 0;    // 求交阶段的总耗时
+  double sort_seconds = 0;         // 光线排序的总耗时
+  std::uint64_t extension_rays = 0;  // 求交阶段处理的光线数
+  bool cache_misses_available = false;  // 性能计数器不可用时为 false
+  std::uint64_t cache_misses = 0;  // 求交阶段的缓存未命中数
+};
+
+/**
+ * @brief 并行的稳定计数排序: 按 key(k) 把下标 [0, n) 分到 buckets 个桶中.
+ * 各块并行统计直方图, 求前缀和后再并行写出, 同一个桶内保持原来的顺序
+ *
+ * @param n 元素个数
+ * @param buckets 桶的个数, key(k) 取 [0, buckets)
+ * @param key int key(size_t k)
+ * @param thread_count 线程数
+ * @param order 输出: 排序后的下标
+ * @param bucket_start 输出: 每个桶在 order 中的起始位置, 长度为 buckets+1
+ * @param stats 不为空时累加调度统计
+ */
+template <typename Key>
+void parallel_counting_sort(size_t n, int buckets, const Key& key,
+                            int thread_count, std::vector<int>& order,
+                            std::vector<size_t>& bucket_start,
+                            parallel_stats* stats = nullptr) {
+  int chunks = wavefront_chunk_count(n);
+  // offset[c * buckets + b]: 第 c 块中属于桶 b 的元素个数, 之后改为写出位置
+  std::vector<size_t> offset(static_cast<size_t>(chunks) * buckets, 0);
+  parallel_for(
+      chunks, thread_count,
+      [&](int c, int) {
+        size_t end = std::min(n, size_t(c + 1) * wavefront_chunk);
+        for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+          offset[size_t(c) * buckets + key(k)]++;
+        }
+      },
+      stats);
+
+  bucket_start.assign(buckets + 1, 0);
+  size_t sum = 0;
+  for (int b = 0; b < buckets; b++) {
+    bucket_start[b] = sum;
+    for (int c = 0; c < chunks; c++) {
+      auto count = offset[size_t(c) * buckets + b];
+      offset[size_t(c) * buckets + b] = sum;
+      sum += count;
+    }
+  }
+  bucket_start[buckets] = sum;
+
+  order.resize(n);
+  parallel_for(
+      chunks, thread_count,
+      [&](int c, int) {
+        size_t end = std::min(n, size_t(c + 1) * wavefront_chunk);
+        for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+          order[offset[size_t(c) * buckets + key(k)]++] = static_cast<int>(k);
+        }
+      },
+      stats);
+}
+
+/**
+ * @brief 并行的 LSD 基数排序, 每轮按 8 位做一次 parallel_counting_sort.
+ * 所有元素在某一轮的 8 位都相同时跳过该轮
+ *
+ * @param keys 每个元素的排序键
+ * @param thread_count 线程数
+ * @param order 输出: 按键从小到大排序后的下标, 键相同时保持原来的顺序
+ * @param stats 不为空时累加调度统计
+ */
+inline void parallel_radix_sort(const std::vector<std::uint32_t>& keys,
+                                int thread_count, std::vector<int>& order,
+                                parallel_stats* stats = nullptr) {
+  size_t n = keys.size();
+  order.resize(n);
+  for (size_t k = 0; k < n; k++) order[k] = static_cast<int>(k);
+  std::vector<int> pass_order, next(n);
+  std::vector<size_t> bucket_start;
+  for (int shift = 0; shift < 32; shift += 8) {
+    parallel_counting_sort(
+        n, 256, [&](size_t k) { return (keys[order[k]] >> shift) & 0xff; },
+        thread_count, pass_order, bucket_start, stats);
+    bool trivial = false;
+    for (int b = 0; b < 256; b++) {
+      if (bucket_start[b + 1] - bucket_start[b] == n) trivial = true;
+    }
+    if (trivial) continue;
+    parallel_for(
+        wavefront_chunk_count(n), thread_count,
+        [&](int c, int) {
+          size_t end = std::min(n, size_t(c + 1) * wavefront_chunk);
+          for (size_t k = size_t(c) * wavefront_chunk; k < end; k++) {
+            next[k] = order[pass_order[k]];
+          }
+        },
+        stats);
+    order.swap(next);
+  }
+}
+
+// 把 8 位整数的各位分散到 3 位一组的最低位上: abc -> a00b00c
+inline std::uint32_t spread_bits3(std::uint32_t x) {
+  x &= 0xff;
+  x = (x | (x << 8)) & 0x0f00f;
+  x = (x | (x << 4)) & 0x0c30c3;
+  x = (x | (x << 2)) & 0x249249;
+  return x;
+}
+
+// 把 4 位整数的各位分散到 2 位一组的最低位上: abcd -> a0b0c0d
+inline std::uint32_t spread_bits2(std::uint32_t x) {
+  x &= 0xf;
+  x = (x | (x << 2)) & 0x33;
+  x = (x | (x << 1)) & 0x55;
+  return x;
+}
+
+// 把 [0,1] 内的值量化为 bits 位整数
+inline std::uint32_t quantize_unit(real x, int bits) {
+  real scale = static_cast<real>((1u << bits) - 1);
+  if (!(x > 0)) return 0;
+  if (x >= 1) return (1u << bits) - 1;
+  return static_cast<std::uint32_t>(x * scale + real(0.5));
+}
+
+/**
+ * @brief 光线的排序键: 高 24 位为起点(在 bounds 内归一化, 每轴 8 位)的
+ * Morton 码, 低 8 位为方向的八面体映射(每维 4 位)的 Morton 码.
+ * 键相近的光线起点相近且方向相近, 遍历 BVH 时访问的节点也相近
+ *
+ * @param origin 光线起点
+ * @param direction 光线方向, 不需要归一化
+ * @param bounds 场景的包围盒
+ */
+inline std::uint32_t ray_sort_key(const point3& origin, const vec3& direction,
+                                  const aabb& bounds) {
+  std::uint32_t o[3];
+  for (int a = 0; a < 3; a++) {
+    const auto& axis = bounds.axis(a);
+    real size = axis.max - axis.min;
+    o[a] = size > 0 ? quantize_unit((origin[a] - axis.min) / size, 8) : 0;
+  }
+  std::uint32_t origin_code =
+      (spread_bits3(o[0]) << 2) | (spread_bits3(o[1]) << 1) | spread_bits3(o[2]);
+
+  // 八面体映射: 单位球面 -> [-1,1]^2
+  real l1 = std::fabs(direction.x()) + std::fabs(direction.y()) +
+            std::fabs(direction.z());
+  real px = l1 > 0 ? direction.x() / l1 : 0;
+  real py = l1 > 0 ? direction.y() / l1 : 0;
+  if (direction.z() < 0) {
+    real qx = (1 - std::fabs(py)) * (px >= 0 ? 1 : -1);
+    real qy = (1 - std::fabs(px)) * (py >= 0 ? 1 : -1);
+    px = qx;
+    py = qy;
+  }
+  std::uint32_t direction_code =
+      (spread_bits2(quantize_unit((px + 1) / 2, 4)) << 1) |
+      spread_bits2(quantize_unit((py + 1) / 2, 4));
+  return (origin_code << 8) | direction_code;
+}
+
+#endif
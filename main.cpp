@@ -1,25 +1,36 @@
 #include <float.h>
 #include <time.h>
 
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
+#include "asset_cache.h"
+#include "box.h"
 #include "bvh.h"
 #include "camera.h"
 #include "color.h"
 #include "constant_medium.h"
 #include "hittable_list.h"
+#include "instance.h"
 #include "interval.h"
 #include "material.h"
+#include "mesh_loader.h"
 #include "quad.h"
 #include "ray.h"
 #include "rtweekend.h"
+#include "scene_bench.h"
+#include "simd_dispatch.h"
 #include "sphere.h"
 #include "texture.h"
+#include "tiled_texture.h"
+#include "trace.h"
+#include "triangle_mesh.h"
 #include "vec3.h"
 
-void random_spheres() {
+void random_spheres(hittable_list& world, camera& cam) {
   /* 生成场景 */
-  hittable_list world;
   auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
   world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
 
@@ -64,7 +75,6 @@ void random_spheres() {
   world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
   /* 设置相机和输出图像的属性 */
-  camera cam;
   cam.aspect_ratio = 16.0 / 9.0;  // 图像的长宽比
   cam.image_width = 400;          // 图像的宽(像素数)
   cam.samples_per_pixel = 100;    // 每个像素的采样光线数
@@ -77,16 +87,9 @@ void random_spheres() {
 
   cam.defocus_angle = 0.6;  // 模拟实际相机的散射角度(以实现景深效果)
   cam.focus_dist = 10.0;  // 模拟实际相机的理想焦距(以实现景深效果)
-  auto start = clock();
-  cam.render(world);
-  auto finish = clock();
-  std::clog << "Elapsed:" << (double)(finish - start) / (CLOCKS_PER_SEC)
-            << "\n";
 }
 
-void two_spheres() {
-  hittable_list world;
-
+void two_spheres(hittable_list& world, camera& cam) {
   auto checker =
       make_shared<checker_texture>(0.8, color(.2, .3, .1), color(.9, .9, .9));
 
@@ -95,8 +98,6 @@ void two_spheres() {
   world.add(make_shared<sphere>(point3(0, 10, 0), 10,
                                 make_shared<lambertian>(checker)));
 
-  camera cam;
-
   cam.aspect_ratio = 16.0 / 9.0;
   cam.image_width = 400;
   cam.samples_per_pixel = 100;
@@ -108,16 +109,15 @@ void two_spheres() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
-void earth() {
-  auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+void earth(hittable_list& world, camera& cam) {
+  // 场景中用到的图片在构建之前并行加载
+  preload_image_textures({"earthmap.jpg"});
+  auto earth_texture = load_image_texture("earthmap.jpg");
 
   auto earth_surface = make_shared<lambertian>(earth_texture);
   auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-  camera cam;
+  world.add(globe);
 
   cam.aspect_ratio = 16.0 / 9.0;
   cam.image_width = 400;
@@ -131,21 +131,15 @@ void earth() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(hittable_list(globe));
 }
 
-void two_perlin_spheres() {
-  hittable_list world;
-
+void two_perlin_spheres(hittable_list& world, camera& cam) {
   auto pertext = make_shared<noise_texture>(4);
   world.add(make_shared<sphere>(point3(0, -1000, 0), 1000,
                                 make_shared<lambertian>(pertext)));
   world.add(make_shared<sphere>(point3(0, 2, 0), 2,
                                 make_shared<lambertian>(pertext)));
 
-  camera cam;
-
   cam.aspect_ratio = 16.0 / 9.0;
   cam.image_width = 400;
   cam.samples_per_pixel = 100;
@@ -157,13 +151,9 @@ void two_perlin_spheres() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
 
-void quads() {
-  hittable_list world;
-
+void quads(hittable_list& world, camera& cam) {
   // Materials
   auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
   auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
@@ -183,8 +173,6 @@ void quads() {
   world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4),
                               lower_teal));
 
-  camera cam;
-
   cam.aspect_ratio = 1.0;
   cam.image_width = 400;
   cam.samples_per_pixel = 100;
@@ -196,11 +184,8 @@ void quads() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
-void simple_light() {
-  hittable_list world;
+void simple_light(hittable_list& world, camera& cam) {
   // perlin noise 纹理
   auto pertext = make_shared<noise_texture>(4);
   // 增加两个使用 perlin noise 纹理的球
@@ -216,8 +201,6 @@ void simple_light() {
   world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0),
                               difflight));
 
-  camera cam;
-
   cam.aspect_ratio = 16.0 / 9.0;
   cam.image_width = 400;
   cam.samples_per_pixel = 100;
@@ -230,12 +213,9 @@ void simple_light() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
-void cornell_box() {
+void cornell_box(hittable_list& world, camera& cam) {
   // Cornell Box 场景
-  hittable_list world;
 
   auto red = make_shared<lambertian>(color(.65, .05, .05));
   auto white = make_shared<lambertian>(color(.73, .73, .73));
@@ -259,17 +239,18 @@ void cornell_box() {
   // 在场景中增加两个四面体
   // 必须先 rotate 再 translate
   shared_ptr<hittable> box1 =
-      box(point3(0, 10, 0), point3(165, 330, 165), white);
+      make_shared<axis_aligned_box>(point3(0, 10, 0),
+                                      point3(165, 330, 165), white);
   box1 = make_shared<rotate_y>(box1, 15);
   box1 = make_shared<translate>(box1, vec3(265, 0, 295));
   world.add(box1);
 
   shared_ptr<hittable> box2 =
-      box(point3(0, 0, 0), point3(165, 165, 165), white);
+      make_shared<axis_aligned_box>(point3(0, 0, 0),
+                                      point3(165, 165, 165), white);
   box2 = make_shared<rotate_y>(box2, -18);
   box2 = make_shared<translate>(box2, vec3(130, 0, 65));
   world.add(box2);
-  camera cam;
 
   cam.aspect_ratio = 1.0;
   cam.image_width = 400;
@@ -283,13 +264,9 @@ void cornell_box() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
 
-void cornell_smoke() {
-  hittable_list world;
-
+void cornell_smoke(hittable_list& world, camera& cam) {
   auto red = make_shared<lambertian>(color(.65, .05, .05));
   auto white = make_shared<lambertian>(color(.73, .73, .73));
   auto green = make_shared<lambertian>(color(.12, .45, .15));
@@ -309,20 +286,20 @@ void cornell_smoke() {
                               vec3(0, 555, 0), white));
 
   shared_ptr<hittable> box1 =
-      box(point3(0, 0, 0), point3(165, 330, 165), white);
+      make_shared<axis_aligned_box>(point3(0, 0, 0),
+                                      point3(165, 330, 165), white);
   box1 = make_shared<rotate_y>(box1, 15);
   box1 = make_shared<translate>(box1, vec3(265, 0, 295));
 
   shared_ptr<hittable> box2 =
-      box(point3(0, 0, 0), point3(165, 165, 165), white);
+      make_shared<axis_aligned_box>(point3(0, 0, 0),
+                                      point3(165, 165, 165), white);
   box2 = make_shared<rotate_y>(box2, -18);
   box2 = make_shared<translate>(box2, vec3(130, 0, 65));
 
   world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
   world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
 
-  camera cam;
-
   cam.aspect_ratio = 1.0;
   cam.image_width = 600;
   cam.samples_per_pixel = 200;
@@ -335,10 +312,11 @@ void cornell_smoke() {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
-void final_scene(int image_width, int samples_per_pixel, int max_depth) {
+void final_scene(hittable_list& world, camera& cam, int image_width,
+                 int samples_per_pixel, int max_depth) {
+  // 场景中用到的图片在构建之前并行加载
+  preload_image_textures({"earthmap.jpg"});
   hittable_list boxes1;
   auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
 
@@ -353,12 +331,11 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
       auto y1 = random_double(1, 101);
       auto z1 = z0 + w;
 
-      boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+      boxes1.add(make_shared<axis_aligned_box>(
+          point3(x0, y0, z0), point3(x1, y1, z1), ground));
     }
   }
 
-  hittable_list world;
-
   world.add(make_shared<bvh_node>(boxes1));
 
   auto light = make_shared<diffuse_light>(color(7, 7, 7));
@@ -383,8 +360,7 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
       make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
   world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
 
-  auto emat =
-      make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
+  auto emat = make_shared<lambertian>(load_image_texture("earthmap.jpg"));
   world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
   auto pertext = make_shared<noise_texture>(0.1);
   world.add(make_shared<sphere>(point3(220, 280, 300), 80,
@@ -397,11 +373,13 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
     boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
   }
 
-  world.add(make_shared<translate>(
-      make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15),
-      vec3(-100, 270, 395)));
-
-  camera cam;
+  // 球簇作为实例: 先绕 y 轴旋转 15 度再平移
+  auto cluster = make_shared<instance_bvh>();
+  cluster->add_instance(cluster->add_blas(make_shared<bvh_node>(boxes2)),
+                        affine_transform::translation(vec3(-100, 270, 395)) *
+                            affine_transform::rotation_y(15));
+  cluster->build();
+  world.add(cluster);
 
   cam.aspect_ratio = 1.0;
   cam.image_width = image_width;
@@ -415,66 +393,679 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
   cam.vup = vec3(0, 1, 0);
 
   cam.defocus_angle = 0;
-
-  cam.render(world);
 }
 
-int main(int argc, char** argv) {
-  if (argc < 1) {
-    std::clog << "请输入要生成的场景参数id[0-9]."
-              << "\n"
-              << "例如: ./RayTracingTheNextWeek 0 > image.ppm"
-              << "\n";
-    return -1;
+/**
+ * @brief 读取网格文件, 放在网格地面上, 相机根据包围盒自动取景
+ *
+ * @param path .obj 或 .ply 网格文件
+ * @return true 读取成功
+ */
+bool mesh_scene(hittable_list& world, camera& cam, const std::string& path) {
+  mesh_data data;
+  auto start = std::chrono::steady_clock::now();
+  if (!load_mesh(path, data)) return false;
+  // 没有三角形时无法根据包围盒取景
+  if (data.indices.empty()) {
+    std::cerr << "ERROR: Mesh file '" << path << "' has no triangles.\n";
+    return false;
   }
-  int scene_id = int(argv[1][0] - '0');
+  auto loaded = std::chrono::steady_clock::now();
+  auto mesh = make_shared<triangle_mesh>(
+      std::move(data), make_shared<lambertian>(color(0.73, 0.73, 0.73)));
+  auto built = std::chrono::steady_clock::now();
+  std::clog << "网格: " << mesh->triangle_count() << " 个三角形, "
+            << mesh->data().vertex_count() << " 个顶点, BVH "
+            << mesh->node_count() << " 个节点, 内存 "
+            << mesh->memory_bytes() / (1024.0 * 1024.0) << " MB\n"
+            << "  读取 "
+            << std::chrono::duration<double>(loaded - start).count()
+            << " s, 构建 "
+            << std::chrono::duration<double>(built - loaded).count()
+            << " s\n";
+
+  // 地面放在包围盒底部, 相机从斜上方看向包围盒中心
+  auto box = mesh->bounding_box();
+  point3 center(box.x.min + box.x.size() / 2, box.y.min + box.y.size() / 2,
+                box.z.min + box.z.size() / 2);
+  real radius = vec3(box.x.size(), box.y.size(), box.z.size()).length() / 2;
+  auto checker = make_shared<checker_texture>(radius / 4, color(.2, .3, .1),
+                                              color(.9, .9, .9));
+  world.add(make_shared<quad>(
+      point3(center.x() - 10 * radius, box.y.min, center.z() + 10 * radius),
+      vec3(20 * radius, 0, 0), vec3(0, 0, -20 * radius),
+      make_shared<lambertian>(checker)));
+  world.add(mesh);
+
+  cam.aspect_ratio = 16.0 / 9.0;
+  cam.image_width = 400;
+  cam.samples_per_pixel = 100;
+  cam.max_depth = 50;
+
+  cam.vfov = 30;
+  cam.lookat = center;
+  cam.lookfrom = center + radius * vec3(2.2, 1.2, 3.0);
+  cam.vup = vec3(0, 1, 0);
+
+  cam.defocus_angle = 0;
+  return true;
+}
+
+// build_scene() 支持的场景数, 场景参数id的取值为[0, scene_count)
+constexpr int scene_count = 10;
+
+// 只检查场景参数id, 不构造场景
+inline bool valid_scene_id(int scene_id) {
+  return scene_id >= 0 && scene_id < scene_count;
+}
+
+/**
+ * @brief 根据场景参数id构造场景及相机, id不合法时返回false
+ *
+ * @param scene_id 场景参数id[0-9]
+ * @param world 场景
+ * @param cam 相机
+ * @return true
+ * @return false
+ */
+bool build_scene(int scene_id, hittable_list& world, camera& cam) {
   switch (scene_id) {
     case 0:
       // 随机场景
-      random_spheres();
+      random_spheres(world, cam);
       break;
     case 1:
       // 网格纹理
-      two_spheres();
+      two_spheres(world, cam);
       break;
     case 2:
       // 地球image纹理
-      earth();
+      earth(world, cam);
       break;
     case 3:
       // perlin noise纹理
-      two_perlin_spheres();
+      two_perlin_spheres(world, cam);
       break;
     case 4:
       // 四边形
-      quads();
+      quads(world, cam);
       break;
     case 5:
       // 光源
-      simple_light();
+      simple_light(world, cam);
       break;
     case 6:
       // 基础 cornell box
-      cornell_box();
+      cornell_box(world, cam);
       break;
     case 7:
       // 带有烟雾材质的 cornell box
-      cornell_smoke();
+      cornell_smoke(world, cam);
       break;
     case 8:
       // 最终的场景
-      final_scene(800, 10000, 40);
+      final_scene(world, cam, 800, 10000, 40);
       break;
     case 9:
       // 最终的场景
-      final_scene(400, 250, 4);
+      final_scene(world, cam, 400, 250, 4);
       break;
     default:
-      std::clog << "场景参数id需要在[0,9]之内."
-                << "\n"
-                << "例如: ./RayTracingTheNextWeek 0 > image.ppm"
-                << "\n";
+      return false;
+  }
+  return true;
+}
+
+void print_usage() {
+  std::clog << "用法: ./RayTracingTheNextWeek <场景参数id[0-9]> [选项] > image.ppm"
+            << "\n"
+            << "例如: ./RayTracingTheNextWeek 0 > image.ppm"
+            << "\n"
+            << "选项:\n"
+            << "  --width <n>             覆盖场景的图像宽度\n"
+            << "  --spp <n>               覆盖场景的每像素采样数\n"
+            << "  --progressive           渐进式渲染, 定期写出预览图\n"
+            << "  --preview <path>        预览图路径, 默认 preview.ppm\n"
+            << "  --preview-interval <s>  预览图写出间隔(秒), 默认 10\n"
+            << "  --threads <n>           渲染线程数, 默认使用全部硬件线程\n"
+            << "  --time-budget <s>       按时间预算(秒)渲染, 忽略每像素采样数\n"
+            << "  --stats-json <path>     以 JSON 格式写出性能计数器\n"
+            << "                          (需要 -DRTW_ENABLE_STATS=ON)\n"
+            << "  --heatmap <path>        输出每个像素求交代价的伪彩色热力图\n"
+            << "  --heatmap-cycles        热力图使用 CPU 周期数而不是遍历步数\n"
+            << "  --trace <path>          输出 Chrome trace 格式的各阶段耗时\n"
+            << "  --simd <level>          强制使用的指令集: scalar/sse42/avx2/avx512,\n"
+            << "                          默认使用 CPU 支持的最宽指令集(或环境变量 RTW_SIMD)\n"
+            << "  --packet <n>            相机光线按 4/8/16 条打包求交, 默认逐条求交\n"
+            << "  --wavefront             wavefront 渲染: 整批光线分阶段求交与着色\n"
+            << "  --wavefront-size <n>    wavefront 渲染每批的路径数, 默认 262144\n"
+            << "  --wavefront-sort        wavefront 渲染时按 Morton 码排序反射光线\n"
+            << "  --texel-format <f>      图片纹理的像素格式: rgb8/half/float, 默认 rgb8\n"
+            << "  --texel-layout <l>      图片纹理的像素排列: linear/tiled, 默认 linear\n"
+            << "  --texture-budget-mb <n> 使用核外纹理: 图片转换为分块纹理文件, 按需读入\n"
+            << "                          内存预算为 n MB 的共享块缓存\n"
+            << "  --tile-dir <dir>        分块纹理文件的目录, 默认 tiled_textures\n"
+            << "  --asset-report          渲染结束后输出资源缓存与块缓存的统计\n"
+            << "  --turbulence <m>        噪声纹理的紊流: exact/periodic/baked, 默认 exact.\n"
+            << "                          periodic 按周期平铺, baked 使用烘焙的平铺体纹理\n"
+            << "  --turbulence-resolution <n>  烘焙紊流每个坐标轴的采样数, 默认 128\n"
+            << "  --turbulence-period <n> 烘焙紊流的平铺周期(格点数), 默认 4\n"
+            << "\n"
+            << "网格渲染: ./RayTracingTheNextWeek mesh <网格.obj|.ply> [选项] > image.ppm\n"
+            << "  读取三角形网格, 放在网格地面上自动取景渲染, 选项与场景渲染相同\n"
+            << "\n"
+            << "基准测试: ./RayTracingTheNextWeek bench [选项] > result.json\n"
+            << "  以固定的种子, 分辨率和采样数渲染全部场景, 输出 JSON 结果\n"
+            << "  --width <n> --spp <n> --seed <n> --threads <n> --simd <level>\n"
+            << "  --refs <dir>            参考图像目录, 默认 bench/reference\n"
+            << "  --update-refs           用本次结果覆盖参考图像\n"
+            << "  --baseline <json>       与之前的结果比较渲染耗时\n"
+            << "  --time-tolerance <r>    允许的耗时增加比例, 默认 0.2\n"
+            << "  --min-psnr <dB>         与参考图像的最低 PSNR, 默认 40\n"
+            << "  --json <path>           JSON 结果的输出路径\n"
+            << "\n"
+            << "线程扩展性测试: ./RayTracingTheNextWeek scaling [选项]\n"
+            << "  以 1,2,4...N 个线程做强扩展和弱扩展测试, 输出 JSON 结果\n"
+            << "  --scene <id>            测试的场景, 默认 6\n"
+            << "  --max-threads <n>       最大线程数, 默认使用全部硬件线程\n"
+            << "  --width <n> --spp <n> --json <path>\n"
+            << "\n"
+            << "光线包测试: ./RayTracingTheNextWeek packets [选项]\n"
+            << "  以逐条光线和 4/8/16 条光线的光线包渲染场景 0,6,8, 输出 JSON 结果\n"
+            << "  --scene <id>            测试的场景, 可重复指定\n"
+            << "  --repeat <n>            每种配置的渲染次数(取最短耗时), 默认 3\n"
+            << "  --width <n> --spp <n> --threads <n> --simd <level> --json <path>\n"
+            << "\n"
+            << "光线排序测试: ./RayTracingTheNextWeek raysort [选项]\n"
+            << "  wavefront 渲染时排序/不排序反射光线, 比较求交吞吐量与缓存未命中数\n"
+            << "  --scene <id>            测试的场景, 可重复指定, 默认 0,8\n"
+            << "  --repeat <n>            每种配置的渲染次数(取最短耗时), 默认 3\n"
+            << "  --width <n> --spp <n> --threads <n> --json <path>\n"
+            << "\n"
+            << "纹理转换: ./RayTracingTheNextWeek convert <图片> <输出.rtwt>\n"
+            << "  把图片(包括 mip 层)转换为核外纹理使用的分块纹理文件\n"
+            << "\n"
+            << "纹理存储测试: ./RayTracingTheNextWeek textures [选项]\n"
+            << "  以每种像素排列与格式渲染地球贴图场景, 比较吞吐量, 内存与误差\n"
+            << "  --scene <id>            测试的场景, 默认 2\n"
+            << "  --repeat <n>            每种配置的渲染次数(取最短耗时), 默认 3\n"
+            << "  --width <n> --spp <n> --threads <n> --json <path>\n"
+            << "\n"
+            << "噪声测试: ./RayTracingTheNextWeek noise [选项]\n"
+            << "  比较逐个八度/各指令集并行八度/烘焙体纹理计算紊流的速度与误差,\n"
+            << "  以及三种紊流计算方式渲染噪声场景的耗时与 PSNR\n"
+            << "  --samples <n>           每种方法计算的采样点数, 默认 1000000\n"
+            << "  --resolution <n> --period <n>  烘焙的分辨率与周期, 默认 128, 4\n"
+            << "  --scene <id>            渲染的场景, 默认 3\n"
+            << "  --width <n> --spp <n> --threads <n> --json <path>\n"
+            << "\n"
+            << "实例化测试: ./RayTracingTheNextWeek instances [选项]\n"
+            << "  在网格上种共享同一底层 BVH 的树, 比较两层结构(instance_bvh)与\n"
+            << "  translate(rotate_y(...)) 包装的构建耗时, 内存与渲染耗时\n"
+            << "  --count <n>             实例数, 默认 1000000\n"
+            << "  --spheres <n>           每棵树的球数, 默认 64\n"
+            << "  --legacy                同时构建原来的包装对象比较(每层都要排序,\n"
+            << "                          构建较慢, 适合 --count 100000 以内)\n"
+            << "  --width <n> --spp <n> --threads <n> --json <path>\n";
+}
+
+// 解析 --simd 选项并切换热点函数使用的指令集
+bool parse_simd_option(const std::string& name) {
+  simd_level level;
+  if (!parse_simd_level(name, level)) {
+    std::clog << "未知的指令集: " << name << "\n";
+    print_usage();
+    return false;
+  }
+  set_simd_level(level);
+  return true;
+}
+
+/**
+ * @brief 场景基准测试模式: ./RayTracingTheNextWeek bench [选项]
+ *
+ * @return int 有回退时返回 1
+ */
+int scene_bench_main(int argc, char** argv) {
+  scene_bench_options opt;
+#ifdef RTW_BENCH_REFERENCE_DIR
+  opt.reference_dir = RTW_BENCH_REFERENCE_DIR;
+#else
+  opt.reference_dir = "bench/reference";
+#endif
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--seed" && has_value) {
+      opt.seed = static_cast<unsigned int>(std::atol(argv[++a]));
+    } else if (o == "--threads" && has_value) {
+      opt.thread_count = std::atoi(argv[++a]);
+    } else if (o == "--refs" && has_value) {
+      opt.reference_dir = argv[++a];
+    } else if (o == "--update-refs") {
+      opt.update_references = true;
+    } else if (o == "--baseline" && has_value) {
+      opt.baseline_path = argv[++a];
+    } else if (o == "--time-tolerance" && has_value) {
+      opt.time_tolerance = std::atof(argv[++a]);
+    } else if (o == "--min-psnr" && has_value) {
+      opt.min_psnr = std::atof(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else if (o == "--simd" && has_value) {
+      if (!parse_simd_option(argv[++a])) return -1;
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  return run_scene_bench(opt, scene_count, build_scene) > 0 ? 1 : 0;
+}
+
+/**
+ * @brief 线程扩展性测试模式: ./RayTracingTheNextWeek scaling [选项]
+ *
+ * @return int
+ */
+int scaling_bench_main(int argc, char** argv) {
+  scaling_bench_options opt;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--scene" && has_value) {
+      opt.scene_id = std::atoi(argv[++a]);
+    } else if (o == "--max-threads" && has_value) {
+      opt.max_threads = std::atoi(argv[++a]);
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  if (!valid_scene_id(opt.scene_id)) {
+    std::clog << "场景参数id需要在[0,9]之内.\n";
+    return -1;
+  }
+  run_scaling_bench(opt, build_scene);
+  return 0;
+}
+
+/**
+ * @brief 光线包测试模式: ./RayTracingTheNextWeek packets [选项]
+ *
+ * @return int
+ */
+int packet_bench_main(int argc, char** argv) {
+  packet_bench_options opt;
+  std::vector<int> scene_ids;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--scene" && has_value) {
+      scene_ids.push_back(std::atoi(argv[++a]));
+    } else if (o == "--repeat" && has_value) {
+      opt.repeat = std::atoi(argv[++a]);
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--threads" && has_value) {
+      opt.threads = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else if (o == "--simd" && has_value) {
+      if (!parse_simd_option(argv[++a])) return -1;
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  if (!scene_ids.empty()) opt.scene_ids = scene_ids;
+  for (int id : opt.scene_ids) {
+    if (!valid_scene_id(id)) {
+      std::clog << "场景参数id需要在[0,9]之内.\n";
+      return -1;
+    }
+  }
+  run_packet_bench(opt, build_scene);
+  return 0;
+}
+
+/**
+ * @brief 光线排序测试模式: ./RayTracingTheNextWeek raysort [选项]
+ *
+ * @return int
+ */
+int ray_sort_bench_main(int argc, char** argv) {
+  ray_sort_bench_options opt;
+  std::vector<int> scene_ids;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--scene" && has_value) {
+      scene_ids.push_back(std::atoi(argv[++a]));
+    } else if (o == "--repeat" && has_value) {
+      opt.repeat = std::atoi(argv[++a]);
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--threads" && has_value) {
+      opt.threads = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  if (!scene_ids.empty()) opt.scene_ids = scene_ids;
+  for (int id : opt.scene_ids) {
+    if (!valid_scene_id(id)) {
+      std::clog << "场景参数id需要在[0,9]之内.\n";
+      return -1;
+    }
+  }
+  run_ray_sort_bench(opt, build_scene);
+  return 0;
+}
+
+/**
+ * @brief 纹理存储测试模式: ./RayTracingTheNextWeek textures [选项]
+ *
+ * @return int
+ */
+int texture_bench_main(int argc, char** argv) {
+  texture_bench_options opt;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--scene" && has_value) {
+      opt.scene_id = std::atoi(argv[++a]);
+    } else if (o == "--repeat" && has_value) {
+      opt.repeat = std::atoi(argv[++a]);
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--threads" && has_value) {
+      opt.threads = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  if (!valid_scene_id(opt.scene_id)) {
+    std::clog << "场景参数id需要在[0,9]之内.\n";
+    return -1;
+  }
+  run_texture_bench(opt, build_scene);
+  return 0;
+}
+
+/**
+ * @brief 紊流测试模式: ./RayTracingTheNextWeek noise [选项]
+ *
+ * @return int
+ */
+int noise_bench_main(int argc, char** argv) {
+  noise_bench_options opt;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--samples" && has_value) {
+      opt.samples = std::atoi(argv[++a]);
+    } else if (o == "--resolution" && has_value) {
+      opt.turbulence.resolution = std::atoi(argv[++a]);
+    } else if (o == "--period" && has_value) {
+      opt.turbulence.period = std::atoi(argv[++a]);
+    } else if (o == "--scene" && has_value) {
+      opt.scene_id = std::atoi(argv[++a]);
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--threads" && has_value) {
+      opt.threads = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
       return -1;
+    }
+  }
+  int period = opt.turbulence.period;
+  if (period <= 0 || period > 256 || (period & (period - 1))) {
+    std::clog << "紊流的周期需要是不超过 256 的 2 的幂\n";
+    return -1;
+  }
+  if (!valid_scene_id(opt.scene_id)) {
+    std::clog << "场景参数id需要在[0,9]之内.\n";
+    return -1;
   }
+  run_noise_bench(opt, build_scene);
   return 0;
-}
\ No newline at end of file
+}
+
+int instance_bench_main(int argc, char** argv) {
+  instance_bench_options opt;
+  for (int a = 2; a < argc; a++) {
+    std::string o = argv[a];
+    bool has_value = a + 1 < argc;
+    if (o == "--count" && has_value) {
+      opt.count = std::atoi(argv[++a]);
+    } else if (o == "--spheres" && has_value) {
+      opt.spheres = std::atoi(argv[++a]);
+    } else if (o == "--legacy") {
+      opt.legacy = true;
+    } else if (o == "--width" && has_value) {
+      opt.image_width = std::atoi(argv[++a]);
+    } else if (o == "--spp" && has_value) {
+      opt.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (o == "--threads" && has_value) {
+      opt.threads = std::atoi(argv[++a]);
+    } else if (o == "--json" && has_value) {
+      opt.json_path = argv[++a];
+    } else {
+      std::clog << "未知选项: " << o << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+  run_instance_bench(opt);
+  return 0;
+}
+
+// 解析 --texel-format/--texel-layout/--texture-budget-mb/--tile-dir 与
+// --turbulence/--turbulence-resolution/--turbulence-period 选项,
+// 需要在构建场景之前调用
+bool parse_texel_options(int argc, char** argv) {
+  auto& storage = default_texel_storage();
+  auto& out_of_core = out_of_core_textures();
+  auto& turbulence = default_turbulence();
+  for (int a = 2; a + 1 < argc; a++) {
+    std::string o = argv[a];
+    if (o == "--texel-format" &&
+        !parse_texel_format(argv[a + 1], storage.format)) {
+      std::clog << "未知的像素格式: " << argv[a + 1] << "\n";
+      return false;
+    }
+    if (o == "--texel-layout" &&
+        !parse_texel_layout(argv[a + 1], storage.layout)) {
+      std::clog << "未知的像素排列: " << argv[a + 1] << "\n";
+      return false;
+    }
+    if (o == "--texture-budget-mb") {
+      double budget_mb = std::atof(argv[a + 1]);
+      if (!(budget_mb > 0)) {
+        std::clog << "纹理内存预算需要大于 0: " << argv[a + 1] << "\n";
+        return false;
+      }
+      out_of_core.budget_bytes = size_t(budget_mb * 1024 * 1024);
+    }
+    if (o == "--tile-dir") out_of_core.tile_dir = argv[a + 1];
+    if (o == "--turbulence" &&
+        !parse_turbulence_mode(argv[a + 1], turbulence.mode)) {
+      std::clog << "未知的紊流计算方式: " << argv[a + 1] << "\n";
+      return false;
+    }
+    if (o == "--turbulence-resolution") {
+      turbulence.resolution = std::max(1, std::atoi(argv[a + 1]));
+    }
+    if (o == "--turbulence-period") {
+      int period = std::atoi(argv[a + 1]);
+      if (period <= 0 || period > 256 || (period & (period - 1))) {
+        std::clog << "紊流的周期需要是不超过 256 的 2 的幂: " << argv[a + 1]
+                  << "\n";
+        return false;
+      }
+      turbulence.period = period;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    print_usage();
+    return -1;
+  }
+  if (std::string(argv[1]) == "bench") return scene_bench_main(argc, argv);
+  if (std::string(argv[1]) == "scaling") return scaling_bench_main(argc, argv);
+  if (std::string(argv[1]) == "packets") return packet_bench_main(argc, argv);
+  if (std::string(argv[1]) == "raysort") return ray_sort_bench_main(argc, argv);
+  if (std::string(argv[1]) == "textures") return texture_bench_main(argc, argv);
+  if (std::string(argv[1]) == "noise") return noise_bench_main(argc, argv);
+  if (std::string(argv[1]) == "instances")
+    return instance_bench_main(argc, argv);
+  if (std::string(argv[1]) == "convert") {
+    if (argc != 4) {
+      print_usage();
+      return -1;
+    }
+    auto source = asset_cache::instance().resolve(argv[2]);
+    return tiled_texture_file::convert(source, argv[3]) ? 0 : 1;
+  }
+  bool mesh_mode = std::string(argv[1]) == "mesh";
+  if (mesh_mode && argc < 3) {
+    print_usage();
+    return -1;
+  }
+  int scene_id = int(argv[1][0] - '0');
+  // 渲染选项的起始位置, mesh 子命令的第一个参数是网格文件
+  int first_option = mesh_mode ? 3 : 2;
+
+  // 先解析 --trace, 以便记录场景构建的耗时
+  std::string trace_path;
+  for (int a = first_option; a + 1 < argc; a++) {
+    if (std::string(argv[a]) == "--trace") trace_path = argv[a + 1];
+  }
+  if (!trace_path.empty()) tracer::instance().enable();
+  if (!parse_texel_options(argc, argv)) {
+    print_usage();
+    return -1;
+  }
+
+  hittable_list world;
+  camera cam;
+  bool scene_ok;
+  {
+    trace_scope scope("build_scene", "scene", scene_id);
+    scene_ok = mesh_mode ? mesh_scene(world, cam, argv[2])
+                         : argv[1][1] == '\0' && build_scene(scene_id, world, cam);
+  }
+  if (mesh_mode && !scene_ok) return 1;
+  if (!scene_ok) {
+    std::clog << "场景参数id需要在[0,9]之内."
+              << "\n";
+    print_usage();
+    return -1;
+  }
+
+  // 命令行选项覆盖场景中的相机设置
+  bool asset_report = false;
+  for (int a = first_option; a < argc; a++) {
+    std::string opt = argv[a];
+    bool has_value = a + 1 < argc;
+    if (opt == "--width" && has_value) {
+      cam.image_width = std::atoi(argv[++a]);
+    } else if (opt == "--spp" && has_value) {
+      cam.samples_per_pixel = std::atoi(argv[++a]);
+    } else if (opt == "--progressive") {
+      cam.progressive = true;
+    } else if (opt == "--preview" && has_value) {
+      cam.preview_path = argv[++a];
+    } else if (opt == "--preview-interval" && has_value) {
+      cam.preview_interval = std::atof(argv[++a]);
+    } else if (opt == "--threads" && has_value) {
+      cam.thread_count = std::atoi(argv[++a]);
+    } else if (opt == "--time-budget" && has_value) {
+      cam.time_budget = std::atof(argv[++a]);
+    } else if (opt == "--stats-json" && has_value) {
+      cam.stats_json_path = argv[++a];
+    } else if (opt == "--heatmap" && has_value) {
+      cam.heatmap_path = argv[++a];
+    } else if (opt == "--heatmap-cycles") {
+      cam.heatmap_cycles = true;
+    } else if (opt == "--trace" && has_value) {
+      ++a;  // 已在前面处理
+    } else if (opt == "--simd" && has_value) {
+      if (!parse_simd_option(argv[++a])) return -1;
+    } else if (opt == "--packet" && has_value) {
+      cam.packet_size = std::atoi(argv[++a]);
+    } else if (opt == "--wavefront") {
+      cam.wavefront = true;
+    } else if (opt == "--wavefront-size" && has_value) {
+      cam.wavefront_size = std::atoi(argv[++a]);
+    } else if (opt == "--wavefront-sort") {
+      cam.wavefront_sort = true;
+    } else if (opt == "--asset-report") {
+      asset_report = true;
+    } else if ((opt == "--texel-format" || opt == "--texel-layout" ||
+                opt == "--texture-budget-mb" || opt == "--tile-dir" ||
+                opt == "--turbulence" || opt == "--turbulence-resolution" ||
+                opt == "--turbulence-period") &&
+               has_value) {
+      ++a;  // 已在前面处理
+    } else {
+      std::clog << "未知选项: " << opt << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+
+  if (cam.wavefront && (cam.progressive || cam.time_budget > 0)) {
+    std::clog << "--wavefront 不能与 --progressive 或 --time-budget 同时使用\n";
+    print_usage();
+    return -1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  cam.render(world);
+  auto finish = std::chrono::steady_clock::now();
+  std::clog << "Elapsed:"
+            << std::chrono::duration<double>(finish - start).count() << "\n";
+  if (asset_report) {
+    asset_cache::instance().report(std::clog);
+    report_tile_cache(std::clog);
+  }
+  if (!trace_path.empty()) tracer::instance().write_json(trace_path);
+  return 0;
+}